@@ -1,11 +1,16 @@
 
 #include "fs.h"
 
+// Blocks currently resident in the cache, replaced in clock order.
+// A zero entry is an empty slot (block 0 is never cached).
+static uint64_t bc_slots[BC_NSLOTS];
+static size_t bc_hand;
+
 // Return the virtual address of this disk block.
 void *
-diskaddr(uint32_t blockno) {
+diskaddr(uint64_t blockno) {
   if (blockno == 0 || (super && blockno >= super->s_nblocks))
-    panic("bad block number %08x in diskaddr", blockno);
+    panic("bad block number %08lx in diskaddr", (unsigned long)blockno);
   void *r = (void *)(uintptr_t)(DISKMAP + blockno * BLKSIZE);
 #ifdef SANITIZE_USER_SHADOW_BASE
   platform_asan_unpoison(r, BLKSIZE);
@@ -13,6 +18,12 @@ diskaddr(uint32_t blockno) {
   return r;
 }
 
+// Return the number of the disk block mapped at this virtual address.
+uint64_t
+addr2blockno(void *addr) {
+  return ((uintptr_t)addr - (uintptr_t)DISKMAP) / BLKSIZE;
+}
+
 // Is this virtual address mapped?
 bool
 va_is_mapped(void *va) {
@@ -26,12 +37,81 @@ va_is_dirty(void *va) {
   return (uvpt[PGNUM(va)] & PTE_D) != 0;
 }
 
+// The super block and the bitmap are referenced through long-lived
+// pointers on every allocation, so they stay resident for good.
+static bool
+bc_pinned(uint64_t blockno) {
+  return blockno < 2 || (super && blockno < 2 + (super->s_nblocks + BLKBITSIZE - 1) / BLKBITSIZE);
+}
+
+// Find a cache slot for a newly faulted block, evicting the first block
+// the clock hand finds that has not been accessed since the last sweep.
+// Dirty victims are written back before they are unmapped; since every
+// block keeps its fixed address, a later access simply faults it in again.
+static uint64_t *
+bc_slot_alloc(void) {
+  uint64_t *slot;
+  void *va;
+  int r;
+
+  for (;;) {
+    slot    = &bc_slots[bc_hand];
+    bc_hand = (bc_hand + 1) % BC_NSLOTS;
+
+    if (*slot == 0)
+      return slot;
+    va = diskaddr(*slot);
+    if (!va_is_mapped(va))
+      return slot;
+    if (bc_pinned(*slot) || jnl_pinned(*slot))
+      continue;
+
+    if (uvpt[PGNUM(va)] & PTE_A) {
+      // Second chance: remapping clears the accessed bit.
+      if (va_is_dirty(va))
+        flush_block(va);
+      else if ((r = sys_page_map(0, va, 0, va, uvpt[PGNUM(va)] & PTE_SYSCALL)) < 0)
+        panic("bc_slot_alloc: sys_page_map: %i", r);
+      continue;
+    }
+
+    flush_block(va);
+    // That may have made it part of the running transaction.
+    if (jnl_pinned(*slot))
+      continue;
+    jnl_evict(*slot);
+    if (ioq_pending(*slot))
+      ioq_drain();
+    if ((r = sys_page_unmap(0, va)) < 0)
+      panic("bc_slot_alloc: sys_page_unmap: %i", r);
+    return slot;
+  }
+}
+
+// Replace the shared page of the cached block at addr with a private
+// writable copy.  It is clean: the block was written back when it was
+// shared and the page has been read-only since.
+static void
+bc_unshare(void *addr) {
+  int r;
+
+  if ((r = sys_page_alloc(0, PFTEMP, PTE_P | PTE_U | PTE_W)) < 0)
+    panic("bc_unshare: sys_page_alloc: %i", r);
+  memmove(PFTEMP, addr, BLKSIZE);
+  if ((r = sys_page_map(0, PFTEMP, 0, addr, PTE_P | PTE_U | PTE_W)) < 0)
+    panic("bc_unshare: sys_page_map: %i", r);
+  if ((r = sys_page_unmap(0, PFTEMP)) < 0)
+    panic("bc_unshare: sys_page_unmap: %i", r);
+  fsstats.rd_cowfaults++;
+}
+
 // Fault any disk block that is read in to memory by
 // loading it from disk.
 static void
 bc_pgfault(struct UTrapframe *utf) {
   void *addr       = (void *)utf->utf_fault_va;
-  uint32_t blockno = (uint32_t)((uintptr_t)addr - (uintptr_t)DISKMAP) / BLKSIZE;
+  uint64_t blockno = addr2blockno(addr);
+  uint64_t *slot;
 
   // Check that the fault was within the block cache region
   if (addr < (void *)DISKMAP || addr >= (void *)(DISKMAP + DISKSIZE))
@@ -40,7 +120,16 @@ bc_pgfault(struct UTrapframe *utf) {
 
   // Sanity check the block number.
   if (super && blockno >= super->s_nblocks)
-    panic("reading non-existent block %08x out of %08x\n", blockno, super->s_nblocks);
+    panic("reading non-existent block %08lx out of %08x\n", (unsigned long)blockno, super->s_nblocks);
+
+  // A write to a block that is also mapped into clients (see bc_share)
+  // goes to a private copy of the page, so the clients keep seeing the
+  // data they read.
+  if ((utf->utf_err & (FEC_PR | FEC_WR)) == (FEC_PR | FEC_WR) &&
+      (uvpt[PGNUM(addr)] & PTE_COW)) {
+    bc_unshare(ROUNDDOWN(addr, PGSIZE));
+    return;
+  }
 
   // Allocate a page in the disk map region, read the contents
   // of the block from the disk into that page.
@@ -48,55 +137,103 @@ bc_pgfault(struct UTrapframe *utf) {
   // the disk.
   //
   // LAB 10: Your code here.
+  //
+  // The read may let other requests run while the disk is busy (see
+  // ide_read), so it goes to a scratch page of our own; the block only
+  // joins the cache once it is complete.  Another request may have
+  // loaded it in the meantime.
   addr = ROUNDDOWN(addr, PGSIZE);
+  void *scratch = serve_scratch();
   int return_code;
-  if ((return_code = sys_page_alloc(0, addr, PTE_W)) < 0) {
+  if ((return_code = sys_page_alloc(0, scratch, PTE_W)) < 0) {
     panic("bc_pgfault: sys_page_alloc: %i", return_code);
   }
-  if ((return_code = ide_read(blockno * BLKSECTS, addr, BLKSECTS)) < 0) {
+  if ((return_code = ioq_read(blockno, scratch, 1)) < 0) {
     panic("bc_pgfault: ide_red: %i", return_code);
   }
+  if (va_is_mapped(addr)) {
+    sys_page_unmap(0, scratch);
+    return;
+  }
 
-  // clear dirty bit
-  if ((return_code = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0) {
+  // Make room for the block if the cache is full.
+  slot = bc_slot_alloc();
+
+  // The new mapping starts out clean.
+  if ((return_code = sys_page_map(0, scratch, 0, addr, PTE_P | PTE_U | PTE_W)) < 0) {
     panic("bc_pgfault: sys_page_map: %i", return_code);
   }
+  sys_page_unmap(0, scratch);
+  *slot = blockno;
+
   // check that the block we read was allocated
   if (bitmap && block_is_free(blockno)) {
-    panic("reading free block %08x\n", blockno);
+    panic("reading free block %08lx\n", (unsigned long)blockno);
   }
 }
 
 // Flush the contents of the block containing VA out to disk if
 // necessary, then clear the PTE_D bit using sys_page_map.
 // If the block is not in the block cache or is not dirty, does
-// nothing.
+// nothing.  The write is queued (see ioq.c); it reaches the disk by
+// the next ioq_drain.  A block the journal has yet to write home is
+// added to the running transaction instead (see journal.c).
 // Hint: Use va_is_mapped, va_is_dirty, and ide_write.
 // Hint: Use the PTE_SYSCALL constant when calling sys_page_map.
 // Hint: Don't forget to round addr down.
 void
 flush_block(void *addr) {
-  uint32_t blockno = (uint32_t)((uintptr_t)addr - (uintptr_t)DISKMAP) / BLKSIZE;
+  uint64_t blockno = addr2blockno(addr);
 
   if (addr < (void *)(uintptr_t)DISKMAP || addr >= (void *)(uintptr_t)(DISKMAP + DISKSIZE))
     panic("flush_block of bad va %p", addr);
   if (super && blockno >= super->s_nblocks)
-    panic("reading non-existent block %08x out of %08x\n", blockno, super->s_nblocks);
+    panic("reading non-existent block %08lx out of %08x\n", (unsigned long)blockno, super->s_nblocks);
 
   // LAB 10: Your code here.
   addr = ROUNDDOWN(addr, PGSIZE);
   if (!va_is_mapped(addr) || !va_is_dirty(addr)) {
     return;
   }
-  int return_code;
-  if ((return_code = ide_write(blockno * BLKSECTS, addr, BLKSECTS)) < 0) {
-    panic("flush_block: ide_write :%i", return_code);
+  if (jnl_owns(blockno)) {
+    jnl_add(addr);
+    return;
   }
+  int return_code;
+  ioq_write(blockno);
   if ((return_code = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0) {
     panic("flush_block: sys_page_map: %i", return_code);
   }
 }
 
+// Get the cached block at addr ready to be mapped into a client: bring
+// it in, write it back if it is dirty, and make our own mapping
+// read-only copy-on-write so that a later change to the block does not
+// show through to the client.  Returns 0 or < 0 on error.
+int
+bc_share(void *addr) {
+  addr = ROUNDDOWN(addr, PGSIZE);
+  // Fault the block in if it is not resident.
+  (void)*(volatile char *)addr;
+  if (uvpt[PGNUM(addr)] & PTE_COW)
+    return 0;
+  flush_block(addr);
+  return sys_page_map(0, addr, 0, addr,
+                      ((uvpt[PGNUM(addr)] & PTE_SYSCALL) & ~PTE_W) | PTE_COW);
+}
+
+// Write back every dirty block in the cache.  Only resident blocks can
+// be dirty, so this walks the cache slots rather than the whole disk.
+void
+bc_sync(void) {
+  size_t i;
+
+  for (i = 0; i < BC_NSLOTS; i++)
+    if (bc_slots[i] && va_is_mapped(diskaddr(bc_slots[i])))
+      flush_block(diskaddr(bc_slots[i]));
+  ioq_drain();
+}
+
 // Test that the block cache works, by smashing the superblock and
 // reading it back.
 static void
@@ -113,6 +250,7 @@ check_bc(void) {
   assert(!va_is_dirty(diskaddr(1)));
 
   // clear it out
+  ioq_drain();
   sys_page_unmap(0, diskaddr(1));
   assert(!va_is_mapped(diskaddr(1)));
 
@@ -0,0 +1,68 @@
+#include "fs.h"
+
+// Name lookup cache.
+// Remembers, for a (directory, name) pair, the directory entry that
+// name resolved to, or that it did not resolve at all, so that
+// walk_path does not search the same directories on every open.
+// Entries are direct mapped by the directory and the name hash; a new
+// entry simply replaces whatever shared its slot.
+//
+// Directory entries never move while they are in use, so a cached
+// struct File pointer stays valid until the entry is freed, and the
+// callers that free or add entries keep the cache up to date.
+
+#define DCACHE_SIZE 4096
+
+struct Dentry {
+  struct File *d_dir;  // directory searched, 0 if the slot is unused
+  struct File *d_file; // entry found, 0 for a negative entry
+  uint32_t d_hash;     // fs_name_hash(d_name)
+  char d_name[MAXNAMELEN];
+};
+
+static struct Dentry dcache[DCACHE_SIZE];
+
+static struct Dentry *
+dcache_slot(struct File *dir, uint32_t hash) {
+  uint32_t h = hash ^ (uint32_t)((uintptr_t)dir / sizeof(struct File)) * 0x9E3779B1U;
+  return &dcache[h % DCACHE_SIZE];
+}
+
+// Look up name in dir.  Returns true on a hit and sets *file to the
+// entry, or to 0 if name is known not to exist.  Returns false if the
+// cache knows nothing about it.
+bool
+dcache_lookup(struct File *dir, const char *name, uint32_t hash, struct File **file) {
+  struct Dentry *d = dcache_slot(dir, hash);
+
+  if (d->d_dir != dir || d->d_hash != hash || strcmp(d->d_name, name) != 0) {
+    fsstats.dc_misses++;
+    return 0;
+  }
+  if (d->d_file)
+    fsstats.dc_hits++;
+  else
+    fsstats.dc_neg_hits++;
+  *file = d->d_file;
+  return 1;
+}
+
+// Record that name in dir resolves to file (0 if it does not exist).
+void
+dcache_insert(struct File *dir, const char *name, uint32_t hash, struct File *file) {
+  struct Dentry *d = dcache_slot(dir, hash);
+
+  d->d_dir  = dir;
+  d->d_file = file;
+  d->d_hash = hash;
+  strcpy(d->d_name, name);
+}
+
+// Forget everything.  Needed when a directory loses its entries
+// wholesale: the freed blocks may later hold other directories, whose
+// entries would then alias cached parents.
+void
+dcache_flush(void) {
+  memset(dcache, 0, sizeof(dcache));
+  fsstats.dc_flushes++;
+}
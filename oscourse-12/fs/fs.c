@@ -16,9 +16,12 @@ check_super(void) {
   if (super->s_magic != FS_MAGIC)
     panic("bad file system magic number");
 
-  if (super->s_nblocks > DISKSIZE / BLKSIZE)
+  if ((uint64_t)super->s_nblocks > DISKSIZE / BLKSIZE)
     panic("file system is too large");
 
+  if (super->s_version > FS_VERSION)
+    panic("unsupported file system version %u", super->s_version);
+
   cprintf("superblock is good\n");
 }
 
@@ -29,7 +32,7 @@ check_super(void) {
 // Check to see if the block bitmap indicates that block 'blockno' is free.
 // Return 1 if the block is free, 0 if not.
 bool
-block_is_free(uint32_t blockno) {
+block_is_free(uint64_t blockno) {
   if (super == 0 || blockno >= super->s_nblocks)
     return 0;
   if (bitmap[blockno / 32] & (1U << (blockno % 32)))
@@ -37,38 +40,127 @@ block_is_free(uint32_t blockno) {
   return 0;
 }
 
+// A directory hash index could not be built for want of free blocks.
+// No build is tried again until a block is freed; until then large
+// directories are scanned.
+static bool dir_index_nospace;
+
 // Mark a block free in the bitmap
 void
-free_block(uint32_t blockno) {
+free_block(uint64_t blockno) {
   // Blockno zero is the null pointer of block numbers.
   if (blockno == 0)
     panic("attempt to free zero block");
   bitmap[blockno / 32] |= 1U << (blockno % 32);
+  jnl_add(&bitmap[blockno / 32]);
+  dir_index_nospace = 0;
+}
+
+// Where allocations without a placement preference start searching.
+// It moves past every block handed out that way, so new files are laid
+// out one after another instead of all competing for the lowest free
+// blocks (and for the room the files before them need to grow into).
+static uint64_t alloc_cursor;
+
+// Return the first free block in [start, end), or -1 if there is none.
+// The bitmap is scanned a 64-bit word at a time.
+static int64_t
+bitmap_scan(uint64_t start, uint64_t end) {
+  const uint64_t *words = (const uint64_t *)bitmap;
+  uint64_t i, w, blockno;
+
+  if (start >= end)
+    return -1;
+  i = start / 64;
+  w = words[i] & (~0ULL << (start % 64));
+  while (!w) {
+    if (++i * 64 >= end)
+      return -1;
+    w = words[i];
+  }
+  // Bits past the end of the disk may be set in the last bitmap word.
+  blockno = i * 64 + __builtin_ctzll(w);
+  return blockno < end ? blockno : -1;
+}
+
+// Return the first free block in [start, end) that the journal does
+// not hold, or -1 if there is none.  Sets *held if it skipped any.
+static int64_t
+alloc_scan(uint64_t start, uint64_t end, bool *held) {
+  int64_t blockno;
+
+  while ((blockno = bitmap_scan(start, end)) >= 0 && jnl_owns(blockno)) {
+    *held = 1;
+    start = blockno + 1;
+  }
+  return blockno;
 }
 
 // Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
+// allocate a block, hand the changed bitmap block to the journal.
+//
+// The search starts at block 'goal' and moves forward from there,
+// wrapping around at the end of the disk, so a caller that asks for the
+// block right after the last one it got keeps its blocks contiguous.
+// A zero goal means no preference: the search starts at the rotating
+// allocation cursor.
+//
+// Freed blocks the journal still has a copy of are skipped: replay
+// after a crash would write that copy over whatever the block was
+// reused for.  They come back at the next checkpoint.
 //
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
-//
-// Hint: use free_block as an example for manipulating the bitmap.
-int
-alloc_block(void) {
+int64_t
+alloc_block_near(uint64_t goal) {
   // The bitmap consists of one or more blocks.  A single bitmap block
   // contains the in-use bits for BLKBITSIZE blocks.  There are
   // super->s_nblocks blocks in the disk altogether.
+  int64_t blockno;
+  bool rotate = (goal == 0);
+  bool held;
 
-  // LAB 10: Your code here.
-  for (int i = 0; i < super->s_nblocks; ++i) {
-    if (block_is_free(i)) {
-      bitmap[i / 32] &= ~(1 << (i % 32));
-      flush_block(&bitmap[i / 32]);
-      return i;
-    }
+  if (rotate || goal >= super->s_nblocks)
+    goal = alloc_cursor;
+  for (;;) {
+    held = 0;
+    if ((blockno = alloc_scan(goal, super->s_nblocks, &held)) >= 0 ||
+        (blockno = alloc_scan(0, goal, &held)) >= 0)
+      break;
+    if (!held || !jnl_reclaim())
+      return -E_NO_DISK;
+  }
+
+  bitmap[blockno / 32] &= ~(1U << (blockno % 32));
+  jnl_add(&bitmap[blockno / 32]);
+  if (rotate)
+    alloc_cursor = blockno + 1;
+  return blockno;
+}
+
+// Start the allocation cursor just past the last block in use, so new
+// files go to the free space at the end of the disk and any gaps left
+// after existing files stay free for those files to grow into.
+static void
+alloc_cursor_init(void) {
+  const uint64_t *words = (const uint64_t *)bitmap;
+  uint64_t b = super->s_nblocks;
+
+  while (b > 0) {
+    if (b % 64 == 0 && words[b / 64 - 1] == ~0ULL)
+      b -= 64;
+    else if (block_is_free(b - 1))
+      b--;
+    else
+      break;
   }
-  return -E_NO_DISK;
+  alloc_cursor = b;
+}
+
+// Allocate a block with no placement preference.
+int64_t
+alloc_block(void) {
+  return alloc_block_near(0);
 }
 
 // Validate the file system bitmap.
@@ -90,6 +182,248 @@ check_bitmap(void) {
   cprintf("bitmap is good\n");
 }
 
+// --------------------------------------------------------------
+// Extent maps
+// --------------------------------------------------------------
+
+// Return a pointer to the i'th extent of file f.  The extent block
+// holding it must already be allocated (see extent_reserve).
+static struct Extent *
+extent_get(struct File *f, uint32_t i) {
+  uint64_t *index;
+
+  if (i < NEXTENT)
+    return &f->f_extents[i];
+  i -= NEXTENT;
+  index = diskaddr(f->f_extblock);
+  return (struct Extent *)diskaddr(index[i / EXTPERBLK]) + i % EXTPERBLK;
+}
+
+// Return the index of the last extent of f that starts at or before
+// file block 'filebno', or -1 if there is none.
+static int64_t
+extent_lookup(struct File *f, uint32_t filebno) {
+  int64_t lo = 0, hi = (int64_t)f->f_nextents - 1, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (extent_get(f, mid)->e_lblk <= filebno)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return hi;
+}
+
+// Does extent e cover file block 'filebno'?
+static bool
+extent_covers(struct Extent *e, uint32_t filebno) {
+  return filebno >= e->e_lblk && filebno - e->e_lblk < e->e_len;
+}
+
+// Allocate a block for file system metadata and clear it.
+static int64_t
+alloc_zeroed_block(void) {
+  int64_t blockno;
+
+  if ((blockno = alloc_block()) < 0)
+    return blockno;
+  clear_page(diskaddr(blockno));
+  return blockno;
+}
+
+// Make sure file f has room for 'n' extents, allocating the extent
+// index block and extent blocks as necessary.  Extent blocks are always
+// allocated in index order, so only the tail needs checking.
+static int
+extent_reserve(struct File *f, uint32_t n) {
+  uint64_t *index;
+  int64_t blockno;
+  uint32_t i;
+
+  if (n > MAXEXTENTS)
+    return -E_NO_DISK;
+  if (n <= NEXTENT)
+    return 0;
+
+  if (!f->f_extblock) {
+    if ((blockno = alloc_zeroed_block()) < 0)
+      return blockno;
+    f->f_extblock = blockno;
+  }
+  index = diskaddr(f->f_extblock);
+  for (i = (n - NEXTENT + EXTPERBLK - 1) / EXTPERBLK; i-- > 0 && !index[i];) {
+    if ((blockno = alloc_zeroed_block()) < 0)
+      return blockno;
+    index[i] = blockno;
+  }
+  return 0;
+}
+
+// Release the extent blocks, and possibly the extent index block,
+// that file f no longer needs for its f_nextents extents.
+static void
+extent_trim(struct File *f) {
+  uint64_t *index;
+  uint32_t i, need;
+
+  if (!f->f_extblock)
+    return;
+
+  need = 0;
+  if (f->f_nextents > NEXTENT)
+    need = (f->f_nextents - NEXTENT + EXTPERBLK - 1) / EXTPERBLK;
+  index = diskaddr(f->f_extblock);
+  for (i = need; i < NEXTBLK && index[i]; i++) {
+    free_block(index[i]);
+    index[i] = 0;
+  }
+  if (!need) {
+    free_block(f->f_extblock);
+    f->f_extblock = 0;
+  }
+}
+
+// Insert extent 'e' into file f at index i, shifting later extents up.
+static int
+extent_insert(struct File *f, uint32_t i, struct Extent e) {
+  uint32_t j;
+  int r;
+
+  if ((r = extent_reserve(f, f->f_nextents + 1)) < 0)
+    return r;
+  for (j = f->f_nextents; j > i; j--)
+    *extent_get(f, j) = *extent_get(f, j - 1);
+  *extent_get(f, i) = e;
+  f->f_nextents++;
+  return 0;
+}
+
+// Remove the i'th extent of file f, shifting later extents down.
+static void
+extent_delete(struct File *f, uint32_t i) {
+  for (; i + 1 < f->f_nextents; i++)
+    *extent_get(f, i) = *extent_get(f, i + 1);
+  f->f_nextents--;
+  extent_trim(f);
+}
+
+// Record that file block 'filebno' of f, which must not be mapped yet,
+// is stored in disk block 'diskbno'.  A block that continues the
+// preceding extent (or precedes the following one) on disk just grows
+// that extent, so sequentially allocated files stay a single extent.
+static int
+extent_map(struct File *f, uint32_t filebno, uint64_t diskbno) {
+  struct Extent *prev = NULL, *next = NULL;
+  int64_t i;
+
+  i = extent_lookup(f, filebno);
+  if (i >= 0)
+    prev = extent_get(f, i);
+  if (i + 1 < f->f_nextents)
+    next = extent_get(f, i + 1);
+
+  if (prev && (uint64_t)prev->e_lblk + prev->e_len == filebno &&
+      prev->e_pblk + prev->e_len == diskbno && prev->e_len < UINT32_MAX) {
+    prev->e_len++;
+    // The new block may have closed the gap to the next extent.
+    if (next && next->e_lblk == filebno + 1 && next->e_pblk == diskbno + 1 &&
+        (uint64_t)prev->e_len + next->e_len <= UINT32_MAX) {
+      prev->e_len += next->e_len;
+      extent_delete(f, i + 1);
+    }
+    return 0;
+  }
+  if (next && next->e_lblk == filebno + 1 && next->e_pblk == diskbno + 1 &&
+      next->e_len < UINT32_MAX) {
+    next->e_lblk--;
+    next->e_pblk--;
+    next->e_len++;
+    return 0;
+  }
+  return extent_insert(f, i + 1, (struct Extent){filebno, 1, diskbno});
+}
+
+// --------------------------------------------------------------
+// Conversion of block map file systems
+// --------------------------------------------------------------
+
+// File descriptor layout of FS_VERSION_BLOCKMAP file systems
+struct BlockMapFile {
+  char f_name[MAXNAMELEN];
+  int32_t f_size;
+  uint32_t f_type;
+  uint32_t f_direct[NDIRECT];
+  uint32_t f_indirect;
+  uint8_t f_pad[256 - MAXNAMELEN - 8 - 4 * NDIRECT - 4];
+} __attribute__((packed));
+
+// Rewrite the block map descriptor stored at f as an extent map,
+// in place, and free its indirect block.
+static void
+fs_convert_file(struct File *f) {
+  struct BlockMapFile old;
+  uint32_t i, nblocks;
+  uint64_t diskbno;
+  int r;
+
+  static_assert(sizeof(struct BlockMapFile) == sizeof(struct File), "Unsupported file size");
+
+  memmove(&old, f, sizeof(old));
+  memset((char *)f + MAXNAMELEN, 0, sizeof(*f) - MAXNAMELEN);
+  f->f_size = old.f_size;
+  f->f_type = old.f_type;
+  f->f_hash = fs_name_hash(f->f_name);
+
+  nblocks = MIN((old.f_size + BLKSIZE - 1) / BLKSIZE, NDIRECT + NINDIRECT);
+  for (i = 0; i < nblocks; i++) {
+    if (i < NDIRECT)
+      diskbno = old.f_direct[i];
+    else if (old.f_indirect)
+      diskbno = ((uint32_t *)diskaddr(old.f_indirect))[i - NDIRECT];
+    else
+      break;
+    if (diskbno && (r = extent_map(f, i, diskbno)) < 0)
+      panic("fs_convert_file %s: %i", f->f_name, r);
+  }
+  if (old.f_indirect)
+    free_block(old.f_indirect);
+}
+
+// Convert every file in the (already converted) directory dir.
+static void
+fs_convert_dir(struct File *dir) {
+  uint32_t i, j, nblock;
+  struct File *f;
+  char *blk;
+  int r;
+
+  nblock = dir->f_size / BLKSIZE;
+  for (i = 0; i < nblock; i++) {
+    if ((r = file_get_block(dir, i, &blk)) < 0)
+      panic("fs_convert_dir %s: %i", dir->f_name, r);
+    f = (struct File *)blk;
+    for (j = 0; j < BLKFILES; j++) {
+      if (f[j].f_name[0] == '\0')
+        continue;
+      fs_convert_file(&f[j]);
+      if (f[j].f_type == FTYPE_DIR)
+        fs_convert_dir(&f[j]);
+    }
+  }
+}
+
+// Upgrade a file system written with direct and indirect block
+// pointers to the extent layout and write it back.
+static void
+fs_convert(void) {
+  cprintf("converting file system to extents\n");
+  fs_convert_file(&super->s_root);
+  fs_convert_dir(&super->s_root);
+  super->s_version = FS_VERSION_EXTENTS;
+  fs_sync();
+}
+
 // --------------------------------------------------------------
 // File system structures
 // --------------------------------------------------------------
@@ -109,52 +443,106 @@ fs_init(void) {
   // Set "super" to point to the super block.
   super = diskaddr(1);
   check_super();
+  // Replaying the journal may change the bitmap and any directory.
+  if (super->s_version >= FS_VERSION_JOURNAL)
+    jnl_init();
 
   // Set "bitmap" to the beginning of the first bitmap block.
   bitmap = diskaddr(2);
   check_bitmap();
+  alloc_cursor_init();
+
+  if (super->s_version == FS_VERSION_BLOCKMAP)
+    fs_convert();
+  if (super->s_version < FS_VERSION) {
+    // Images older than FS_VERSION_JOURNAL have no journal.
+    super->s_journal = 0;
+    super->s_jblocks = 0;
+    super->s_version = FS_VERSION;
+    flush_block(super);
+  }
 }
 
-// Find the disk block number slot for the 'filebno'th block in file 'f'.
-// Set '*ppdiskbno' to point to that slot.
-// The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
-// if necessary.
+static int file_uninline(struct File *f);
+static void file_log(struct File *f);
+static void extent_log(struct File *f);
+
+// Find the disk block backing the 'filebno'th block in file 'f'
+// and store its number in '*pdiskbno'.
+// When 'alloc' is set and that block of the file is a hole, this
+// function allocates a block for it, preferring the disk block that
+// follows the one backing the preceding part of the file.
 //
 // Returns:
-//	0 on success (but note that *ppdiskbno might equal 0).
-//	-E_NOT_FOUND if the function needed to allocate an indirect block, but
-//		alloc was 0.
-//	-E_NO_DISK if there's no space on the disk for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NDIRECT + NINDIRECT).
+//	0 on success (but note that *pdiskbno might equal 0).
+//	-E_NO_DISK if there's no space on the disk for the block or for
+//		the extent blocks needed to describe it.
+//	-E_INVAL if filebno is out of range (it's >= MAXFILESIZE / BLKSIZE).
+// Inline files have no blocks; allocating one moves their data out to
+// block storage first.
 //
 // Analogy: This is like pgdir_walk for files.
-// Hint: Don't forget to clear any block you allocate.
 int
-file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc) {
-  // LAB 10: Your code here.
-  int newb;
+file_block_walk(struct File *f, uint32_t filebno, uint64_t *pdiskbno, bool alloc) {
+  struct Extent *e;
+  uint64_t goal = 0;
+  int64_t i, newb;
+  int r;
 
-  if (filebno >= NDIRECT + NINDIRECT) {
+  if (filebno >= MAXFILESIZE / BLKSIZE)
     return -E_INVAL;
+
+  *pdiskbno = 0;
+  if (f->f_flags & FILE_INLINE) {
+    if (!alloc)
+      return 0;
+    if ((r = file_uninline(f)) < 0)
+      return r;
   }
-  if (filebno < NDIRECT) {
-    *ppdiskbno = f->f_direct + filebno; 
-  } else {
-    if (!f->f_indirect) {
-      if (!alloc) {
-        return -E_NOT_FOUND;
-      }
-      if ((newb = alloc_block()) < 0) {
-        return -E_NOT_FOUND;
-      } else {
-        f->f_indirect = newb;
-        memset(diskaddr(f->f_indirect), 0, BLKSIZE);
-      }
+  if ((i = extent_lookup(f, filebno)) >= 0) {
+    e = extent_get(f, i);
+    goal = e->e_pblk + (filebno - e->e_lblk);
+    if (extent_covers(e, filebno)) {
+      *pdiskbno = goal;
+      return 0;
     }
-    *ppdiskbno = (uint32_t *)diskaddr(f->f_indirect) + filebno - NDIRECT;
   }
+  if (!alloc)
+    return 0;
+
+  if ((newb = alloc_block_near(goal)) < 0)
+    return -E_NO_DISK;
+  clear_page(diskaddr(newb));
+  if ((r = extent_map(f, filebno, newb)) < 0) {
+    free_block(newb);
+    return r;
+  }
+  // The new extent joins the transaction that allocates its block, so
+  // it cannot reach its home ahead of the bitmap.
+  extent_log(f);
+  *pdiskbno = newb;
+  return 0;
+}
+
+// Move the data of inline file f out to a block of its own.  Needed
+// before f grows past FILE_INLINE_MAX or anyone wants its blocks.
+static int
+file_uninline(struct File *f) {
+  char data[FILE_INLINE_MAX];
+  uint64_t diskbno;
+  int r;
+
+  memmove(data, f->f_data, sizeof(data));
+  memset(f->f_data, 0, sizeof(f->f_data));
+  f->f_flags &= ~FILE_INLINE;
+  if (f->f_size == 0)
+    return 0;
+  if ((r = file_block_walk(f, 0, &diskbno, 1)) < 0) {
+    memmove(f->f_data, data, sizeof(data));
+    f->f_flags |= FILE_INLINE;
+    return r;
+  }
+  memmove(diskaddr(diskbno), data, f->f_size);
   return 0;
 }
 
@@ -164,32 +552,234 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_NO_DISK if a block needed to be allocated but the disk is full.
 //	-E_INVAL if filebno is out of range.
-//
-// Hint: Use file_block_walk and alloc_block.
 int
 file_get_block(struct File *f, uint32_t filebno, char **blk) {
-  // LAB 10: Your code here.
-  int r, newb;
-  uint32_t *pdiskbno;
-  if ((r = file_block_walk(f, filebno, &pdiskbno, 1)) < 0) {
+  uint64_t diskbno;
+  int r;
+
+  if ((r = file_block_walk(f, filebno, &diskbno, 1)) < 0)
     return r;
-  }
-  if (!*pdiskbno) {
-    if ((newb = alloc_block()) < 0) {
+  *blk = (char *)diskaddr(diskbno);
+  return 0;
+}
+
+// --------------------------------------------------------------
+// Directory hash index
+// --------------------------------------------------------------
+
+static void file_truncate_blocks(struct File *f, off_t newsize);
+
+// Return the directory entry in slot 'slot' of dir.
+static int
+dir_slot_file(struct File *dir, uint32_t slot, struct File **file) {
+  char *blk;
+  int r;
+
+  if ((r = file_get_block(dir, slot / BLKFILES, &blk)) < 0)
+    return r;
+  *file = (struct File *)blk + slot % BLKFILES;
+  return 0;
+}
+
+// Return the slot number of entry f, which lives in dir block 'blockno'.
+static uint32_t
+dir_file_slot(uint32_t blockno, struct File *f) {
+  return blockno * BLKFILES + (((uintptr_t)f % BLKSIZE) / sizeof(struct File));
+}
+
+static int
+dir_index_header(struct File *dir, struct DirIndex **di) {
+  return file_get_block(dir, DIRINDEX_LBLK, (char **)di);
+}
+
+static int
+dir_index_bucket(struct File *dir, uint32_t i, struct DirBucket **db) {
+  char *blk;
+  int r;
+
+  if ((r = file_get_block(dir, DIRINDEX_LBLK + 1 + i / DIRBUCKETS, &blk)) < 0)
+    return r;
+  *db = (struct DirBucket *)blk + i % DIRBUCKETS;
+  return 0;
+}
+
+// Throw away the hash index of dir, if it has one.
+static void
+dir_index_drop(struct File *dir) {
+  // The index blocks are the tail of the directory's extent map.
+  file_truncate_blocks(dir, (off_t)DIRINDEX_LBLK * BLKSIZE);
+  dir->f_flags &= ~FILE_DIRINDEX;
+}
+
+// Record that slot 'slot' of dir holds a file whose name hashes to
+// 'hash'.  Tombstones are reused.  Returns -E_NO_DISK if every bucket
+// holds an entry.
+static int
+dir_index_insert(struct File *dir, uint32_t hash, uint32_t slot) {
+  struct DirIndex *di;
+  struct DirBucket *db;
+  uint32_t i, n;
+  int r;
+
+  if ((r = dir_index_header(dir, &di)) < 0)
+    return r;
+  for (i = hash & (di->di_nbuckets - 1), n = 0;; i = (i + 1) & (di->di_nbuckets - 1), n++) {
+    if (n == di->di_nbuckets)
       return -E_NO_DISK;
+    if ((r = dir_index_bucket(dir, i, &db)) < 0)
+      return r;
+    if (db->db_slot == 0 || db->db_slot == DIRBUCKET_DELETED)
+      break;
+  }
+  if (db->db_slot == 0)
+    di->di_nused++;
+  di->di_nentries++;
+  db->db_hash = hash;
+  db->db_slot = slot + 1;
+  return 0;
+}
+
+// (Re)build the hash index of dir from its entries, sizing the table
+// so that it is at most half full.  Also rebuilds the free slot list.
+static int
+dir_index_build(struct File *dir) {
+  uint32_t nslots, slot, nbuckets, nentries, i;
+  struct DirIndex *di;
+  struct File *f;
+  char *blk;
+  int r;
+
+  dir_index_drop(dir);
+
+  nslots   = dir->f_size / BLKSIZE * BLKFILES;
+  nentries = 0;
+  for (slot = 0; slot < nslots; slot++) {
+    if ((r = dir_slot_file(dir, slot, &f)) < 0)
+      goto fail;
+    nentries += f->f_name[0] != '\0';
+  }
+  for (nbuckets = DIRBUCKETS; nbuckets < 2 * (nentries + 1);)
+    nbuckets *= 2;
+
+  // Allocate (zeroed, hence empty) bucket blocks, then the header.
+  for (i = 0; i < nbuckets / DIRBUCKETS; i++)
+    if ((r = file_get_block(dir, DIRINDEX_LBLK + 1 + i, &blk)) < 0)
+      goto fail;
+  if ((r = dir_index_header(dir, &di)) < 0)
+    goto fail;
+  di->di_nbuckets = nbuckets;
+
+  for (slot = 0; slot < nslots; slot++) {
+    if ((r = dir_slot_file(dir, slot, &f)) < 0)
+      goto fail;
+    if (f->f_name[0] == '\0')
+      continue;
+    if (!f->f_hash)
+      f->f_hash = fs_name_hash(f->f_name);
+    if ((r = dir_index_insert(dir, f->f_hash, slot)) < 0)
+      goto fail;
+    di->di_nslots = slot + 1;
+  }
+
+  // Chain the free slots below the high water mark, lowest first.
+  for (slot = di->di_nslots; slot-- > 0;) {
+    if ((r = dir_slot_file(dir, slot, &f)) < 0)
+      goto fail;
+    if (f->f_name[0] == '\0') {
+      f->f_hash       = di->di_freelist;
+      di->di_freelist = slot + 1;
     }
-    *pdiskbno = newb;
   }
-  *blk = (char *)diskaddr(*pdiskbno);
+  // Only a complete index is used.
+  dir->f_flags |= FILE_DIRINDEX;
+  // The entries' hashes and free list changed along with the index.
+  file_log(dir);
   return 0;
+
+fail:
+  dir_index_drop(dir);
+  // Set after the drop, whose freeing of blocks clears it.
+  if (r == -E_NO_DISK)
+    dir_index_nospace = 1;
+  return r;
+}
+
+// Look name up in the hash index of dir.
+static int
+dir_index_lookup(struct File *dir, const char *name, uint32_t hash, struct File **file) {
+  struct DirIndex *di;
+  struct DirBucket *db;
+  struct File *f;
+  uint32_t i, n;
+  int r;
+
+  if ((r = dir_index_header(dir, &di)) < 0)
+    return r;
+  // A table without empty buckets is searched through once.
+  for (i = hash & (di->di_nbuckets - 1), n = 0;; i = (i + 1) & (di->di_nbuckets - 1), n++) {
+    if (n == di->di_nbuckets)
+      return -E_NOT_FOUND;
+    if ((r = dir_index_bucket(dir, i, &db)) < 0)
+      return r;
+    if (db->db_slot == 0)
+      return -E_NOT_FOUND;
+    if (db->db_slot == DIRBUCKET_DELETED || db->db_hash != hash)
+      continue;
+    if ((r = dir_slot_file(dir, db->db_slot - 1, &f)) < 0)
+      return r;
+    if (strcmp(f->f_name, name) == 0) {
+      *file = f;
+      return 0;
+    }
+  }
 }
 
-// Try to find a file named "name" in dir.  If so, set *file to it.
+// Remove entry f from the hash index of dir.  Returns the slot f
+// occupied, or -1 if the index could not be updated and was dropped.
+static int64_t
+dir_index_remove(struct File *dir, struct File *f) {
+  struct DirIndex *di;
+  struct DirBucket *db;
+  struct File *g;
+  uint32_t i, n, hash, slot;
+
+  hash = f->f_hash ? f->f_hash : fs_name_hash(f->f_name);
+  if (dir_index_header(dir, &di) < 0)
+    goto fail;
+  for (i = hash & (di->di_nbuckets - 1), n = 0;; i = (i + 1) & (di->di_nbuckets - 1), n++) {
+    if (n == di->di_nbuckets || dir_index_bucket(dir, i, &db) < 0 || db->db_slot == 0)
+      goto fail;
+    if (db->db_slot == DIRBUCKET_DELETED || db->db_hash != hash)
+      continue;
+    if (dir_slot_file(dir, db->db_slot - 1, &g) < 0)
+      goto fail;
+    if (g == f) {
+      slot        = db->db_slot - 1;
+      db->db_slot = DIRBUCKET_DELETED;
+      di->di_nentries--;
+      return slot;
+    }
+  }
+
+fail:
+  // An index that cannot be updated is worse than none.
+  dir_index_drop(dir);
+  return -1;
+}
+
+// --------------------------------------------------------------
+// Directories
+// --------------------------------------------------------------
+
+// Try to find a file named "name", whose fs_name_hash is hash, in dir.
+// If so, set *file to it.  Directories with a hash index are searched
+// through it; others are scanned, comparing the cached name hashes
+// before the names.
 //
 // Returns 0 and sets *file on success, < 0 on error.  Errors are:
 //	-E_NOT_FOUND if the file is not found
 static int
-dir_lookup(struct File *dir, const char *name, struct File **file) {
+dir_lookup(struct File *dir, const char *name, uint32_t hash, struct File **file) {
   int r;
   uint32_t i, j, nblock;
   char *blk;
@@ -200,12 +790,20 @@ dir_lookup(struct File *dir, const char *name, struct File **file) {
   // is always a multiple of the file system's block size.
   assert((dir->f_size % BLKSIZE) == 0);
   nblock = dir->f_size / BLKSIZE;
+
+  // Lookups run under the server's shared lock, so they never build an
+  // index, which takes blocks; directories that grew before they were
+  // indexed (or lost their index) get one at their next create.
+  if (dir->f_flags & FILE_DIRINDEX)
+    return dir_index_lookup(dir, name, hash, file);
+
   for (i = 0; i < nblock; i++) {
     if ((r = file_get_block(dir, i, &blk)) < 0)
       return r;
     f = (struct File *)blk;
     for (j = 0; j < BLKFILES; j++)
-      if (strcmp(f[j].f_name, name) == 0) {
+      if ((f[j].f_hash == hash || f[j].f_hash == 0) && f[j].f_name[0] != '\0' &&
+          strcmp(f[j].f_name, name) == 0) {
         *file = &f[j];
         return 0;
       }
@@ -213,35 +811,120 @@ dir_lookup(struct File *dir, const char *name, struct File **file) {
   return -E_NOT_FOUND;
 }
 
-// Set *file to point at a free File structure in dir.  The caller is
-// responsible for filling in the File fields.
+// Find the first entry in use in dir at or after slot *slot.  Sets
+// *file to it and *slot to its slot number.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if there are no more entries
+int
+dir_read(struct File *dir, uint32_t *slot, struct File **file) {
+  uint32_t i, nslots = dir->f_size / sizeof(struct File);
+  struct File *f;
+  int r;
+
+  for (i = *slot; i < nslots; i++) {
+    if ((r = dir_slot_file(dir, i, &f)) < 0)
+      return r;
+    if (f->f_name[0] != '\0') {
+      *slot = i;
+      *file = f;
+      return 0;
+    }
+  }
+  return -E_NOT_FOUND;
+}
+
+// Set *file to point at a free File structure in dir, cleared and
+// named 'name'.  The caller is responsible for filling in the other
+// File fields.  Indexed directories take the slot off their free list,
+// or the next never used slot, so this is O(1) for them.
 static int
-dir_alloc_file(struct File *dir, struct File **file) {
+dir_alloc_file(struct File *dir, const char *name, struct File **file) {
   int r;
-  uint32_t nblock, i, j;
+  uint32_t nblock, i, j, slot, hash;
+  struct DirIndex *di;
   char *blk;
   struct File *f;
 
   assert((dir->f_size % BLKSIZE) == 0);
   nblock = dir->f_size / BLKSIZE;
+  hash   = fs_name_hash(name);
+
+  if (dir->f_flags & FILE_DIRINDEX) {
+    if ((r = dir_index_header(dir, &di)) < 0)
+      return r;
+    if (di->di_freelist) {
+      slot = di->di_freelist - 1;
+      if ((r = dir_slot_file(dir, slot, &f)) < 0)
+        return r;
+      di->di_freelist = f->f_hash;
+    } else {
+      slot = di->di_nslots++;
+      if (slot / BLKFILES >= nblock)
+        dir->f_size += BLKSIZE;
+      if ((r = dir_slot_file(dir, slot, &f)) < 0)
+        return r;
+    }
+    goto found;
+  }
+
   for (i = 0; i < nblock; i++) {
     if ((r = file_get_block(dir, i, &blk)) < 0)
       return r;
     f = (struct File *)blk;
     for (j = 0; j < BLKFILES; j++)
       if (f[j].f_name[0] == '\0') {
-        *file = &f[j];
-        return 0;
+        f    = &f[j];
+        slot = dir_file_slot(i, f);
+        goto found;
       }
   }
   dir->f_size += BLKSIZE;
   if ((r = file_get_block(dir, i, &blk)) < 0)
     return r;
-  f     = (struct File *)blk;
-  *file = &f[0];
+  f    = (struct File *)blk;
+  slot = dir_file_slot(i, f);
+
+found:
+  memset(f, 0, sizeof(*f));
+  strcpy(f->f_name, name);
+  f->f_hash = hash;
+  *file     = f;
+
+  if (dir->f_flags & FILE_DIRINDEX) {
+    // Past 3/4 load the table is rebuilt, which also sizes it anew.
+    // Without the blocks for that it is dropped instead: tombstones
+    // only ever turn empty buckets into used ones, so a crowded table
+    // kept on a full disk would end up with no empty bucket at all.
+    if ((r = dir_index_insert(dir, hash, slot)) < 0 ||
+        (di->di_nused + 1) * 4 > di->di_nbuckets * 3) {
+      if (dir_index_nospace)
+        dir_index_drop(dir);
+      else
+        dir_index_build(dir);
+    }
+  } else if (dir->f_size / BLKSIZE >= DIRINDEX_MINBLOCKS && !dir_index_nospace) {
+    dir_index_build(dir);
+  }
   return 0;
 }
 
+// Release the directory entry f of dir.  In an indexed directory the
+// slot goes onto the free list for the next dir_alloc_file.
+static void
+dir_free_file(struct File *dir, struct File *f) {
+  struct DirIndex *di;
+  int64_t slot = -1;
+
+  if (dir->f_flags & FILE_DIRINDEX)
+    slot = dir_index_remove(dir, f);
+  memset(f, 0, sizeof(*f));
+  if (slot >= 0 && dir_index_header(dir, &di) == 0) {
+    f->f_hash       = di->di_freelist;
+    di->di_freelist = slot + 1;
+  }
+}
+
 // Skip over slashes.
 static const char *
 skip_slash(const char *p) {
@@ -261,6 +944,7 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
   const char *p;
   char name[MAXNAMELEN];
   struct File *dir, *f;
+  uint32_t hash;
   int r;
 
   // if (*path != '/')
@@ -287,7 +971,14 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
     if (dir->f_type != FTYPE_DIR)
       return -E_NOT_FOUND;
 
-    if ((r = dir_lookup(dir, name, &f)) < 0) {
+    // Consult the name cache first, and remember what the directory
+    // search found, including names that are not there.
+    hash = fs_name_hash(name);
+    if (dcache_lookup(dir, name, hash, &f))
+      r = f ? 0 : -E_NOT_FOUND;
+    else if ((r = dir_lookup(dir, name, hash, &f)) == 0 || r == -E_NOT_FOUND)
+      dcache_insert(dir, name, hash, r == 0 ? f : 0);
+    if (r < 0) {
       if (r == -E_NOT_FOUND && *path == '\0') {
         if (pdir)
           *pdir = dir;
@@ -321,12 +1012,12 @@ file_create(const char *path, struct File **pf) {
     return -E_FILE_EXISTS;
   if (r != -E_NOT_FOUND || dir == 0)
     return r;
-  if ((r = dir_alloc_file(dir, &f)) < 0)
+  if ((r = dir_alloc_file(dir, name, &f)) < 0)
     return r;
+  dcache_insert(dir, name, f->f_hash, f);
 
-  strcpy(f->f_name, name);
   *pf = f;
-  file_flush(dir);
+  file_log(dir);
   return 0;
 }
 
@@ -339,25 +1030,47 @@ file_open(const char *path, struct File **pf) {
 
 // Read count bytes from f into buf, starting from seek position
 // offset.  This meant to mimic the standard pread function.
+// The data is copied one extent at a time; holes read as zeros.
 // Returns the number of bytes read, < 0 on error.
 ssize_t
 file_read(struct File *f, void *buf, size_t count, off_t offset) {
-  int r, bn;
-  off_t pos;
-  char *blk;
+  struct Extent e;
+  off_t pos, end, stop;
+  uint32_t filebno;
+  int64_t i;
+  size_t bn;
 
   if (offset >= f->f_size)
     return 0;
 
   count = MIN(count, f->f_size - offset);
+  end   = offset + count;
 
-  for (pos = offset; pos < offset + count;) {
-    if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
-      return r;
-    bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
-    memmove(buf, blk + pos % BLKSIZE, bn);
-    pos += bn;
-    buf += bn;
+  if (f->f_flags & FILE_INLINE) {
+    memmove(buf, f->f_data + offset, count);
+    return count;
+  }
+
+  for (pos = offset; pos < end;) {
+    filebno = pos / BLKSIZE;
+    i       = extent_lookup(f, filebno);
+    if (i >= 0 && extent_covers(extent_get(f, i), filebno)) {
+      // Copy out of consecutive disk blocks up to the end of the extent.
+      e    = *extent_get(f, i);
+      stop = MIN(end, ((off_t)e.e_lblk + e.e_len) * BLKSIZE);
+      for (; pos < stop; pos += bn, buf += bn) {
+        bn = MIN(BLKSIZE - pos % BLKSIZE, stop - pos);
+        memmove(buf, (char *)diskaddr(e.e_pblk + (pos / BLKSIZE - e.e_lblk)) + pos % BLKSIZE, bn);
+      }
+    } else {
+      // Nothing is allocated until the next extent.
+      stop = end;
+      if (i + 1 < f->f_nextents)
+        stop = MIN(end, (off_t)extent_get(f, i + 1)->e_lblk * BLKSIZE);
+      memset(buf, 0, stop - pos);
+      buf += stop - pos;
+      pos = stop;
+    }
   }
 
   return count;
@@ -378,6 +1091,11 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset) {
     if ((r = file_set_size(f, offset + count)) < 0)
       return r;
 
+  if (f->f_flags & FILE_INLINE) {
+    memmove(f->f_data + offset, buf, count);
+    return count;
+  }
+
   for (pos = offset; pos < offset + count;) {
     if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
       return r;
@@ -390,82 +1108,164 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset) {
   return count;
 }
 
-// Remove a block from file f.  If it's not there, just silently succeed.
-// Returns 0 on success, < 0 on error.
-static int
-file_free_block(struct File *f, uint32_t filebno) {
-  int r;
-  uint32_t *ptr;
-
-  if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0)
-    return r;
-  if (*ptr) {
-    free_block(*ptr);
-    *ptr = 0;
-  }
-  return 0;
-}
-
 // Remove any blocks currently used by file 'f',
 // but not necessary for a file of size 'newsize'.
-// For both the old and new sizes, figure out the number of blocks required,
-// and then clear the blocks from new_nblocks to old_nblocks.
-// If the new_nblocks is no more than NDIRECT, and the indirect block has
-// been allocated (f->f_indirect != 0), then free the indirect block too.
-// (Remember to clear the f->f_indirect pointer so you'll know
-// whether it's valid!)
+// Extents are sorted, so only the last ones can reach past the new
+// end: drop those lying wholly beyond it, shorten the one straddling
+// it, and release any extent blocks that are no longer needed.
 // Do not change f->f_size.
 static void
 file_truncate_blocks(struct File *f, off_t newsize) {
-  int r;
-  uint32_t bno, old_nblocks, new_nblocks;
+  uint64_t new_nblocks;
+  struct Extent *e;
+  uint32_t keep, k;
 
-  old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+  if (f->f_flags & FILE_INLINE)
+    return;
   new_nblocks = (newsize + BLKSIZE - 1) / BLKSIZE;
-  for (bno = new_nblocks; bno < old_nblocks; bno++)
-    if ((r = file_free_block(f, bno)) < 0)
-      cprintf("warning: file_free_block: %i", r);
-
-  if (new_nblocks <= NDIRECT && f->f_indirect) {
-    free_block(f->f_indirect);
-    f->f_indirect = 0;
+  while (f->f_nextents > 0) {
+    e = extent_get(f, f->f_nextents - 1);
+    if ((uint64_t)e->e_lblk + e->e_len <= new_nblocks)
+      break;
+    keep = e->e_lblk < new_nblocks ? new_nblocks - e->e_lblk : 0;
+    for (k = keep; k < e->e_len; k++)
+      free_block(e->e_pblk + k);
+    if (keep) {
+      e->e_len = keep;
+      break;
+    }
+    f->f_nextents--;
   }
+  extent_trim(f);
 }
 
 // Set the size of file f, truncating or extending as necessary.
 int
 file_set_size(struct File *f, off_t newsize) {
-  if (f->f_size > newsize)
+  int r;
+
+  if (newsize < 0 || newsize > MAXFILESIZE)
+    return -E_INVAL;
+
+  // Small regular files without blocks keep their data inline.
+  if (f->f_flags & FILE_INLINE) {
+    if (newsize > FILE_INLINE_MAX && (r = file_uninline(f)) < 0)
+      return r;
+  } else if (f->f_type == FTYPE_REG && f->f_nextents == 0 && newsize > f->f_size &&
+             newsize <= FILE_INLINE_MAX) {
+    memset(f->f_data, 0, sizeof(f->f_data));
+    f->f_flags |= FILE_INLINE;
+  }
+
+  if (f->f_size > newsize && (f->f_flags & FILE_INLINE)) {
+    memset(f->f_data + newsize, 0, f->f_size - newsize);
+  } else if (f->f_size > newsize) {
     file_truncate_blocks(f, newsize);
+    // That also released the hash index of a directory, and
+    // dropped entries the name cache may point into.
+    f->f_flags &= ~FILE_DIRINDEX;
+    if (f->f_type == FTYPE_DIR)
+      dcache_flush();
+  }
   f->f_size = newsize;
-  flush_block(f);
+  extent_log(f);
   return 0;
 }
 
-// Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Return the number of disk blocks holding f's data.  Together with
+// f->f_nextents this says how fragmented the file is: a file laid out
+// contiguously (and without holes) is a single extent.
+uint64_t
+file_nblocks(struct File *f) {
+  uint64_t n = 0;
+  uint32_t i;
+
+  for (i = 0; i < f->f_nextents; i++)
+    n += extent_get(f, i)->e_len;
+  return n;
+}
+
+// Add the metadata that maps f's blocks to the running transaction:
+// the block holding its descriptor, its extent index block and the
+// extent blocks.  Blocks that have not changed are skipped by jnl_add.
+static void
+extent_log(struct File *f) {
+  uint64_t *index;
+  uint32_t i;
+
+  jnl_add(f);
+  if (!(f->f_flags & FILE_INLINE) && f->f_extblock) {
+    index = diskaddr(f->f_extblock);
+    for (i = 0; i < NEXTBLK && index[i]; i++)
+      jnl_add(diskaddr(index[i]));
+    jnl_add(index);
+  }
+}
+
+// Write out the changes to file f without waiting for them.
+// Loop over all the extents in the file and every disk block they
+// cover, queueing the dirty ones, then the descriptor itself and the
+// extent blocks.  Metadata goes through the journal; the blocks of a
+// directory are metadata too, since they hold its entries.
+static void
+file_log(struct File *f) {
+  struct Extent e;
+  uint32_t i, k;
+
+  for (i = 0; i < f->f_nextents; i++) {
+    e = *extent_get(f, i);
+    for (k = 0; k < e.e_len; k++) {
+      if (f->f_type == FTYPE_DIR)
+        jnl_add(diskaddr(e.e_pblk + k));
+      else
+        flush_block(diskaddr(e.e_pblk + k));
+    }
+  }
+  extent_log(f);
+}
+
+// Flush the contents and metadata of file f out to disk: queue them,
+// commit the journal, and wait for the queued writes.
 void
 file_flush(struct File *f) {
-  int i;
-  uint32_t *pdiskbno;
+  file_log(f);
+  jnl_commit();
+  ioq_drain();
+}
 
-  for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
-    if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-        pdiskbno == NULL || *pdiskbno == 0)
-      continue;
-    flush_block(diskaddr(*pdiskbno));
-  }
-  flush_block(f);
-  if (f->f_indirect)
-    flush_block(diskaddr(f->f_indirect));
+// Remove a file, releasing its blocks and its directory entry.
+// Returns -E_NOT_EMPTY for a directory that still has entries.
+int
+file_remove(const char *path) {
+  int r;
+  struct File *dir, *f, *g;
+  uint32_t slot = 0;
+
+  if ((r = walk_path(path, &dir, &f, 0)) < 0)
+    return r;
+  if (dir == 0)
+    return -E_INVAL;
+  // Only empty directories go: the entries of a non-empty one would
+  // lose their parent and their blocks would never be freed.
+  if (f->f_type == FTYPE_DIR && (r = dir_read(f, &slot, &g)) != -E_NOT_FOUND)
+    return r < 0 ? r : -E_NOT_EMPTY;
+
+  // Removing a directory takes its whole subtree out of the name
+  // cache; otherwise only this one name changes.
+  if (f->f_type == FTYPE_DIR)
+    dcache_flush();
+  dcache_insert(dir, f->f_name, fs_name_hash(f->f_name), 0);
+
+  file_truncate_blocks(f, 0);
+  dir_free_file(dir, f);
+  file_log(dir);
+  return 0;
 }
 
-// Sync the entire file system.  A big hammer.
+// Sync the entire file system.  A big hammer, though journaled
+// metadata only needs its commit; the checkpoint can wait.
 void
 fs_sync(void) {
-  int i;
-  for (i = 1; i < super->s_nblocks; i++)
-    flush_block(diskaddr(i));
+  bc_sync();
+  jnl_commit();
 }
@@ -5,45 +5,85 @@
 #define BLKSECTS (BLKSIZE / SECTSIZE) // sectors per block
 
 /* Disk block n, when in memory, is mapped into the file system
- * server's address space at DISKMAP + (n*BLKSIZE). */
-#define DISKMAP 0x10000000
+ * server's address space at DISKMAP + (n*BLKSIZE).  The window lives
+ * above the 4GB boundary, clear of FILEVA and the request page. */
+#define DISKMAP 0x1000000000
 
-/* Maximum disk size we can handle (3GB) */
-#define DISKSIZE 0xC0000000
+/* Maximum disk size we can handle (384GB) */
+#define DISKSIZE 0x6000000000
+
+/* Maximum number of disk blocks kept resident in the block cache.
+ * Clean blocks beyond this are evicted (and dirty ones written back
+ * first), so the memory used by the cache no longer grows with the
+ * size of the disk. */
+#define BC_NSLOTS 65536
 
 extern struct Super *super; // superblock
 extern uint32_t *bitmap;    // bitmap blocks mapped in memory
+extern struct FsStats fsstats;
 
 /* ide.c */
 bool ide_probe_disk1(void);
 void ide_set_disk(int diskno);
-void ide_set_partition(uint32_t first_sect, uint32_t nsect);
-int ide_read(uint32_t secno, void *dst, size_t nsecs);
-int ide_write(uint32_t secno, const void *src, size_t nsecs);
+void ide_set_partition(uint64_t first_sect, uint64_t nsect);
+int ide_read(uint64_t secno, void *dst, size_t nsecs, bool yield);
+int ide_write(uint64_t secno, const void *src, size_t nsecs);
+
+/* ioq.c */
+void ioq_write(uint64_t blockno);
+int ioq_read(uint64_t blockno, void *dst, bool yield);
+bool ioq_pending(uint64_t blockno);
+void ioq_drain(void);
+int ioq_write_direct(uint64_t blockno, const void *src, size_t nblocks);
+
+/* journal.c */
+void jnl_init(void);
+void jnl_add(void *addr);
+void jnl_commit(void);
+void jnl_tick(void);
+void jnl_evict(uint64_t blockno);
+bool jnl_pinned(uint64_t blockno);
+bool jnl_owns(uint64_t blockno);
+bool jnl_reclaim(void);
 
 /* bc.c */
-void *diskaddr(uint32_t blockno);
+void *diskaddr(uint64_t blockno);
+uint64_t addr2blockno(void *addr);
 bool va_is_mapped(void *va);
 bool va_is_dirty(void *va);
 void flush_block(void *addr);
+void bc_sync(void);
+int bc_share(void *addr);
 void bc_init(void);
 
 /* fs.c */
 void fs_init(void);
 int file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
 int file_create(const char *path, struct File **f);
-int file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc);
+int file_block_walk(struct File *f, uint32_t filebno, uint64_t *pdiskbno, bool alloc);
 int file_open(const char *path, struct File **f);
+int dir_read(struct File *dir, uint32_t *slot, struct File **file);
 ssize_t file_read(struct File *f, void *buf, size_t count, off_t offset);
 int file_write(struct File *f, const void *buf, size_t count, off_t offset);
 int file_set_size(struct File *f, off_t newsize);
+uint64_t file_nblocks(struct File *f);
 void file_flush(struct File *f);
 int file_remove(const char *path);
 void fs_sync(void);
 
 /* int	map_block(uint32_t); */
-bool block_is_free(uint32_t blockno);
-int alloc_block(void);
+bool block_is_free(uint64_t blockno);
+int64_t alloc_block(void);
+int64_t alloc_block_near(uint64_t goal);
+
+/* serv.c */
+void serve_yield(void);
+void *serve_scratch(void);
+
+/* dcache.c */
+bool dcache_lookup(struct File *dir, const char *name, uint32_t hash, struct File **file);
+void dcache_insert(struct File *dir, const char *name, uint32_t hash, struct File *file);
+void dcache_flush(void);
 
 /* test.c */
 void fs_test(void);
@@ -25,7 +25,7 @@
 #define JOS_INC_TYPES_H
 // Typedef the types that inc/mmu.h needs.
 typedef uint32_t physaddr_t;
-typedef uint32_t off_t;
+typedef int64_t off_t;
 typedef int bool;
 
 #include <inc/mmu.h>
@@ -34,6 +34,13 @@ typedef int bool;
 #define ROUNDUP(n, v) ((n)-1 + (v) - ((n)-1) % (v))
 #define MAX_DIR_ENTS  128
 
+// Largest disk the file server can map (DISKSIZE in fs/fs.h)
+#define MAX_NBLOCKS (0x6000000000ULL / BLKSIZE)
+
+// Journal size when -j is not given: a sixteenth of the disk, up to
+// this many blocks, or none if that is too small to be useful.
+#define DEFAULT_JBLOCKS 1024
+
 struct Dir {
   struct File *f;
   struct File *ents;
@@ -41,6 +48,8 @@ struct Dir {
 };
 
 uint32_t nblocks;
+uint32_t nreserve; // free blocks left after each file (-r)
+int64_t njournal = -1; // journal blocks (-j), -1 for the default
 char *diskmap, *diskpos;
 struct Super *super;
 uint32_t *bitmap;
@@ -74,26 +83,46 @@ blockof(void *pos) {
   return ((char *)pos - diskmap) / BLKSIZE;
 }
 
+// Mark blocks [start, end) in use.
+void
+markused(uint32_t start, uint32_t end) {
+  for (; start < end; start++)
+    bitmap[start / 32] &= ~(1U << (start % 32));
+}
+
 void *
-alloc(uint32_t bytes) {
+alloc(size_t bytes) {
   void *start = diskpos;
   diskpos += ROUNDUP(bytes, BLKSIZE);
   if (blockof(diskpos) >= nblocks)
     panic("out of disk blocks");
+  if (bitmap)
+    markused(blockof(start), blockof(diskpos));
   return start;
 }
 
+// Leave n blocks free at the current position.
+void
+skip(uint32_t n) {
+  if (n >= nblocks - blockof(diskpos))
+    panic("out of disk blocks");
+  diskpos += (size_t)n * BLKSIZE;
+}
+
 void
 opendisk(const char *name) {
   int r, diskfd, nbitblocks;
+  struct JournalHeader *jh;
 
   if ((diskfd = open(name, O_RDWR | O_CREAT, 0666)) < 0)
     panic("open %s: %s", name, strerror(errno));
 
-  if ((r = ftruncate(diskfd, 0)) < 0 || (r = ftruncate(diskfd, nblocks * BLKSIZE)) < 0)
+  // Truncating to zero and back leaves the image as one big hole, so
+  // only the blocks we actually write below take up space on the host.
+  if ((r = ftruncate(diskfd, 0)) < 0 || (r = ftruncate(diskfd, (size_t)nblocks * BLKSIZE)) < 0)
     panic("truncate %s: %s", name, strerror(errno));
 
-  if ((diskmap = mmap(NULL, nblocks * BLKSIZE, PROT_READ | PROT_WRITE,
+  if ((diskmap = mmap(NULL, (size_t)nblocks * BLKSIZE, PROT_READ | PROT_WRITE,
                       MAP_SHARED, diskfd, 0)) == MAP_FAILED)
     panic("mmap %s: %s", name, strerror(errno));
 
@@ -104,44 +133,51 @@ opendisk(const char *name) {
   super                = alloc(BLKSIZE);
   super->s_magic       = FS_MAGIC;
   super->s_nblocks     = nblocks;
+  super->s_version     = FS_VERSION;
   super->s_root.f_type = FTYPE_DIR;
   strcpy(super->s_root.f_name, "/");
 
   nbitblocks = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
   bitmap     = alloc(nbitblocks * BLKSIZE);
   memset(bitmap, 0xFF, nbitblocks * BLKSIZE);
+  markused(0, blockof(diskpos));
+
+  // The journal follows the bitmap.  Its log starts out empty.
+  if (njournal) {
+    super->s_journal = blockof(diskpos);
+    super->s_jblocks = njournal;
+    jh               = alloc(njournal * BLKSIZE);
+    jh->jh_magic     = JNL_MAGIC_HEADER;
+    jh->jh_tail      = 0;
+    jh->jh_seq       = 1;
+  }
 }
 
 void
 finishdisk(void) {
-  int r, i;
+  int r;
 
-  for (i = 0; i < blockof(diskpos); ++i)
-    bitmap[i / 32] &= ~(1 << (i % 32));
-
-  if ((r = msync(diskmap, nblocks * BLKSIZE, MS_SYNC)) < 0)
+  // Everything we wrote lives below diskpos; the rest stays sparse.
+  if ((r = msync(diskmap, diskpos - diskmap, MS_SYNC)) < 0)
     panic("msync: %s", strerror(errno));
 }
 
+// Files are laid out contiguously, so every file is a single extent.
 void
-finishfile(struct File *f, uint32_t start, uint32_t len) {
-  int i;
+finishfile(struct File *f, uint32_t start, off_t len) {
   f->f_size = len;
-  len       = ROUNDUP(len, BLKSIZE);
-  for (i = 0; i < len / BLKSIZE && i < NDIRECT; ++i)
-    f->f_direct[i] = start + i;
-  if (i == NDIRECT) {
-    uint32_t *ind = alloc(BLKSIZE);
-    f->f_indirect = blockof(ind);
-    for (; i < len / BLKSIZE; ++i)
-      ind[i - NDIRECT] = start + i;
+  if (len > 0) {
+    f->f_nextents           = 1;
+    f->f_extents[0].e_lblk = 0;
+    f->f_extents[0].e_len  = ROUNDUP(len, BLKSIZE) / BLKSIZE;
+    f->f_extents[0].e_pblk = start;
   }
 }
 
 void
 startdir(struct File *f, struct Dir *dout) {
   dout->f    = f;
-  dout->ents = malloc(MAX_DIR_ENTS * sizeof *dout->ents);
+  dout->ents = calloc(MAX_DIR_ENTS, sizeof *dout->ents);
   dout->n    = 0;
 }
 
@@ -152,6 +188,7 @@ diradd(struct Dir *d, uint32_t type, const char *name) {
     panic("too many directory entries");
   strcpy(out->f_name, name);
   out->f_type = type;
+  out->f_hash = fs_name_hash(name);
   return out;
 }
 
@@ -179,7 +216,7 @@ writefile(struct Dir *dir, const char *name) {
     panic("stat %s: %s", name, strerror(errno));
   if (!S_ISREG(st.st_mode))
     panic("%s is not a regular file", name);
-  if (st.st_size >= MAXFILESIZE)
+  if (st.st_size > MAXFILESIZE)
     panic("%s too large", name);
 
   last = strrchr(name, '/');
@@ -188,16 +225,28 @@ writefile(struct Dir *dir, const char *name) {
   else
     last = name;
 
-  f     = diradd(dir, FTYPE_REG, last);
+  f = diradd(dir, FTYPE_REG, last);
+  if (st.st_size <= FILE_INLINE_MAX) {
+    // Tiny files live in their directory entry.
+    readn(fd, f->f_data, st.st_size);
+    f->f_size  = st.st_size;
+    f->f_flags = FILE_INLINE;
+    close(fd);
+    return;
+  }
   start = alloc(st.st_size);
   readn(fd, start, st.st_size);
   finishfile(f, blockof(start), st.st_size);
   close(fd);
+
+  // Room for the file to grow without being split into more extents:
+  // the server allocates the block after a file's last one when free.
+  skip(nreserve);
 }
 
 void
 usage(void) {
-  fprintf(stderr, "Usage: fsformat fs.img NBLOCKS files...\n");
+  fprintf(stderr, "Usage: fsformat [-r NRESERVE] [-j NJOURNAL] fs.img NBLOCKS files...\n");
   exit(2);
 }
 
@@ -206,15 +255,39 @@ main(int argc, char **argv) {
   int i;
   char *s;
   struct Dir root;
+  unsigned long long n;
 
   assert(BLKSIZE % sizeof(struct File) == 0);
-
+  assert(sizeof(struct Super) <= BLKSIZE && sizeof(struct JournalDesc) <= BLKSIZE);
+
+  while (argc > 2 && argv[1][0] == '-') {
+    n = strtoul(argv[2], &s, 0);
+    if (*s || s == argv[2])
+      usage();
+    if (strcmp(argv[1], "-r") == 0)
+      nreserve = n;
+    else if (strcmp(argv[1], "-j") == 0)
+      njournal = n;
+    else
+      usage();
+    argc -= 2;
+    argv += 2;
+  }
   if (argc < 3)
     usage();
 
-  nblocks = strtol(argv[2], &s, 0);
-  if (*s || s == argv[2] || nblocks < 2 || nblocks > 1024)
+  n = strtoull(argv[2], &s, 0);
+  if (*s || s == argv[2] || n < 2 || n > MAX_NBLOCKS)
+    usage();
+  nblocks = n;
+
+  if (njournal < 0) {
+    njournal = nblocks / 16 < DEFAULT_JBLOCKS ? nblocks / 16 : DEFAULT_JBLOCKS;
+    if (njournal < JNL_MINBLOCKS)
+      njournal = 0;
+  } else if (njournal && (njournal < JNL_MINBLOCKS || njournal >= nblocks)) {
     usage();
+  }
 
   opendisk(argv[1]);
 
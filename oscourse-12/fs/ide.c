@@ -12,8 +12,31 @@
 #define IDE_DF   0x20
 #define IDE_ERR  0x01
 
+#define IDE_CMD_READ      0x20 // READ SECTORS
+#define IDE_CMD_READ_EXT  0x24 // READ SECTORS EXT (LBA48)
+#define IDE_CMD_WRITE     0x30 // WRITE SECTORS
+#define IDE_CMD_WRITE_EXT 0x34 // WRITE SECTORS EXT (LBA48)
+
+// Addressing limits of the two command sets.  A sector count of 0 means
+// 256 sectors for LBA28 and 65536 sectors for LBA48.
+#define IDE_LBA28_MAX     (1ULL << 28)
+#define IDE_LBA28_MAXSECS 256
+#define IDE_LBA48_MAX     (1ULL << 48)
+#define IDE_LBA48_MAXSECS 65536
+
 static int diskno = 1;
 
+// The read in flight.  A reader may wait for the drive by yielding to
+// other requests (see serve_yield), so another request may want the
+// drive before the reader is back; it then finishes the transfer
+// itself (ide_finish), into the reader's buffer.  Reads are numbered
+// so that each reader can tell when its own is over.
+static void *ide_rd_dst;       // where the next sector goes
+static size_t ide_rd_nsecs;    // sectors still to come
+static uint64_t ide_rd_issued; // reads started
+static uint64_t ide_rd_done;   // reads over
+static uint64_t ide_rd_failed; // the last read that failed
+
 static int
 ide_wait_ready(bool check_error) {
   int r;
@@ -56,44 +79,98 @@ ide_set_disk(int d) {
   diskno = d;
 }
 
-int
-ide_read(uint32_t secno, void *dst, size_t nsecs) {
+// Program the task file for a transfer of 'nsecs' sectors starting at
+// 'secno' and issue 'cmd'.  Requests that fit below 2^28 sectors use the
+// classic 28-bit registers; anything beyond that (or longer than 256
+// sectors) is sent as an LBA48 command, which takes the high-order bytes
+// of the count and address first through the same ports.
+static void
+ide_start(uint64_t secno, size_t nsecs, bool write) {
+  bool lba48 = secno + nsecs > IDE_LBA28_MAX || nsecs > IDE_LBA28_MAXSECS;
+
+  if (lba48) {
+    outb(0x1F6, 0x40 | ((diskno & 1) << 4));
+    outb(0x1F2, (nsecs >> 8) & 0xFF);
+    outb(0x1F3, (secno >> 24) & 0xFF);
+    outb(0x1F4, (secno >> 32) & 0xFF);
+    outb(0x1F5, (secno >> 40) & 0xFF);
+    outb(0x1F2, nsecs & 0xFF);
+    outb(0x1F3, secno & 0xFF);
+    outb(0x1F4, (secno >> 8) & 0xFF);
+    outb(0x1F5, (secno >> 16) & 0xFF);
+    outb(0x1F7, write ? IDE_CMD_WRITE_EXT : IDE_CMD_READ_EXT);
+  } else {
+    outb(0x1F2, nsecs);
+    outb(0x1F3, secno & 0xFF);
+    outb(0x1F4, (secno >> 8) & 0xFF);
+    outb(0x1F5, (secno >> 16) & 0xFF);
+    outb(0x1F6, 0xE0 | ((diskno & 1) << 4) | ((secno >> 24) & 0x0F));
+    outb(0x1F7, write ? IDE_CMD_WRITE : IDE_CMD_READ);
+  }
+}
+
+// Transfer the sectors of the read in flight that the drive has ready,
+// without waiting.  Returns true once the read is over.
+static bool
+ide_poll(void) {
   int r;
 
-  assert(nsecs <= 256);
+  while (ide_rd_nsecs > 0) {
+    if (((r = inb(0x1F7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY)
+      return 0;
+    if (r & (IDE_DF | IDE_ERR)) {
+      ide_rd_failed = ide_rd_issued;
+      break;
+    }
+    insl(0x1F0, ide_rd_dst, SECTSIZE / 4);
+    ide_rd_dst += SECTSIZE;
+    ide_rd_nsecs--;
+  }
+  ide_rd_nsecs = 0;
+  ide_rd_done  = ide_rd_issued;
+  return 1;
+}
 
-  ide_wait_ready(0);
+// Wait for the read in flight, if any, to be over.
+static void
+ide_finish(void) {
+  while (!ide_poll())
+    /* do nothing */;
+}
 
-  outb(0x1F2, nsecs);
-  outb(0x1F3, secno & 0xFF);
-  outb(0x1F4, (secno >> 8) & 0xFF);
-  outb(0x1F5, (secno >> 16) & 0xFF);
-  outb(0x1F6, 0xE0 | ((diskno & 1) << 4) | ((secno >> 24) & 0x0F));
-  outb(0x1F7, 0x20); // CMD 0x20 means read sector
+// Read nsecs sectors at secno into dst.  With yield set, other requests
+// run while the drive is busy.
+int
+ide_read(uint64_t secno, void *dst, size_t nsecs, bool yield) {
+  uint64_t id;
 
-  for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
-    if ((r = ide_wait_ready(1)) < 0)
-      return r;
-    insl(0x1F0, dst, SECTSIZE / 4);
-  }
+  assert(nsecs > 0 && nsecs <= IDE_LBA48_MAXSECS);
+  assert(secno + nsecs <= IDE_LBA48_MAX);
 
-  return 0;
+  ide_finish();
+  ide_wait_ready(0);
+  ide_start(secno, nsecs, 0);
+
+  id           = ++ide_rd_issued;
+  ide_rd_dst   = dst;
+  ide_rd_nsecs = nsecs;
+  while (ide_rd_done < id && !ide_poll())
+    if (yield)
+      serve_yield();
+
+  return ide_rd_failed == id ? -1 : 0;
 }
 
 int
-ide_write(uint32_t secno, const void *src, size_t nsecs) {
+ide_write(uint64_t secno, const void *src, size_t nsecs) {
   int r;
 
-  assert(nsecs <= 256);
+  assert(nsecs > 0 && nsecs <= IDE_LBA48_MAXSECS);
+  assert(secno + nsecs <= IDE_LBA48_MAX);
 
+  ide_finish();
   ide_wait_ready(0);
-
-  outb(0x1F2, nsecs);
-  outb(0x1F3, secno & 0xFF);
-  outb(0x1F4, (secno >> 8) & 0xFF);
-  outb(0x1F5, (secno >> 16) & 0xFF);
-  outb(0x1F6, 0xE0 | ((diskno & 1) << 4) | ((secno >> 24) & 0x0F));
-  outb(0x1F7, 0x30); // CMD 0x30 means write sector
+  ide_start(secno, nsecs, 1);
 
   for (; nsecs > 0; nsecs--, src += SECTSIZE) {
     if ((r = ide_wait_ready(1)) < 0)
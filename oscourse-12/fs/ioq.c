@@ -0,0 +1,149 @@
+#include "fs.h"
+
+// Disk request queue between the block cache and the IDE driver.
+//
+// The server waits for every read it issues (a page fault needs its
+// block now), so reads go to the disk at once.  Writes are only needed
+// on disk by the next sync point, so flush_block queues them instead.
+// The queue is kept sorted by block number and is drained in C-LOOK
+// order: upwards from the block the disk head last touched, then once
+// back to the lowest pending block.  Runs of consecutive blocks go out
+// as one multi-sector command, straight from the block cache pages,
+// which are consecutive in memory as well.
+//
+// The queue is drained when it fills up, at sync points (file_flush,
+// bc_sync, and before a queued block is evicted), and once
+// IOQ_DEADLINE reads have overtaken a pending write, so reads cannot
+// hold writes back for long.
+//
+// Queued blocks stay resident in the cache; whatever the page holds
+// when the queue drains is what gets written, which is never older
+// than what was flushed.
+//
+// The journal's log blocks are not cached; ioq_write_direct writes them
+// from the journal's own pages, after everything already queued.
+
+#define IOQ_MAX      256 // pending writes
+#define IOQ_DEADLINE 32  // reads that may pass a pending write
+
+static uint64_t ioq[IOQ_MAX]; // pending blocks, sorted, no duplicates
+static size_t ioq_n;
+static size_t ioq_passed;   // reads issued since the oldest pending write
+static uint64_t ioq_head;   // block after the last one transferred
+static uint64_t ioq_queued; // last block queued, for the FIFO estimate
+
+static uint64_t
+ioq_dist(uint64_t a, uint64_t b) {
+  return a > b ? a - b : b - a;
+}
+
+// Account for a command of n blocks at blockno and move the head.
+static void
+ioq_seek(uint64_t blockno, size_t n) {
+  fsstats.io_seek += ioq_dist(ioq_head, blockno);
+  ioq_head = blockno + n;
+}
+
+// Return the index of the first pending block >= blockno.
+static size_t
+ioq_find(uint64_t blockno) {
+  size_t lo = 0, hi = ioq_n, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (ioq[mid] < blockno)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Write the pending blocks [i, j) of the queue, merging runs.
+static void
+ioq_issue(size_t i, size_t j) {
+  size_t k;
+  int r;
+
+  while (i < j) {
+    for (k = i + 1; k < j && ioq[k] == ioq[k - 1] + 1; k++)
+      /* do nothing */;
+    ioq_seek(ioq[i], k - i);
+    if ((r = ide_write(ioq[i] * BLKSECTS, diskaddr(ioq[i]), (k - i) * BLKSECTS)) < 0)
+      panic("ioq_issue: ide_write: %i", r);
+    fsstats.io_wrcmds++;
+    fsstats.io_wrblocks += k - i;
+    i = k;
+  }
+}
+
+// Write out every pending block.
+void
+ioq_drain(void) {
+  size_t start;
+
+  if (!ioq_n)
+    return;
+  start = ioq_find(ioq_head);
+  ioq_issue(start, ioq_n);
+  ioq_issue(0, start);
+  ioq_n      = 0;
+  ioq_passed = 0;
+}
+
+// Queue block blockno, whose cache page is resident, to be written.
+void
+ioq_write(uint64_t blockno) {
+  size_t i = ioq_find(blockno);
+
+  if (i < ioq_n && ioq[i] == blockno)
+    return;
+  if (ioq_n == IOQ_MAX) {
+    ioq_drain();
+    i = 0;
+  }
+  memmove(&ioq[i + 1], &ioq[i], (ioq_n - i) * sizeof(ioq[0]));
+  ioq[i] = blockno;
+  ioq_n++;
+
+  // What writing everything in arrival order would have cost.
+  fsstats.io_seek_fifo += ioq_dist(ioq_queued, blockno);
+  ioq_queued = blockno + 1;
+}
+
+// Read block blockno into dst, ahead of any pending writes.  With yield
+// set, other requests may run until the block is in.
+int
+ioq_read(uint64_t blockno, void *dst, bool yield) {
+  int r;
+
+  ioq_seek(blockno, 1);
+  fsstats.io_seek_fifo += ioq_dist(ioq_queued, blockno);
+  ioq_queued = blockno + 1;
+  fsstats.io_rdcmds++;
+  r = ide_read(blockno * BLKSECTS, dst, BLKSECTS, yield);
+  if (ioq_n && ++ioq_passed >= IOQ_DEADLINE)
+    ioq_drain();
+  return r;
+}
+
+// Write nblocks blocks from src to the disk at blockno, once every
+// pending write is out.
+int
+ioq_write_direct(uint64_t blockno, const void *src, size_t nblocks) {
+  ioq_drain();
+  ioq_seek(blockno, nblocks);
+  fsstats.io_seek_fifo += ioq_dist(ioq_queued, blockno);
+  ioq_queued = blockno + nblocks;
+  fsstats.io_wrcmds++;
+  fsstats.io_wrblocks += nblocks;
+  return ide_write(blockno * BLKSECTS, src, nblocks * BLKSECTS);
+}
+
+// Is block blockno waiting to be written?
+bool
+ioq_pending(uint64_t blockno) {
+  size_t i = ioq_find(blockno);
+
+  return i < ioq_n && ioq[i] == blockno;
+}
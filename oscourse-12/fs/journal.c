@@ -0,0 +1,357 @@
+#include "fs.h"
+
+// Write-ahead journal for metadata blocks (see inc/fs.h for the layout).
+//
+// Code that changes a metadata block hands it to jnl_add rather than
+// flush_block.  The block joins the running transaction, which gathers
+// the changes of many requests and is committed with one sequential
+// write: descriptor, block copies and commit block in a single disk
+// command.  A transaction is committed when it is full, at sync points
+// (file_flush, fs_sync), and by jnl_tick once it has been open across
+// JNL_BATCH of the server's idle moments.  Until then its blocks stay
+// in the cache and do not go home: flush_block hands them back here and
+// the cache does not evict them.
+//
+// Committed blocks are written home by the next checkpoint, which then
+// frees the whole log.  The server checkpoints from jnl_tick, when it
+// has no request in hand, once the log is half full, and from
+// jnl_commit when a transaction does not fit.  A committed block that
+// is evicted before that is written home on its way out, but stays in
+// jnl_ckpt until the checkpoint: its copy in the log is replayed after
+// a crash until then, so the allocator must not hand the block out
+// for anything else meanwhile (see jnl_owns).
+//
+// After a crash, jnl_init replays the committed transactions from the
+// header's tail on, before anything reads the bitmap or a directory.
+
+#define JNLVA       ((char *)0x0f000000)               // staging pages for a transaction
+#define JNLTMP      (JNLVA + (JNL_MAXTX + 2) * PGSIZE) // header and scratch page
+#define JNL_BATCH   8                                  // idle moments a transaction stays open
+#define JNL_MAXCKPT 1024                               // committed blocks not yet home
+
+struct JnlBlock {
+  uint64_t jb_blockno; // home block
+  uint32_t jb_logpos;  // log offset of its latest committed copy
+  bool jb_home;        // written home when evicted; the log copy is the same
+};
+
+static uint32_t jnl_nlog;    // log blocks, 0 if there is no journal
+static uint32_t jnl_head;    // log offset the next transaction goes to
+static uint32_t jnl_used;    // log blocks in use since the last checkpoint
+static uint64_t jnl_seq;     // sequence number of the next transaction
+static size_t jnl_age;       // requests the running transaction has been open
+static uint64_t jnl_tx[JNL_MAXTX]; // running transaction, sorted
+static size_t jnl_ntx;
+static struct JnlBlock jnl_ckpt[JNL_MAXCKPT]; // sorted by jb_blockno
+static size_t jnl_nckpt;
+
+// Return the disk block at log offset pos.
+static uint64_t
+jnl_logblock(uint32_t pos) {
+  return super->s_journal + 1 + pos % (super->s_jblocks - 1);
+}
+
+// Return the index of the first block >= blockno in the running
+// transaction.
+static size_t
+jnl_tx_find(uint64_t blockno) {
+  size_t lo = 0, hi = jnl_ntx, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (jnl_tx[mid] < blockno)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Return the index of the first committed block >= blockno.
+static size_t
+jnl_ckpt_find(uint64_t blockno) {
+  size_t lo = 0, hi = jnl_nckpt, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (jnl_ckpt[mid].jb_blockno < blockno)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Is block blockno part of the running transaction?
+bool
+jnl_pinned(uint64_t blockno) {
+  size_t i = jnl_tx_find(blockno);
+
+  return i < jnl_ntx && jnl_tx[i] == blockno;
+}
+
+// Is block blockno one the journal has yet to write home, or has a
+// copy of that replay would write home after a crash?  Such a block
+// is not reused until the next checkpoint, even if it is freed.
+bool
+jnl_owns(uint64_t blockno) {
+  size_t i = jnl_ckpt_find(blockno);
+
+  return jnl_pinned(blockno) || (i < jnl_nckpt && jnl_ckpt[i].jb_blockno == blockno);
+}
+
+static void
+jnl_write_header(void) {
+  struct JournalHeader *jh = (struct JournalHeader *)JNLTMP;
+  int r;
+
+  memset(jh, 0, BLKSIZE);
+  jh->jh_magic = JNL_MAGIC_HEADER;
+  jh->jh_tail  = jnl_head;
+  jh->jh_seq   = jnl_seq;
+  if ((r = ioq_write_direct(super->s_journal, jh, 1)) < 0)
+    panic("jnl_write_header: %i", r);
+}
+
+// Write every committed block home and free the whole log.  A block
+// whose cache page is clean still holds what was committed and goes
+// out from the cache; one that has changed since (or is in the running
+// transaction) gets its committed copy read back from the log, so that
+// nothing uncommitted reaches its home.
+static void
+jnl_checkpoint(void) {
+  struct JnlBlock *b;
+  void *va;
+  size_t i;
+  int r;
+
+  for (i = 0; i < jnl_nckpt; i++) {
+    b  = &jnl_ckpt[i];
+    va = diskaddr(b->jb_blockno);
+    if (b->jb_home && !va_is_mapped(va))
+      continue;
+    if (va_is_mapped(va) && !va_is_dirty(va) && !jnl_pinned(b->jb_blockno)) {
+      ioq_write(b->jb_blockno);
+      continue;
+    }
+    if ((r = ioq_read(jnl_logblock(b->jb_logpos), JNLTMP, 0)) < 0 ||
+        (r = ioq_write_direct(b->jb_blockno, JNLTMP, 1)) < 0)
+      panic("jnl_checkpoint: %i", r);
+  }
+  ioq_drain();
+  jnl_nckpt = 0;
+  jnl_used  = 0;
+  jnl_write_header();
+  fsstats.jn_ckpts++;
+}
+
+// Remember that the latest committed copy of blockno is at log offset
+// pos.
+static void
+jnl_ckpt_note(uint64_t blockno, uint32_t pos) {
+  size_t i = jnl_ckpt_find(blockno);
+
+  if (i == jnl_nckpt || jnl_ckpt[i].jb_blockno != blockno) {
+    memmove(&jnl_ckpt[i + 1], &jnl_ckpt[i], (jnl_nckpt - i) * sizeof(jnl_ckpt[0]));
+    jnl_ckpt[i].jb_blockno = blockno;
+    jnl_nckpt++;
+  }
+  jnl_ckpt[i].jb_logpos = pos;
+  jnl_ckpt[i].jb_home   = 0;
+}
+
+// Commit the running transaction.  The data blocks queued so far are
+// written first, so committed metadata never points at stale data.
+void
+jnl_commit(void) {
+  struct JournalDesc *jd = (struct JournalDesc *)JNLVA;
+  struct JournalCommit *jc;
+  uint64_t sum = JNL_CHECKSUM_INIT;
+  uint32_t need, first;
+  size_t i;
+  int r;
+
+  if (!jnl_ntx)
+    return;
+  need = jnl_ntx + 2;
+  if (jnl_nlog - jnl_used < need || jnl_nckpt + jnl_ntx > JNL_MAXCKPT)
+    jnl_checkpoint();
+
+  memset(jd, 0, BLKSIZE);
+  jd->jd_magic = JNL_MAGIC_DESC;
+  jd->jd_n     = jnl_ntx;
+  jd->jd_seq   = jnl_seq;
+  for (i = 0; i < jnl_ntx; i++) {
+    jd->jd_blocks[i] = jnl_tx[i];
+    memmove(JNLVA + (i + 1) * PGSIZE, diskaddr(jnl_tx[i]), BLKSIZE);
+    sum = jnl_checksum(sum, JNLVA + (i + 1) * PGSIZE);
+  }
+  jc = (struct JournalCommit *)(JNLVA + (jnl_ntx + 1) * PGSIZE);
+  memset(jc, 0, BLKSIZE);
+  jc->jc_magic = JNL_MAGIC_COMMIT;
+  jc->jc_n     = jnl_ntx;
+  jc->jc_seq   = jnl_seq;
+  jc->jc_sum   = sum;
+
+  // One command, or two if the transaction wraps around the end of the
+  // log; the commit block goes out last either way.
+  first = MIN(need, jnl_nlog - jnl_head);
+  if ((r = ioq_write_direct(jnl_logblock(jnl_head), JNLVA, first)) < 0 ||
+      (first < need && (r = ioq_write_direct(jnl_logblock(0), JNLVA + first * PGSIZE, need - first)) < 0))
+    panic("jnl_commit: %i", r);
+
+  for (i = 0; i < jnl_ntx; i++)
+    jnl_ckpt_note(jnl_tx[i], (jnl_head + 1 + i) % jnl_nlog);
+  jnl_head = (jnl_head + need) % jnl_nlog;
+  jnl_used += need;
+  jnl_seq++;
+  fsstats.jn_commits++;
+  fsstats.jn_blocks += jnl_ntx;
+  jnl_ntx = 0;
+  jnl_age = 0;
+}
+
+// The metadata block at addr has changed: add it to the running
+// transaction, or just flush it if there is no journal.  The commit
+// copies whatever the page holds by then; clearing the dirty bit here
+// only tells later callers there is nothing new to add.
+void
+jnl_add(void *addr) {
+  uint64_t blockno = addr2blockno(addr);
+  size_t i;
+  int r;
+
+  if (!jnl_nlog) {
+    flush_block(addr);
+    return;
+  }
+  addr = ROUNDDOWN(addr, PGSIZE);
+  if (!va_is_mapped(addr) || !va_is_dirty(addr))
+    return;
+
+  i = jnl_tx_find(blockno);
+  if (i == jnl_ntx || jnl_tx[i] != blockno) {
+    if (jnl_ntx == JNL_MAXTX) {
+      jnl_commit();
+      i = 0;
+    }
+    memmove(&jnl_tx[i + 1], &jnl_tx[i], (jnl_ntx - i) * sizeof(jnl_tx[0]));
+    jnl_tx[i] = blockno;
+    jnl_ntx++;
+  }
+  if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
+    panic("jnl_add: sys_page_map: %i", r);
+}
+
+// Block blockno is about to be evicted.  If it is committed but not
+// home yet, queue it for writing home now: once it is gone, a fault
+// would read the old copy from its home.
+void
+jnl_evict(uint64_t blockno) {
+  size_t i = jnl_ckpt_find(blockno);
+
+  if (i == jnl_nckpt || jnl_ckpt[i].jb_blockno != blockno || jnl_ckpt[i].jb_home)
+    return;
+  ioq_write(blockno);
+  jnl_ckpt[i].jb_home = 1;
+}
+
+// The allocator found free blocks, but only ones jnl_owns.  Checkpoint
+// to let the committed ones go; returns whether there were any.
+bool
+jnl_reclaim(void) {
+  if (!jnl_nckpt)
+    return 0;
+  jnl_checkpoint();
+  return 1;
+}
+
+// Called when the server has no request in hand, before it waits for
+// the next one, so that committing and checkpointing do not hold up a
+// client.
+void
+jnl_tick(void) {
+  if (!jnl_nlog)
+    return;
+  if (jnl_ntx && ++jnl_age >= JNL_BATCH)
+    jnl_commit();
+  if (jnl_used > jnl_nlog / 2 || jnl_nckpt > JNL_MAXCKPT / 2)
+    jnl_checkpoint();
+}
+
+// Replay the transaction at log offset pos if it is the committed
+// transaction seq.  Return the log blocks it takes up, or 0 if it is
+// not there.
+static uint32_t
+jnl_replay(uint32_t pos, uint64_t seq) {
+  struct JournalDesc *jd = (struct JournalDesc *)JNLVA;
+  struct JournalCommit *jc;
+  uint64_t sum = JNL_CHECKSUM_INIT;
+  uint32_t i, n;
+
+  if (ioq_read(jnl_logblock(pos), jd, 0) < 0)
+    return 0;
+  n = jd->jd_n;
+  if (jd->jd_magic != JNL_MAGIC_DESC || jd->jd_seq != seq || n == 0 || n > JNL_MAXTX)
+    return 0;
+  // The copies, then the commit block.
+  for (i = 0; i <= n; i++)
+    if (ioq_read(jnl_logblock(pos + 1 + i), JNLVA + (i + 1) * PGSIZE, 0) < 0)
+      return 0;
+  for (i = 0; i < n; i++)
+    sum = jnl_checksum(sum, JNLVA + (i + 1) * PGSIZE);
+  jc = (struct JournalCommit *)(JNLVA + (n + 1) * PGSIZE);
+  if (jc->jc_magic != JNL_MAGIC_COMMIT || jc->jc_seq != seq || jc->jc_n != n || jc->jc_sum != sum)
+    return 0;
+
+  for (i = 0; i < n; i++) {
+    if (jd->jd_blocks[i] == 0 || jd->jd_blocks[i] >= super->s_nblocks)
+      panic("journal transaction %ld has bad block %08lx",
+            (long)seq, (unsigned long)jd->jd_blocks[i]);
+    memmove(diskaddr(jd->jd_blocks[i]), JNLVA + (i + 1) * PGSIZE, BLKSIZE);
+    flush_block(diskaddr(jd->jd_blocks[i]));
+  }
+  return n + 2;
+}
+
+// Set up the journal of a file system that has one, replaying whatever
+// was committed but may not have reached its home before the server
+// last stopped.
+void
+jnl_init(void) {
+  struct JournalHeader *jh = (struct JournalHeader *)JNLTMP;
+  uint32_t nlog, pos, len;
+  uint64_t seq;
+  int i, r;
+
+  if (!super->s_jblocks)
+    return;
+  if (super->s_jblocks < JNL_MINBLOCKS || super->s_journal < 2 ||
+      (uint64_t)super->s_journal + super->s_jblocks > super->s_nblocks)
+    panic("bad journal location");
+  for (i = 0; i < JNL_MAXTX + 3; i++)
+    if ((r = sys_page_alloc(0, JNLVA + i * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+      panic("jnl_init: sys_page_alloc: %i", r);
+
+  nlog = super->s_jblocks - 1;
+  if ((r = ioq_read(super->s_journal, jh, 0)) < 0)
+    panic("jnl_init: reading journal header: %i", r);
+  if (jh->jh_magic != JNL_MAGIC_HEADER || jh->jh_tail >= nlog)
+    panic("bad journal header");
+
+  pos = jh->jh_tail;
+  seq = jh->jh_seq;
+  for (i = 0; (len = jnl_replay(pos, seq)) > 0; i++) {
+    pos = (pos + len) % nlog;
+    seq++;
+  }
+  ioq_drain();
+
+  jnl_nlog = nlog;
+  jnl_head = pos;
+  jnl_seq  = seq;
+  if (i) {
+    jnl_write_header();
+    cprintf("journal: replayed %d transactions\n", i);
+  }
+}
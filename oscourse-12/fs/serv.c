@@ -33,14 +33,59 @@ struct OpenFile {
   struct File *o_file; // mapped descriptor for open file
   int o_mode;          // open mode
   struct Fd *o_fd;     // Fd page
+  bool o_busy;         // a read is moving the seek position
 };
 
 // initialize to force into data section
 struct OpenFile opentab[MAXOPEN] = {
     {0, 0, 1, 0}};
 
-// Virtual address at which to receive page mappings containing client requests.
-union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// Requests are served by NWORKERS coroutines, so that a request that
+// has to wait for the disk does not hold up the ones behind it.  Only a
+// block cache miss waits (see bc_pgfault and ide_read): the worker
+// switches back to serve(), which takes in more requests and resumes
+// the other workers, and picks it up again until its block is in.
+//
+// Requests that only read the file system run side by side; one that
+// changes it waits for them to finish and then runs alone (serve_lock).
+//
+// Each worker has an area of its own at WORKERVA: the request page and
+// the client pages of a vectored request, a page where FSREQ_MAP builds
+// pages that do not come straight from the cache, a scratch page for
+// cache misses, and its stack.  A worker that switches out in the
+// middle of a page fault leaves frames on the exception stack, which
+// the next fault would overwrite; they are kept in w_uxstack meanwhile.
+#define NWORKERS     8
+#define WORKERVA     0x0e000000
+#define WORKERSIZE   (128 * PGSIZE)
+#define WORKERSTACK  (8 * PGSIZE)
+#define SERVETEMP    ((void *)0x0ffbe000) // scratch page outside the workers
+
+struct Worker {
+  struct Coro w_co;       // saved context while switched out
+  union Fsipc *w_req;     // request page, client pages follow
+  void *w_maptemp;        // where FSREQ_MAP builds pages
+  void *w_scratch;        // where cache misses are read
+  envid_t w_whom;         // client
+  uint32_t w_type;        // request type
+  int w_perm;             // permissions of the request page
+  size_t w_npages;        // pages that came with the request
+  bool w_busy;            // has a request
+  size_t w_uxlen;         // bytes of exception stack saved
+  char w_uxstack[UXSTACKSIZE]; // exception stack frames while switched out
+};
+
+static struct Worker workers[NWORKERS];
+static struct Worker *curworker; // the worker running, if any
+static struct Coro serve_co;     // serve() while a worker runs
+
+// State of the file system lock
+static size_t serve_nshared;    // workers serving a read-only request
+static bool serve_excl;         // a worker is changing the file system
+static size_t serve_excl_wait;  // workers waiting to change it
+
+// Counters reported by FSREQ_STATS
+struct FsStats fsstats;
 
 void
 serve_init(void) {
@@ -53,6 +98,49 @@ serve_init(void) {
   }
 }
 
+// Let other requests run while this one waits.  Outside a worker
+// (during initialization and in serve() itself) there is nothing else
+// to run.
+void
+serve_yield(void) {
+  struct Worker *w = curworker;
+
+  if (w)
+    coro_switch(&w->w_co, &serve_co);
+}
+
+// A page of the running request's own for temporary mappings.
+void *
+serve_scratch(void) {
+  return curworker ? curworker->w_scratch : SERVETEMP;
+}
+
+// Take the file system lock, shared if the request only reads the file
+// system.  A request that changes it waits for the readers running to
+// finish, and holds back new ones meanwhile.
+static void
+serve_lock(bool excl) {
+  if (excl) {
+    serve_excl_wait++;
+    while (serve_excl || serve_nshared)
+      serve_yield();
+    serve_excl_wait--;
+    serve_excl = 1;
+  } else {
+    while (serve_excl || serve_excl_wait)
+      serve_yield();
+    serve_nshared++;
+  }
+}
+
+static void
+serve_unlock(bool excl) {
+  if (excl)
+    serve_excl = 0;
+  else
+    serve_nshared--;
+}
+
 // Allocate an open file.
 int
 openfile_alloc(struct OpenFile **o) {
@@ -87,6 +175,22 @@ openfile_lookup(envid_t envid, uint32_t fileid, struct OpenFile **po) {
   return 0;
 }
 
+// Requests that move the seek position run under the shared lock and
+// may wait for the disk between reading fd_offset and advancing it.
+// Envs that share the Fd page through fork or dup would then read the
+// same bytes twice, so such requests take the open file for themselves.
+static void
+openfile_lock(struct OpenFile *o) {
+  while (o->o_busy)
+    serve_yield();
+  o->o_busy = 1;
+}
+
+static void
+openfile_unlock(struct OpenFile *o) {
+  o->o_busy = 0;
+}
+
 // Open req->req_path in mode req->req_omode, storing the Fd page and
 // permissions to return to the calling environment in *pg_store and
 // *perm_store respectively.
@@ -106,14 +210,6 @@ serve_open(envid_t envid, struct Fsreq_open *req,
   memmove(path, req->req_path, MAXPATHLEN);
   path[MAXPATHLEN - 1] = 0;
 
-  // Find an open file ID
-  if ((r = openfile_alloc(&o)) < 0) {
-    if (debug)
-      cprintf("openfile_alloc failed: %i", r);
-    return r;
-  }
-  fileid = r;
-
   // Open the file
   if (req->req_omode & O_CREAT) {
     if ((r = file_create(path, &f)) < 0) {
@@ -123,6 +219,10 @@ serve_open(envid_t envid, struct Fsreq_open *req,
         cprintf("file_create failed: %i", r);
       return r;
     }
+    if (req->req_omode & O_MKDIR) {
+      f->f_type = FTYPE_DIR;
+      jnl_add(f);
+    }
   } else {
   try_open:
     if ((r = file_open(path, &f)) < 0) {
@@ -146,6 +246,15 @@ serve_open(envid_t envid, struct Fsreq_open *req,
     return r;
   }
 
+  // Find an open file ID.  Nothing waits between here and the reply,
+  // so no other request can take the same one.
+  if ((r = openfile_alloc(&o)) < 0) {
+    if (debug)
+      cprintf("openfile_alloc failed: %i", r);
+    return r;
+  }
+  fileid = r;
+
   // Save the file pointer
   o->o_file = f;
 
@@ -174,7 +283,7 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req) {
   int r;
 
   if (debug)
-    cprintf("serve_set_size %08x %08x %08x\n", envid, req->req_fileid, req->req_size);
+    cprintf("serve_set_size %08x %08x %08lx\n", envid, req->req_fileid, (long)req->req_size);
 
   // Every file system IPC call has the same general structure.
   // Here's how it goes.
@@ -211,13 +320,164 @@ serve_read(envid_t envid, union Fsipc *ipc) {
   if (req->req_n > BUFSIZE) {
     req->req_n = BUFSIZE;
   }
+  openfile_lock(o);
   int count = file_read(o->o_file, ret->ret_buf, req->req_n, o->o_fd->fd_offset);
   if (count > 0) {
     o->o_fd->fd_offset += count;
   }
+  openfile_unlock(o);
+  return count;
+}
+
+// Map the page of req->req_fileid at the current seek position into
+// the caller instead of copying it out: the block cache page itself is
+// returned in *pg_store, read-only copy-on-write, and the seek position
+// moves past it.  Only whole pages at page-aligned positions that are
+// allocated on disk can be mapped; for anything else this returns
+// -E_INVAL and the caller should fall back to FSREQ_READ.  Returns the
+// number of bytes mapped (PGSIZE) on success.
+int
+serve_read_map(envid_t envid, struct Fsreq_read_map *req,
+               void **pg_store, int *perm_store) {
+  struct OpenFile *o;
+  uint64_t diskbno;
+  off_t offset;
+  int r;
+
+  static_assert(BLKSIZE == PGSIZE, "Block cache pages are not blocks");
+
+  if (debug)
+    cprintf("serve_read_map %08x %08x\n", envid, req->req_fileid);
+
+  if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+    return r;
+  openfile_lock(o);
+  offset = o->o_fd->fd_offset;
+  r      = -E_INVAL;
+  if (offset % PGSIZE != 0 || o->o_file->f_size - offset < PGSIZE)
+    goto out;
+  if ((r = file_block_walk(o->o_file, offset / BLKSIZE, &diskbno, 0)) < 0)
+    goto out;
+  r = -E_INVAL;
+  if (diskbno == 0)
+    goto out;
+  if ((r = bc_share(diskaddr(diskbno))) < 0)
+    goto out;
+
+  o->o_fd->fd_offset += PGSIZE;
+  fsstats.rd_mapped++;
+  *pg_store   = diskaddr(diskbno);
+  *perm_store = PTE_P | PTE_U | PTE_COW;
+  r           = PGSIZE;
+out:
+  openfile_unlock(o);
+  return r;
+}
+
+// Map the page of req->req_fileid at file offset req->req_offset into
+// the caller, without moving the seek position.  A whole page backed by
+// a disk block is the block cache page itself, shared read-only (see
+// bc_share); the last, partial page of the file and holes are sent as
+// fresh copies, zero past the end of the file.  With req->req_cow set
+// the page is mapped copy-on-write, otherwise plain read-only.
+// Returns PGSIZE on success, < 0 on error.
+int
+serve_map(envid_t envid, struct Fsreq_map *req, void **pg_store, int *perm_store) {
+  struct OpenFile *o;
+  struct File *f;
+  uint64_t diskbno = 0;
+  off_t offset = req->req_offset;
+  int r;
+
+  if (debug)
+    cprintf("serve_map %08x %08x %08lx\n", envid, req->req_fileid, (long)offset);
+
+  if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+    return r;
+  f = o->o_file;
+  if (offset < 0 || offset % PGSIZE != 0 || offset >= f->f_size)
+    return -E_INVAL;
+
+  if (f->f_size - offset >= PGSIZE &&
+      (r = file_block_walk(f, offset / BLKSIZE, &diskbno, 0)) < 0)
+    return r;
+  if (diskbno) {
+    if ((r = bc_share(diskaddr(diskbno))) < 0)
+      return r;
+    *pg_store = diskaddr(diskbno);
+    fsstats.mp_shared++;
+  } else {
+    // Allocating over the last copy drops our reference to it.
+    if ((r = sys_page_alloc(0, curworker->w_maptemp, PTE_P | PTE_U | PTE_W)) < 0)
+      return r;
+    if ((r = file_read(f, curworker->w_maptemp, PGSIZE, offset)) < 0)
+      return r;
+    *pg_store = curworker->w_maptemp;
+    fsstats.mp_copied++;
+  }
+  *perm_store = PTE_P | PTE_U | (req->req_cow ? PTE_COW : 0);
+  return PGSIZE;
+}
+
+// Check that the client memory sent with a vectored request holds n
+// bytes from pgoff into its first page, and return a pointer to them,
+// or NULL if they do not fit.
+static char *
+serve_vec_buf(size_t n, size_t pgoff) {
+  size_t nvec = curworker->w_npages ? curworker->w_npages - 1 : 0;
+
+  if (pgoff >= PGSIZE || n > nvec * PGSIZE - pgoff)
+    return NULL;
+  return (char *)curworker->w_req + PGSIZE + pgoff;
+}
+
+// Read req->req_n bytes from the current seek position in
+// req->req_fileid straight into the client pages sent with the request
+// and update the seek position.  Returns the number of bytes read, or
+// < 0 on error.
+int
+serve_readv(envid_t envid, struct Fsreq_vec *req) {
+  struct OpenFile *o;
+  char *buf;
+  ssize_t count;
+  int r;
+
+  if (debug)
+    cprintf("serve_readv %08x %08x %08lx\n", envid, req->req_fileid, (long)req->req_n);
+
+  if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+    return r;
+  if (!(buf = serve_vec_buf(req->req_n, req->req_pgoff)))
+    return -E_INVAL;
+  openfile_lock(o);
+  if ((count = file_read(o->o_file, buf, req->req_n, o->o_fd->fd_offset)) > 0)
+    o->o_fd->fd_offset += count;
+  openfile_unlock(o);
   return count;
 }
 
+// Write req->req_n bytes from the client pages sent with the request
+// to req->req_fileid at the current seek position, extending the file
+// if necessary, and update the seek position.  Returns the number of
+// bytes written, or < 0 on error.
+int
+serve_writev(envid_t envid, struct Fsreq_vec *req) {
+  struct OpenFile *o;
+  char *buf;
+  int r;
+
+  if (debug)
+    cprintf("serve_writev %08x %08x %08lx\n", envid, req->req_fileid, (long)req->req_n);
+
+  if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+    return r;
+  if (!(buf = serve_vec_buf(req->req_n, req->req_pgoff)))
+    return -E_INVAL;
+  if ((r = file_write(o->o_file, buf, req->req_n, o->o_fd->fd_offset)) > 0)
+    o->o_fd->fd_offset += r;
+  return r;
+}
+
 // Write req->req_n bytes from req->req_buf to req_fileid, starting at
 // the current seek position, and update the seek position
 // accordingly.  Extend the file if necessary.  Returns the number of
@@ -241,6 +501,16 @@ serve_write(envid_t envid, struct Fsreq_write *req) {
 	return count;
 }
 
+// Describe f in ret.
+static void
+serve_fill_stat(struct File *f, struct Fsret_stat *ret) {
+  strcpy(ret->ret_name, f->f_name);
+  ret->ret_size     = f->f_size;
+  ret->ret_isdir    = (f->f_type == FTYPE_DIR);
+  ret->ret_nblocks  = file_nblocks(f);
+  ret->ret_nextents = f->f_nextents;
+}
+
 // Stat ipc->stat.req_fileid.  Return the file's struct Stat to the
 // caller in ipc->statRet.
 int
@@ -256,12 +526,67 @@ serve_stat(envid_t envid, union Fsipc *ipc) {
   if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
     return r;
 
-  strcpy(ret->ret_name, o->o_file->f_name);
-  ret->ret_size  = o->o_file->f_size;
-  ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
+  serve_fill_stat(o->o_file, ret);
   return 0;
 }
 
+// Stat the file ipc->stat_path.req_path without opening it.  Return
+// its struct Stat to the caller in ipc->statRet.
+int
+serve_stat_path(envid_t envid, union Fsipc *ipc) {
+  char path[MAXPATHLEN];
+  struct File *f;
+  int r;
+
+  if (debug)
+    cprintf("serve_stat_path %08x %s\n", envid, ipc->stat_path.req_path);
+
+  // The reply overwrites the path.
+  memmove(path, ipc->stat_path.req_path, MAXPATHLEN);
+  path[MAXPATHLEN - 1] = 0;
+  if ((r = file_open(path, &f)) < 0)
+    return r;
+  serve_fill_stat(f, &ipc->statRet);
+  return 0;
+}
+
+// Read the first req_n bytes of the file ipc->read_whole.req_path
+// without opening it.  The data goes into the client pages sent with
+// the request, req_pgoff into the first one, or if there are none into
+// ipc->read_wholeRet.ret_buf (then at most its size is read).  The
+// file's size is returned in ipc->read_wholeRet.ret_size.  Returns the
+// number of bytes read, or < 0 on error.
+int
+serve_read_whole(envid_t envid, union Fsipc *ipc) {
+  struct Fsret_read_whole *ret = &ipc->read_wholeRet;
+  char path[MAXPATHLEN];
+  size_t n = ipc->read_whole.req_n;
+  struct File *f;
+  ssize_t count;
+  char *buf;
+  int r;
+
+  if (debug)
+    cprintf("serve_read_whole %08x %s %08lx\n", envid, ipc->read_whole.req_path, (long)n);
+
+  memmove(path, ipc->read_whole.req_path, MAXPATHLEN);
+  path[MAXPATHLEN - 1] = 0;
+  if (curworker->w_npages > 1) {
+    if (!(buf = serve_vec_buf(n, ipc->read_whole.req_pgoff)))
+      return -E_INVAL;
+  } else {
+    n   = MIN(n, sizeof(ret->ret_buf));
+    buf = ret->ret_buf;
+  }
+
+  if ((r = file_open(path, &f)) < 0)
+    return r;
+  if ((count = file_read(f, buf, n, 0)) < 0)
+    return count;
+  ret->ret_size = f->f_size;
+  return count;
+}
+
 // Flush all data and metadata of req->req_fileid to disk.
 int
 serve_flush(envid_t envid, struct Fsreq_flush *req) {
@@ -277,57 +602,263 @@ serve_flush(envid_t envid, struct Fsreq_flush *req) {
   return 0;
 }
 
+// Remove the file req->req_path.
+int
+serve_remove(envid_t envid, struct Fsreq_remove *req) {
+  char path[MAXPATHLEN];
+
+  if (debug)
+    cprintf("serve_remove %08x %s\n", envid, req->req_path);
+
+  // Copy in the path, making sure it's null-terminated
+  memmove(path, req->req_path, MAXPATHLEN);
+  path[MAXPATHLEN - 1] = 0;
+
+  return file_remove(path);
+}
+
 int
 serve_sync(envid_t envid, union Fsipc *req) {
   fs_sync();
   return 0;
 }
 
+// List the directory req_fileid from directory offset req_cookie on.
+// Packs as many entries as fit into ipc->readdirRet, along with the
+// offset to resume from.  Returns the number of entries, 0 at the end
+// of the directory.
+int
+serve_readdir(envid_t envid, union Fsipc *ipc) {
+  struct Fsret_readdir *ret = &ipc->readdirRet;
+  struct OpenFile *o;
+  struct Fsdirent *de;
+  struct File *f;
+  size_t len = 0, namelen, reclen;
+  uint32_t slot;
+  int r, n = 0;
+
+  if (debug)
+    cprintf("serve_readdir %08x %08x %08lx\n", envid, ipc->readdir.req_fileid,
+            (long)ipc->readdir.req_cookie);
+
+  if ((r = openfile_lookup(envid, ipc->readdir.req_fileid, &o)) < 0)
+    return r;
+  if (o->o_file->f_type != FTYPE_DIR || ipc->readdir.req_cookie < 0 ||
+      ipc->readdir.req_cookie % sizeof(struct File))
+    return -E_INVAL;
+  // The reply overwrites the request.
+  slot = ipc->readdir.req_cookie / sizeof(struct File);
+
+  for (;; slot++) {
+    if ((r = dir_read(o->o_file, &slot, &f)) < 0) {
+      if (r != -E_NOT_FOUND)
+        return r;
+      slot = o->o_file->f_size / sizeof(struct File);
+      break;
+    }
+    namelen = strlen(f->f_name);
+    reclen  = FSDIRENT_RECLEN(namelen);
+    if (len + reclen > sizeof(ret->ret_buf))
+      break;
+    de            = (struct Fsdirent *)(ret->ret_buf + len);
+    de->de_size   = f->f_size;
+    de->de_slot   = slot;
+    de->de_reclen = reclen;
+    de->de_type   = f->f_type;
+    de->de_pad    = 0;
+    memcpy(de->de_name, f->f_name, namelen + 1);
+    len += reclen;
+    n++;
+  }
+  ret->ret_cookie = (off_t)slot * sizeof(struct File);
+  ret->ret_len    = len;
+  return n;
+}
+
+// Return the server's counters in ipc->statsRet.
+int
+serve_stats(envid_t envid, union Fsipc *ipc) {
+  ipc->statsRet.ret_stats = fsstats;
+  return 0;
+}
+
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
-    // Open is handled specially because it passes pages
+    // Open and the map requests are handled specially because they
+    // pass pages
     /* [FSREQ_OPEN] =	(fshandler)serve_open, */
-    [FSREQ_READ]     = serve_read,
-    [FSREQ_STAT]     = serve_stat,
-    [FSREQ_FLUSH]    = (fshandler)serve_flush,
-    [FSREQ_WRITE]    = (fshandler)serve_write,
-    [FSREQ_SET_SIZE] = (fshandler)serve_set_size,
-    [FSREQ_SYNC]     = serve_sync};
+    [FSREQ_READ]       = serve_read,
+    [FSREQ_STAT]       = serve_stat,
+    [FSREQ_FLUSH]      = (fshandler)serve_flush,
+    [FSREQ_WRITE]      = (fshandler)serve_write,
+    [FSREQ_SET_SIZE]   = (fshandler)serve_set_size,
+    [FSREQ_REMOVE]     = (fshandler)serve_remove,
+    [FSREQ_SYNC]       = serve_sync,
+    [FSREQ_STATS]      = serve_stats,
+    [FSREQ_READV]      = (fshandler)serve_readv,
+    [FSREQ_WRITEV]     = (fshandler)serve_writev,
+    [FSREQ_READDIR]    = serve_readdir,
+    [FSREQ_STAT_PATH]  = serve_stat_path,
+    [FSREQ_READ_WHOLE] = serve_read_whole};
 #define NHANDLERS (sizeof(handlers) / sizeof(handlers[0]))
 
+// Does request w change the file system?
+static bool
+serve_changes(struct Worker *w) {
+  switch (w->w_type) {
+    case FSREQ_OPEN:
+      return w->w_req->open.req_omode & (O_CREAT | O_TRUNC | O_MKDIR);
+    case FSREQ_READ:
+    case FSREQ_READ_MAP:
+    case FSREQ_MAP:
+    case FSREQ_READV:
+    case FSREQ_STAT:
+    case FSREQ_STAT_PATH:
+    case FSREQ_READ_WHOLE:
+    case FSREQ_READDIR:
+    case FSREQ_STATS:
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+// Serve the request that worker w received, and reply.
+static void
+serve_request(struct Worker *w) {
+  union Fsipc *fsreq = w->w_req;
+  uint32_t req       = w->w_type;
+  envid_t whom       = w->w_whom;
+  int perm           = w->w_perm;
+  bool excl          = serve_changes(w);
+  size_t i;
+  void *pg;
+  int r;
+
+  serve_lock(excl);
+  pg = NULL;
+  if (req == FSREQ_OPEN) {
+    r = serve_open(whom, (struct Fsreq_open *)fsreq, &pg, &perm);
+  } else if (req == FSREQ_READ_MAP) {
+    r = serve_read_map(whom, (struct Fsreq_read_map *)fsreq, &pg, &perm);
+  } else if (req == FSREQ_MAP) {
+    r = serve_map(whom, (struct Fsreq_map *)fsreq, &pg, &perm);
+  } else if (req < NHANDLERS && handlers[req]) {
+    r = handlers[req](whom, fsreq);
+  } else {
+    cprintf("Invalid request code %d from %08x\n", req, whom);
+    r = -E_INVAL;
+  }
+  serve_unlock(excl);
+  ipc_send(whom, r, pg, perm);
+  for (i = 0; i < w->w_npages; i++)
+    sys_page_unmap(0, (char *)fsreq + i * PGSIZE);
+}
+
+static void
+worker_main(void *arg) {
+  struct Worker *w = arg;
+
+  while (1) {
+    serve_request(w);
+    w->w_busy = 0;
+    coro_switch(&w->w_co, &serve_co);
+  }
+}
+
+// Run worker w until it finishes its request or has to wait.
+static void
+worker_run(struct Worker *w) {
+  uintptr_t rsp;
+
+  if (w->w_uxlen)
+    memmove((char *)UXSTACKTOP - w->w_uxlen, w->w_uxstack, w->w_uxlen);
+  curworker = w;
+  coro_switch(&serve_co, &w->w_co);
+  curworker = NULL;
+
+  rsp        = w->w_co.co_rsp;
+  w->w_uxlen = 0;
+  if (rsp >= UXSTACKTOP - UXSTACKSIZE && rsp < UXSTACKTOP) {
+    w->w_uxlen = UXSTACKTOP - rsp;
+    memmove(w->w_uxstack, (void *)rsp, w->w_uxlen);
+  }
+}
+
+static void
+worker_init(void) {
+  struct Worker *w;
+  size_t i, off;
+  char *va;
+  int r;
+
+  static_assert(1 + FSVEC_MAXPAGES + 2 + WORKERSTACK / PGSIZE <= WORKERSIZE / PGSIZE,
+                "Worker area too small");
+
+  for (i = 0; i < NWORKERS; i++) {
+    w            = &workers[i];
+    va           = (char *)WORKERVA + i * WORKERSIZE;
+    w->w_req     = (union Fsipc *)va;
+    w->w_maptemp = va + (1 + FSVEC_MAXPAGES) * PGSIZE;
+    w->w_scratch = va + (2 + FSVEC_MAXPAGES) * PGSIZE;
+    va += WORKERSIZE - WORKERSTACK;
+    for (off = 0; off < WORKERSTACK; off += PGSIZE)
+      if ((r = sys_page_alloc(0, va + off, PTE_P | PTE_U | PTE_W)) < 0)
+        panic("worker_init: sys_page_alloc: %i", r);
+    coro_init(&w->w_co, va, WORKERSTACK, worker_main, w);
+  }
+}
+
 void
 serve(void) {
-  uint32_t req, whom;
-  int perm, r;
-  void *pg;
+  struct Worker *w;
+  size_t i, nbusy;
+  int32_t req;
 
+  worker_init();
   while (1) {
-    perm = 0;
-    req  = ipc_recv((int32_t *)&whom, fsreq, &perm);
-    if (debug)
-      cprintf("fs req %d from %08x [page %08lx: %s]\n",
-              req, whom, (unsigned long)uvpt[PGNUM(fsreq)],
-              (char *)fsreq);
-
-    // All requests must contain an argument page
-    if (!(perm & PTE_P)) {
-      cprintf("Invalid request from %08x: no argument page\n",
-              whom);
-      continue; // just leave it hanging...
+    // Take in a request if a worker is free: wait for one if nothing
+    // else is going on, otherwise only pick up one already sent.
+    w     = NULL;
+    nbusy = 0;
+    for (i = 0; i < NWORKERS; i++) {
+      if (workers[i].w_busy)
+        nbusy++;
+      else if (!w)
+        w = &workers[i];
     }
-
-    pg = NULL;
-    if (req == FSREQ_OPEN) {
-      r = serve_open(whom, (struct Fsreq_open *)fsreq, &pg, &perm);
-    } else if (req < NHANDLERS && handlers[req]) {
-      r = handlers[req](whom, fsreq);
-    } else {
-      cprintf("Invalid request code %d from %08x\n", req, whom);
-      r = -E_INVAL;
+    if (w) {
+      w->w_perm = 0;
+      if (!nbusy) {
+        jnl_tick();
+        req = ipc_recvv((int32_t *)&w->w_whom, w->w_req, 1 + FSVEC_MAXPAGES,
+                        &w->w_perm, &w->w_npages);
+      } else {
+        req = ipc_try_recvv((int32_t *)&w->w_whom, w->w_req, 1 + FSVEC_MAXPAGES,
+                            &w->w_perm, &w->w_npages);
+      }
+      if (req >= 0) {
+        fsstats.requests++;
+        if (debug)
+          cprintf("fs req %d from %08x [page %08lx: %s]\n",
+                  req, w->w_whom, (unsigned long)uvpt[PGNUM(w->w_req)],
+                  (char *)w->w_req);
+
+        // All requests must contain an argument page
+        if (!(w->w_perm & PTE_P)) {
+          cprintf("Invalid request from %08x: no argument page\n",
+                  w->w_whom);
+          continue; // just leave it hanging...
+        }
+        w->w_type = req;
+        w->w_busy = 1;
+      }
     }
-    ipc_send(whom, r, pg, perm);
-    sys_page_unmap(0, fsreq);
+
+    for (i = 0; i < NWORKERS; i++)
+      if (workers[i].w_busy)
+        worker_run(&workers[i]);
   }
 }
 
@@ -15,22 +15,22 @@ check_consistency(void) {
 void
 check_dir(struct File *dir) {
   int r, i, j, k;
-  uint32_t *blk;
+  uint64_t blk;
   struct File *files;
 
   uint32_t nblock = dir->f_size / BLKSIZE;
   for (i = 0; i < nblock; ++i) {
 
-    if ((r = file_block_walk(dir, i, &blk, 0)) < 0) {
+    if ((r = file_block_walk(dir, i, &blk, 0)) < 0 || blk == 0) {
       continue;
     }
 
-    files = (struct File *)diskaddr(*blk);
+    files = (struct File *)diskaddr(blk);
 
     for (j = 0; j < BLKFILES; ++j) {
       struct File *f = &(files[j]);
       if (strcmp(f->f_name, "\0") != 0) {
-        uint32_t *pdiskbno = NULL;
+        uint64_t diskbno = 0;
 
         cprintf("checking consistency of %s\n", f->f_name);
 
@@ -38,10 +38,10 @@ check_dir(struct File *dir) {
           if (f->f_type == FTYPE_DIR) {
             check_dir(f);
           }
-          if (file_block_walk(f, k, &pdiskbno, 0) < 0 || pdiskbno == NULL || *pdiskbno == 0) {
+          if (file_block_walk(f, k, &diskbno, 0) < 0 || diskbno == 0) {
             continue;
           }
-          assert(!block_is_free(*pdiskbno));
+          assert(!block_is_free(diskbno));
         }
       }
     }
@@ -93,7 +93,7 @@ fs_test(void) {
 
   if ((r = file_set_size(f, 0)) < 0)
     panic("file_set_size: %i", r);
-  assert(f->f_direct[0] == 0);
+  assert(f->f_nextents == 0);
   assert(!(uvpt[PGNUM(f)] & PTE_D));
   cprintf("file_truncate is good\n");
 
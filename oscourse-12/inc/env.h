@@ -71,6 +71,39 @@ struct Env {
   uint32_t env_ipc_value; // Data value sent to us
   envid_t env_ipc_from;   // envid of the sender
   int env_ipc_perm;       // Perm of page mapping received
+  size_t env_ipc_maxpages; // Pages we accept at env_ipc_dstva onwards
+  size_t env_ipc_npages;   // Pages received
+  bool env_ipc_polling;    // Receive offer lapses when the env next runs
+
+  // Sleep and wakeup (see sys_env_sleep)
+  bool env_sleeping;         // Env is blocked in sys_env_sleep
+  bool env_wakeup;           // A wakeup came while it was not sleeping
+  void *env_sleep_dstva;     // VA at which to map pages the waker hands over
+  size_t env_sleep_maxpages; // Pages we accept at env_sleep_dstva onwards
+  size_t env_sleep_npages;   // Pages received with the last wakeup
+  unsigned env_sleep_flags;  // ENV_SLEEP_* of the current sleep
+  uint64_t env_sleep_deadline; // TSC value to give up at, or 0
+
+  // Futex wait (see kern/futex.c)
+  bool env_futex_waiting;        // Env is blocked in sys_futex_wait
+  physaddr_t env_futex_key;      // Physical address of the word waited on
+  uint64_t env_futex_deadline;   // TSC value to give up at, or 0
+  struct Env *env_futex_next;    // Next waiter in the same bucket
+
+  // Exit status and waiting for exit (see sys_env_wait)
+  int env_exit_status;         // Status to report; kept after the env is freed
+  struct Env *env_waiters;     // Envs blocked in sys_env_wait on this one
+  struct Env *env_wait_target; // Env we are blocked waiting on, or NULL
+  struct Env *env_wait_next;   // Next env waiting on the same target
+
+  // x87 and SSE registers, saved by fxsave while another env has them
+  uint8_t env_fxsave[512] __attribute__((aligned(16)));
 };
 
+// Flags for sys_env_sleep
+#define ENV_SLEEP_CONS 0x1 // Also wake when console input arrives
+
+// Most pages one IPC message may carry (see sys_ipc_try_sendv)
+#define IPC_MAXPAGES 128
+
 #endif // !JOS_INC_ENV_H
@@ -29,6 +29,13 @@ enum {
   E_NOT_EXEC    = 17, // File not a valid executable
   E_NOT_SUPP    = 18, // Operation not supported
 
+  // Futex error codes
+  E_AGAIN   = 19, // Value changed before the wait began
+  E_TIMEOUT = 20, // Wait timed out
+
+  // More file system error codes
+  E_NOT_EMPTY = 21, // Directory is not empty
+
   MAXERROR
 };
 
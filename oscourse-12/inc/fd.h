@@ -21,12 +21,19 @@ struct Dev {
   int (*dev_close)(struct Fd *fd);
   int (*dev_stat)(struct Fd *fd, struct Stat *stat);
   int (*dev_trunc)(struct Fd *fd, off_t length);
+  int (*dev_seek)(struct Fd *fd, off_t offset);  // optional
+  int (*dev_fsync)(struct Fd *fd);               // optional
+  int (*dev_poll)(struct Fd *fd, int events, unsigned *sleep); // optional
 };
 
 struct FdFile {
   int id;
 };
 
+struct FdCons {
+  volatile int pending; // character poll took from the console, or 0
+};
+
 struct Fd {
   int fd_dev_id;
   off_t fd_offset;
@@ -34,6 +41,8 @@ struct Fd {
   union {
     // File server files
     struct FdFile fd_file;
+    // Console
+    struct FdCons fd_cons;
   };
 };
 
@@ -41,9 +50,32 @@ struct Stat {
   char st_name[MAXNAMELEN];
   off_t st_size;
   int st_isdir;
+  uint64_t st_nblocks;  // disk blocks allocated to the file
+  uint32_t st_nextents; // contiguous runs those blocks form
   struct Dev *st_dev;
 };
 
+struct Dirent {
+  char d_name[MAXNAMELEN];
+  off_t d_size;
+  int d_isdir;
+};
+
+// One file descriptor for poll to look at
+struct pollfd {
+  int fd;        // file descriptor, or < 0 to be skipped
+  short events;  // POLLIN and POLLOUT wanted
+  short revents; // what is ready, set by poll
+};
+
+#define POLLIN   0x001 // read will not block
+#define POLLOUT  0x004 // write will not block
+#define POLLHUP  0x010 // the other end is gone (revents only)
+#define POLLNVAL 0x020 // fd is not open (revents only)
+
+// Size of the data area each file descriptor has at fd2data(fd)
+#define FDDATASIZE (16 * PGSIZE)
+
 char *fd2data(struct Fd *fd);
 uint64_t fd2num(struct Fd *fd);
 int fd_alloc(struct Fd **fd_store);
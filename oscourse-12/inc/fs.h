@@ -19,26 +19,51 @@
 // Maximum size of a complete pathname, including null
 #define MAXPATHLEN 1024
 
-// Number of block pointers in a File descriptor
-#define NDIRECT 10
-// Number of direct block pointers in an indirect block
-#define NINDIRECT (BLKSIZE / 4)
+// A run of 'e_len' file blocks starting at file block 'e_lblk',
+// stored in consecutive disk blocks starting at 'e_pblk'.
+struct Extent {
+  uint32_t e_lblk; // first file block covered
+  uint32_t e_len;  // number of blocks
+  uint64_t e_pblk; // first disk block
+} __attribute__((packed));
+
+// Number of extents stored directly in a File descriptor
+#define NEXTENT 6
+// Number of extents in an extent block
+#define EXTPERBLK (BLKSIZE / sizeof(struct Extent))
+// Number of extent block pointers in the extent index block
+#define NEXTBLK (BLKSIZE / sizeof(uint64_t))
+// Maximum number of extents a file can have
+#define MAXEXTENTS (NEXTENT + NEXTBLK * EXTPERBLK)
 
-#define MAXFILESIZE ((NDIRECT + NINDIRECT) * BLKSIZE)
+// Largest file size: file block numbers are 32 bits wide.
+#define MAXFILESIZE ((off_t)UINT32_MAX * BLKSIZE)
 
 struct File {
   char f_name[MAXNAMELEN]; // filename
   off_t f_size;            // file size in bytes
   uint32_t f_type;         // file type
+  uint32_t f_flags;        // FILE_* flags
 
-  // Block pointers.
-  // A block is allocated iff its value is != 0.
-  uint32_t f_direct[NDIRECT]; // direct blocks
-  uint32_t f_indirect;        // indirect block
+  // Extent map, sorted by e_lblk.  The first NEXTENT extents live in
+  // f_extents; the rest are in extent blocks whose disk addresses are
+  // listed in the extent index block f_extblock.
+  // A file block is allocated iff some extent covers it.
+  // Files flagged FILE_INLINE have no extents; their data is kept in
+  // f_data instead, zero past f_size.
+  uint32_t f_nextents; // number of extents in use
+  union {
+    struct {
+      uint64_t f_extblock;              // extent index block, 0 if none
+      struct Extent f_extents[NEXTENT]; // first extents
+    };
+    char f_data[sizeof(uint64_t) + NEXTENT * sizeof(struct Extent)];
+  };
 
-  // Pad out to 256 bytes; must do arithmetic in case we're compiling
-  // fsformat on a 64-bit machine.
-  uint8_t f_pad[256 - MAXNAMELEN - 8 - 4 * NDIRECT - 4];
+  // Cached fs_name_hash(f_name) of a directory entry, or 0 if unknown.
+  // In a free entry of an indexed directory it links the free list
+  // instead (next free slot + 1, 0 at the end).
+  uint32_t f_hash;
 } __attribute__((packed)); // required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -48,16 +73,133 @@ struct File {
 #define FTYPE_REG 0 // Regular file
 #define FTYPE_DIR 1 // Directory
 
+// File flags
+#define FILE_DIRINDEX 0x1 // Directory has a hash index
+#define FILE_INLINE   0x2 // Regular file with its data in f_data
+
+// Largest file kept inline
+#define FILE_INLINE_MAX ((off_t)sizeof(((struct File *)0)->f_data))
+
+// Directory hash index.
+// Directories of at least DIRINDEX_MINBLOCKS blocks keep an open
+// addressing hash table from name hashes to entry slots (slot n is
+// entry n % BLKFILES of directory block n / BLKFILES).  It is stored in
+// the directory's own file blocks starting at DIRINDEX_LBLK, far past
+// any directory entries, so the entry blocks keep their format and
+// readers of the directory never see the index.  The first index block
+// holds a struct DirIndex; the buckets follow.
+#define DIRINDEX_LBLK      0x80000000U
+#define DIRINDEX_MINBLOCKS 4
+
+struct DirIndex {
+  uint32_t di_nbuckets; // number of buckets, a power of two
+  uint32_t di_nentries; // buckets holding an entry
+  uint32_t di_nused;    // buckets holding an entry or a tombstone
+  uint32_t di_nslots;   // slots ever handed out (high water mark)
+  uint32_t di_freelist; // first free slot below di_nslots + 1, 0 if none
+};
+
+struct DirBucket {
+  uint32_t db_hash; // fs_name_hash of the entry name
+  uint32_t db_slot; // entry slot + 1, 0 if empty, DIRBUCKET_DELETED
+};
+
+#define DIRBUCKET_DELETED 0xFFFFFFFFU
+#define DIRBUCKETS        (BLKSIZE / sizeof(struct DirBucket))
+
+// Hash of a file name (32-bit FNV-1a), never 0 so that 0 can mean
+// "not computed".
+static inline uint32_t
+fs_name_hash(const char *name) {
+  uint32_t h = 2166136261U;
+
+  while (*name)
+    h = (h ^ (uint8_t)*name++) * 16777619U;
+  return h ? h : 1;
+}
+
 // File system super-block (both in-memory and on-disk)
 
 #define FS_MAGIC 0x4A0530AE // related vaguely to 'J\0S!'
 
+// On-disk layout versions.  Images from older fsformat builds have a
+// zero s_version and describe files with NDIRECT direct block pointers
+// plus one indirect block; the server converts them to extents when it
+// mounts them.  Inline files are new in FS_VERSION_INLINE and the
+// metadata journal in FS_VERSION_JOURNAL; images of the versions in
+// between are valid as they are and just get the new version number
+// (with no journal: s_jblocks is zero in them).
+#define FS_VERSION_BLOCKMAP 0
+#define FS_VERSION_EXTENTS  1
+#define FS_VERSION_INLINE   2
+#define FS_VERSION_JOURNAL  3
+#define FS_VERSION          FS_VERSION_JOURNAL
+
+// Block map layout of FS_VERSION_BLOCKMAP file systems
+#define NDIRECT   10
+#define NINDIRECT (BLKSIZE / 4)
+
 struct Super {
   uint32_t s_magic;   // Magic number: FS_MAGIC
   uint32_t s_nblocks; // Total number of blocks on disk
   struct File s_root; // Root directory node
+  uint32_t s_version; // On-disk layout version: FS_VERSION_*
+  uint32_t s_journal; // First journal block (its header), 0 if none
+  uint32_t s_jblocks; // Journal blocks, header included
+};
+
+// Metadata journal.
+// Changed metadata blocks (file descriptors, directory blocks, extent
+// blocks, the bitmap) are written to a circular log before they go to
+// their home locations.  The log is the s_jblocks - 1 blocks after the
+// header at s_journal.  Each transaction in it is a JournalDesc block
+// listing the home block numbers, a copy of each of those blocks, and a
+// JournalCommit block; a transaction counts only once its commit block
+// is on disk with the right checksum.  The header says where the
+// oldest transaction whose blocks may not all be home yet starts.
+#define JNL_MAGIC_HEADER 0x4A4E4C48 // 'JNLH'
+#define JNL_MAGIC_DESC   0x4A4E4C44 // 'JNLD'
+#define JNL_MAGIC_COMMIT 0x4A4E4C43 // 'JNLC'
+
+// Most blocks in one transaction
+#define JNL_MAXTX 64
+// Smallest useful journal: the header plus one full transaction
+#define JNL_MINBLOCKS (1 + JNL_MAXTX + 2)
+
+struct JournalHeader {
+  uint32_t jh_magic; // JNL_MAGIC_HEADER
+  uint32_t jh_tail;  // log offset of the oldest live transaction
+  uint64_t jh_seq;   // its sequence number
+};
+
+struct JournalDesc {
+  uint32_t jd_magic;             // JNL_MAGIC_DESC
+  uint32_t jd_n;                 // blocks in the transaction
+  uint64_t jd_seq;               // sequence number
+  uint64_t jd_blocks[JNL_MAXTX]; // home block of each copy
 };
 
+struct JournalCommit {
+  uint32_t jc_magic; // JNL_MAGIC_COMMIT
+  uint32_t jc_n;     // same as jd_n
+  uint64_t jc_seq;   // same as jd_seq
+  uint64_t jc_sum;   // jnl_checksum of the copies
+};
+
+// Checksum of the block copies of a transaction (64-bit FNV-1a over
+// their words), so that a torn commit is not replayed.
+static inline uint64_t
+jnl_checksum(uint64_t sum, const void *blk) {
+  const uint64_t *w = blk;
+  size_t i;
+
+  for (i = 0; i < BLKSIZE / sizeof(uint64_t); i++)
+    sum = (sum ^ w[i]) * 1099511628211ULL;
+  return sum;
+}
+
+#define JNL_CHECKSUM_INIT 14695981039346656037ULL
+
 // Definitions for requests from clients to file system
 enum {
   FSREQ_OPEN = 1,
@@ -69,7 +211,66 @@ enum {
   FSREQ_STAT,
   FSREQ_FLUSH,
   FSREQ_REMOVE,
-  FSREQ_SYNC
+  FSREQ_SYNC,
+  // Stats returns a Fsret_stats on the request page
+  FSREQ_STATS,
+  // Read map returns the next page of the file as the reply page
+  FSREQ_READ_MAP,
+  // Map returns the page of the file at req_offset as the reply page
+  FSREQ_MAP,
+  // Vectored read and write carry up to FSVEC_MAXPAGES pages of client
+  // memory after the request page; the data is at req_pgoff into them
+  FSREQ_READV,
+  FSREQ_WRITEV,
+  // Readdir returns a Fsret_readdir on the request page
+  FSREQ_READDIR,
+  // Compound requests on a path, without opening a file: stat path
+  // returns a Fsret_stat on the request page; read whole returns the
+  // start of the file either in the client pages sent with the request
+  // (as for FSREQ_READV) or, if there are none, in a Fsret_read_whole
+  FSREQ_STAT_PATH,
+  FSREQ_READ_WHOLE
+};
+
+#define FSVEC_MAXPAGES 64
+
+// One directory entry in an FSREQ_READDIR reply.  Entries are packed
+// back to back in ret_buf, each de_reclen bytes long (a multiple of 8
+// that holds the NUL-terminated name).
+struct Fsdirent {
+  off_t de_size;      // file size in bytes
+  uint32_t de_slot;   // entry number within the directory
+  uint16_t de_reclen; // bytes from this entry to the next
+  uint8_t de_type;    // FTYPE_*
+  uint8_t de_pad;
+  char de_name[];
+};
+
+#define FSDIRENT_RECLEN(namelen) ROUNDUP(sizeof(struct Fsdirent) + (namelen) + 1, 8)
+
+// Bytes of entries in one FSREQ_READDIR reply, leaving clients room to
+// keep a reply in a page along with some state.
+#define FSDIRENT_BUFSIZE (PGSIZE - 64)
+
+// File server counters, as returned by FSREQ_STATS
+struct FsStats {
+  uint64_t dc_hits;      // name cache lookups that found an entry
+  uint64_t dc_neg_hits;  // ... that found the name to be absent
+  uint64_t dc_misses;    // ... that had to search the directory
+  uint64_t dc_flushes;   // times the whole name cache was dropped
+  uint64_t rd_mapped;    // file pages mapped into clients by FSREQ_READ_MAP
+  uint64_t rd_cowfaults; // mapped cache pages copied before being written
+  uint64_t mp_shared;    // pages FSREQ_MAP handed out from the cache
+  uint64_t mp_copied;    // ... built as copies (file tails and holes)
+  uint64_t requests;     // requests received
+  uint64_t io_rdcmds;    // disk read commands
+  uint64_t io_wrcmds;    // disk write commands, after merging
+  uint64_t io_wrblocks;  // blocks those commands wrote
+  uint64_t io_seek;      // blocks the disk head moved between commands
+  uint64_t io_seek_fifo; // ... had every block been written on its own, in order
+  uint64_t jn_commits;   // journal transactions committed
+  uint64_t jn_blocks;    // metadata blocks they logged
+  uint64_t jn_ckpts;     // journal checkpoints
 };
 
 union Fsipc {
@@ -88,6 +289,19 @@ union Fsipc {
   struct Fsret_read {
     char ret_buf[PGSIZE];
   } readRet;
+  struct Fsreq_read_map {
+    int req_fileid;
+  } read_map;
+  struct Fsreq_map {
+    int req_fileid;
+    off_t req_offset;
+    int req_cow;
+  } map;
+  struct Fsreq_vec {
+    int req_fileid;
+    size_t req_n;
+    size_t req_pgoff;
+  } vec;
   struct Fsreq_write {
     int req_fileid;
     size_t req_n;
@@ -100,13 +314,41 @@ union Fsipc {
     char ret_name[MAXNAMELEN];
     off_t ret_size;
     int ret_isdir;
+    uint64_t ret_nblocks;
+    uint32_t ret_nextents;
   } statRet;
+  struct Fsreq_stat_path {
+    char req_path[MAXPATHLEN];
+  } stat_path;
+  struct Fsreq_read_whole {
+    size_t req_n;
+    size_t req_pgoff;
+    char req_path[MAXPATHLEN];
+  } read_whole;
+  struct Fsret_read_whole {
+    off_t ret_size; // size of the whole file
+    char ret_buf[PGSIZE - sizeof(off_t)];
+  } read_wholeRet;
   struct Fsreq_flush {
     int req_fileid;
   } flush;
   struct Fsreq_remove {
     char req_path[MAXPATHLEN];
   } remove;
+  struct Fsret_stats {
+    struct FsStats ret_stats;
+  } statsRet;
+  // Entries are listed from directory offset req_cookie on; ret_cookie
+  // is where the next request should resume.
+  struct Fsreq_readdir {
+    int req_fileid;
+    off_t req_cookie;
+  } readdir;
+  struct Fsret_readdir {
+    off_t ret_cookie;
+    size_t ret_len;
+    char ret_buf[FSDIRENT_BUFSIZE];
+  } readdirRet;
 
   // Ensure Fsipc is one page
   char _pad[PGSIZE];
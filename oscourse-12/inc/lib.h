@@ -44,6 +44,7 @@ extern const volatile struct PageInfo pages[];
 
 // exit.c
 void exit(void);
+void exitstatus(int status);
 
 // pgfault.c
 void set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
@@ -55,7 +56,8 @@ char *readline(const char *buf);
 void sys_cputs(const char *string, size_t len);
 int sys_cgetc(void);
 envid_t sys_getenvid(void);
-int sys_env_destroy(envid_t);
+int sys_env_destroy(envid_t env, int status);
+int sys_env_wait(envid_t env);
 void sys_yield(void);
 static envid_t sys_exofork(void);
 int sys_env_set_status(envid_t env, int status);
@@ -67,9 +69,20 @@ int sys_page_map(envid_t src_env, void *src_pg,
 int sys_page_unmap(envid_t env, void *pg);
 int sys_ipc_try_send(envid_t to_env, uint64_t value, void *pg, int perm);
 int sys_ipc_recv(void *rcv_pg);
+int sys_ipc_try_sendv(envid_t to_env, uint64_t value, void *const *pgs, size_t npages, int perm);
+int sys_ipc_recvv(void *rcv_pg, size_t maxpages);
+int sys_ipc_try_recvv(void *rcv_pg, size_t maxpages);
+int sys_env_sleep(void *dstva, size_t maxpages, unsigned flags, uint32_t timeout_ms);
+int sys_env_wake(envid_t envid, void *const *pgs, size_t npages, int perm);
+int sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms);
+int sys_futex_wake(volatile uint32_t *addr, size_t n);
 int sys_gettime(void);
 
 int vsys_gettime(void);
+int vsys_tsc_khz(void);
+int vsys_zero_pages(void);
+int vsys_zero_hits(void);
+int vsys_zero_misses(void);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t __attribute__((always_inline))
@@ -85,11 +98,18 @@ sys_exofork(void) {
 // ipc.c
 void ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int ipc_sendv(envid_t to_env, uint32_t value, void *const *pgs, size_t npages, int perm);
+int32_t ipc_recvv(envid_t *from_env_store, void *pg, size_t maxpages,
+                  int *perm_store, size_t *npages_store);
+int32_t ipc_try_recvv(envid_t *from_env_store, void *pg, size_t maxpages,
+                      int *perm_store, size_t *npages_store);
 envid_t ipc_find_env(enum EnvType type);
 
 // fork.c
 #define PTE_SHARE 0x400
+#define PTE_COW   0x800
 envid_t fork(void);
+bool cow_enable(void);
 envid_t sfork(void); // Challenge!
 
 // fd.c
@@ -97,17 +117,31 @@ int close(int fd);
 ssize_t read(int fd, void *buf, size_t nbytes);
 ssize_t write(int fd, const void *buf, size_t nbytes);
 int seek(int fd, off_t offset);
+int fsync(int fd);
 void close_all(void);
 ssize_t readn(int fd, void *buf, size_t nbytes);
 int dup(int oldfd, int newfd);
 int fstat(int fd, struct Stat *statbuf);
-int stat(const char *path, struct Stat *statbuf);
+int poll(struct pollfd *fds, size_t nfds, int timeout);
 
 // file.c
 int open(const char *path, int mode);
+int stat(const char *path, struct Stat *statbuf);
+ssize_t readfile(const char *path, void *buf, size_t n);
 int ftruncate(int fd, off_t size);
 int remove(const char *path);
 int sync(void);
+int fs_stats(struct FsStats *st);
+int mmap(void *addr, size_t len, int prot, int flags, int fdnum, off_t offset);
+int munmap(void *addr, size_t len);
+int readdir(int fd, struct Dirent *de);
+
+// coro.c
+struct Coro {
+  uintptr_t co_rsp; // stack pointer while switched out
+};
+void coro_init(struct Coro *co, void *stack, size_t size, void (*fn)(void *), void *arg);
+void coro_switch(struct Coro *from, struct Coro *to);
 
 // pageref.c
 int pageref(void *addr);
@@ -127,7 +161,16 @@ int pipe(int pipefds[2]);
 int pipeisclosed(int pipefd);
 
 // wait.c
-void wait(envid_t env);
+int wait(envid_t env);
+
+// malloc.c
+void *malloc(size_t size);
+void free(void *ptr);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
+
+// string.c
+void string_init(bool vector);
 
 /* File open modes */
 #define O_RDONLY  0x0000 /* open for reading only */
@@ -140,6 +183,15 @@ void wait(envid_t env);
 #define O_EXCL  0x0400 /* error if already exists */
 #define O_MKDIR 0x0800 /* create directory, not regular file */
 
+#define O_BUFFERED 0x1000 /* collect small writes before sending them */
+
+/* mmap protections and flags */
+#define PROT_READ  0x1 /* pages may be read */
+#define PROT_WRITE 0x2 /* pages may be written */
+
+#define MAP_SHARED  0x1 /* see the file, not a copy */
+#define MAP_PRIVATE 0x2 /* writes go to a private copy */
+
 #ifdef JOS_PROG
 extern void (*volatile sys_exit)(void);
 extern void (*volatile sys_yield)(void);
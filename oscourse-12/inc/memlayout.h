@@ -165,6 +165,10 @@
 // Max number of open files in the file system at once
 #define MAXOPEN 512
 #define FILEVA  0xD0000000
+// Where malloc carves its spans from (see lib/malloc.c); below the
+// user shadow limit so that UASAN covers it
+#define UHEAP     0x10000000
+#define UHEAPSIZE 0x8000000
 
 #ifdef SANITIZE_USER_SHADOW_OFF
 // User stack and some other tables are located at higher addresses, so we need to map a separate shadow for it.
@@ -21,6 +21,9 @@ void *memmove(void *dst, const void *src, size_t len);
 int memcmp(const void *s1, const void *s2, size_t len);
 void *memfind(const void *s, int c, size_t len);
 
+void clear_page(void *pg);
+void copy_page(void *dst, const void *src);
+
 long strtol(const char *s, char **endptr, int base);
 
 #endif /* not JOS_INC_STRING_H */
@@ -18,6 +18,14 @@ enum {
   SYS_ipc_try_send,
   SYS_ipc_recv,
   SYS_gettime,
+  SYS_ipc_try_sendv,
+  SYS_ipc_recvv,
+  SYS_ipc_try_recvv,
+  SYS_env_sleep,
+  SYS_env_wake,
+  SYS_futex_wait,
+  SYS_futex_wake,
+  SYS_env_wait,
   NSYSCALLS
 };
 
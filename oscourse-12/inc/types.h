@@ -7,7 +7,7 @@
 
 typedef uintptr_t physaddr_t;
 typedef ptrdiff_t ssize_t;
-typedef int32_t off_t;
+typedef int64_t off_t;
 
 // Efficient min and max operations
 #ifndef MIN
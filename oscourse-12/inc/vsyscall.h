@@ -4,6 +4,10 @@
 /* system call numbers */
 enum {
   VSYS_gettime,
+  VSYS_tsc_khz,
+  VSYS_zero_pages,  // pages in the kernel's pool of zeroed pages
+  VSYS_zero_hits,   // zeroed page allocations served from the pool
+  VSYS_zero_misses, // zeroed page allocations that had to clear a page
   NVSYSCALLS
 };
 
@@ -34,6 +34,9 @@ static __inline void write_rflags(uint64_t rflags) __attribute__((always_inline)
 static __inline uint64_t read_rbp(void) __attribute__((always_inline));
 static __inline uint64_t read_rsp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
+static __inline void cpuid_count(uint32_t info, uint32_t index, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
+static __inline void fxsave(void *area) __attribute__((always_inline));
+static __inline void fxrstor(const void *area) __attribute__((always_inline));
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
 
 static __inline void
@@ -283,6 +286,36 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
     *edxp = edx;
 }
 
+// cpuid for the leaves that take a subleaf index in %ecx
+static __inline void
+cpuid_count(uint32_t info, uint32_t index, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp) {
+  uint32_t eax, ebx, ecx, edx;
+  asm volatile("cpuid"
+               : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+               : "a"(info), "c"(index));
+  if (eaxp)
+    *eaxp = eax;
+  if (ebxp)
+    *ebxp = ebx;
+  if (ecxp)
+    *ecxp = ecx;
+  if (edxp)
+    *edxp = edx;
+}
+
+// Save and restore the x87 and SSE registers; area is 512 bytes,
+// 16-byte aligned.
+static __inline void
+fxsave(void *area) {
+  __asm __volatile("fxsave64 %0"
+                   : "=m"(*(uint8_t(*)[512])area));
+}
+
+static __inline void
+fxrstor(const void *area) {
+  __asm __volatile("fxrstor64 %0" ::"m"(*(const uint8_t(*)[512])area));
+}
+
 static __inline uint64_t
 read_tsc(void) {
   uint32_t lo, hi;
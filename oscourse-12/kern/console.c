@@ -542,6 +542,13 @@ cons_getc(void) {
   return 0;
 }
 
+// Is there input waiting for cons_getc?  Unlike cons_getc, this only
+// looks at what the interrupt handlers have put in the buffer.
+bool
+cons_ready(void) {
+  return cons.rpos != cons.wpos;
+}
+
 // output a character to the console
 static void
 cons_putc(int c) {
@@ -16,6 +16,7 @@
 void cons_init(void);
 void fb_init(void);
 int cons_getc(void);
+bool cons_ready(void);
 
 void kbd_intr(void);    // irq 1
 void serial_intr(void); // irq 4
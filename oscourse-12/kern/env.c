@@ -12,6 +12,9 @@
 #include <kern/trap.h>
 #include <kern/monitor.h>
 #include <kern/sched.h>
+#include <kern/futex.h>
+#include <kern/console.h>
+#include <kern/tsc.h>
 #include <kern/cpu.h>
 #include <kern/kdebug.h>
 #include <kern/macro.h>
@@ -27,6 +30,11 @@ struct Env *curenv = NULL; // The current env
 static struct Env *env_free_list; // Free environment list
                                   // (linked by Env->env_link)
 
+// Env whose x87 and SSE state is in the registers.  The kernel itself
+// never touches them, so they are only switched when a different env
+// runs, and stay put across its system calls and interrupts.
+static struct Env *env_fpu_owner;
+
 #define ENVGENSHIFT 12 // >= LOGNENV
 
 // Global descriptor table.
@@ -293,8 +301,22 @@ env_alloc(struct Env **newenv_store, envid_t parent_id) {
   // Clear the page fault handler until user installs one.
   e->env_pgfault_upcall = 0;
 
-  // Also clear the IPC receiving flag.
+  // Also clear the IPC receiving flags.
   e->env_ipc_recving = 0;
+  e->env_ipc_polling = 0;
+  e->env_sleeping    = 0;
+  e->env_wakeup      = 0;
+
+  // Until it exits with a status of its own, it is killed.
+  e->env_exit_status = -E_FAULT;
+  e->env_waiters     = NULL;
+  e->env_wait_target = NULL;
+
+  // Vector registers start in their reset state: all exceptions
+  // masked in the x87 control word (at offset 0) and in MXCSR (at 24).
+  memset(e->env_fxsave, 0, sizeof(e->env_fxsave));
+  *(uint16_t *)&e->env_fxsave[0]  = 0x037F;
+  *(uint32_t *)&e->env_fxsave[24] = 0x1F80;
 
   // commit the allocation
   env_free_list = e->env_link;
@@ -412,6 +434,27 @@ bind_functions(struct Env *e, uint8_t *binary) {
 }
 #endif
 
+// Fill a segment mapped at dst: filesz bytes from src, then zeroes up
+// to memsz.  The pages in between are copied and cleared whole.
+static void
+load_segment(uint8_t *dst, const uint8_t *src, size_t filesz, size_t memsz) {
+  uint8_t *fend = dst + filesz, *mend = dst + memsz;
+  size_t n;
+
+  n = MIN(ROUNDUP(dst, PGSIZE), fend) - dst;
+  memcpy(dst, src, n);
+  for (dst += n, src += n; dst + PGSIZE <= fend; dst += PGSIZE, src += PGSIZE)
+    copy_page(dst, src);
+  memcpy(dst, src, fend - dst);
+
+  dst = fend;
+  n   = MIN(ROUNDUP(dst, PGSIZE), mend) - dst;
+  memset(dst, 0, n);
+  for (dst += n; dst + PGSIZE <= mend; dst += PGSIZE)
+    clear_page(dst);
+  memset(dst, 0, mend - dst);
+}
+
 //
 // Set up the initial program binary, stack, and processor flags
 // for a user process.
@@ -486,8 +529,7 @@ load_icode(struct Env *e, uint8_t *binary) {
 
       region_alloc(e, (void *)dst, memsz);
 
-      memcpy(dst, src, filesz);
-      memset(dst + filesz, 0, memsz - filesz); // обнуление памяти по адресу dst + filesz, где количество нулей = memsz - filesz. Т.е. зануляем всю выделенную память сегмента кода, оставшуюяся после копирования src. Возможно, эта строка не нужна
+      load_segment(dst, src, filesz, memsz);
     }
   }
 
@@ -543,11 +585,111 @@ env_create(uint8_t *binary, enum EnvType type){
   load_icode(newenv, binary); // load instruction code
 }
 
+// Sleepers in sys_env_sleep with a deadline
+static size_t env_nsleep_timed;
+
+// Put curenv to sleep until sys_env_wake, or what flags ask for, wakes
+// it, or timeout_ms milliseconds pass unless that is 0.  The system
+// call returns 0 when woken and -E_TIMEOUT when the time is up.
+// Does not return.
+void
+env_sleep(unsigned flags, uint32_t timeout_ms) {
+  curenv->env_sleeping       = 1;
+  curenv->env_sleep_flags    = flags;
+  curenv->env_sleep_deadline = 0;
+  if (timeout_ms) {
+    curenv->env_sleep_deadline = read_tsc() + tsc_calibrate() / 1000 * timeout_ms;
+    env_nsleep_timed++;
+  }
+  curenv->env_status             = ENV_NOT_RUNNABLE;
+  curenv->env_tf.tf_regs.reg_rax = 0;
+  sched_yield();
+}
+
+// End e's sleep, returning r from sys_env_sleep.
+void
+env_sleep_end(struct Env *e, int r) {
+  if (e->env_sleep_deadline)
+    env_nsleep_timed--;
+  e->env_sleeping           = 0;
+  e->env_sleep_deadline     = 0;
+  e->env_tf.tf_regs.reg_rax = r;
+  e->env_status             = ENV_RUNNABLE;
+}
+
+// End the sleeps whose timeout has passed.  Called on clock interrupts.
+void
+env_sleep_expire(void) {
+  uint64_t now;
+  size_t i;
+
+  if (!env_nsleep_timed)
+    return;
+  now = read_tsc();
+  for (i = 0; i < NENV; i++)
+    if (envs[i].env_sleeping && envs[i].env_sleep_deadline &&
+        envs[i].env_sleep_deadline <= now)
+      env_sleep_end(&envs[i], -E_TIMEOUT);
+}
+
+// Wake the envs sleeping for console input, if there is some.  Called
+// on keyboard and serial interrupts.
+void
+env_sleep_wake_cons(void) {
+  size_t i;
+
+  if (!cons_ready())
+    return;
+  for (i = 0; i < NENV; i++)
+    if (envs[i].env_sleeping && (envs[i].env_sleep_flags & ENV_SLEEP_CONS))
+      env_sleep_end(&envs[i], 0);
+}
+
+// Block curenv until envid is freed, and have the system call return
+// the status it exited with.  An env that is already free still
+// reports its status, until its slot in envs[] is used again.
+// Does not return when it blocks; otherwise returns the status or
+//	-E_BAD_ENV if envid does not exist and its status is lost.
+//	-E_INVAL if envid is curenv.
+int
+env_wait(envid_t envid) {
+  struct Env *e = &envs[ENVX(envid)];
+
+  if (!envid || e->env_id != envid)
+    return -E_BAD_ENV;
+  if (e->env_status == ENV_FREE)
+    return e->env_exit_status;
+  if (e == curenv)
+    return -E_INVAL;
+
+  curenv->env_wait_target = e;
+  curenv->env_wait_next   = e->env_waiters;
+  e->env_waiters          = curenv;
+  curenv->env_status      = ENV_NOT_RUNNABLE;
+  sched_yield();
+}
+
+// Take e off the list of the env it waits for, if any.
+static void
+env_wait_cancel(struct Env *e) {
+  struct Env **pw;
+
+  if (!e->env_wait_target)
+    return;
+  for (pw = &e->env_wait_target->env_waiters; *pw != e; pw = &(*pw)->env_wait_next)
+    /* find e */;
+  *pw                = e->env_wait_next;
+  e->env_wait_target = NULL;
+  e->env_wait_next   = NULL;
+}
+
 //
 // Frees env e and all memory it uses.
 //
 void
 env_free(struct Env *e) {
+  struct Env *w;
+  size_t i;
 #ifndef CONFIG_KSPACE
   pdpe_t *pdpe;
   pde_t *pgdir;
@@ -563,6 +705,9 @@ env_free(struct Env *e) {
     lcr3(kern_cr3);
 #endif
 
+  if (e == env_fpu_owner)
+    env_fpu_owner = NULL;
+
   // Note the environment's demise.
   cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
@@ -615,6 +760,25 @@ env_free(struct Env *e) {
   e->env_cr3      = 0;
   page_decref(pa2page(pa));
 #endif
+  futex_cancel(e);
+  env_wait_cancel(e);
+
+  // Hand e's exit status to the envs waiting for it.
+  while ((w = e->env_waiters)) {
+    e->env_waiters            = w->env_wait_next;
+    w->env_wait_target        = NULL;
+    w->env_wait_next          = NULL;
+    w->env_tf.tf_regs.reg_rax = e->env_exit_status;
+    w->env_status             = ENV_RUNNABLE;
+  }
+
+  // Whoever sleeps waiting on this env (say, on a pipe it never got to
+  // close) would sleep forever; let every sleeper look again.
+  for (i = 0; i < NENV; i++) {
+    if (envs[i].env_sleeping)
+      env_sleep_end(&envs[i], 0);
+  }
+
   // return the environment to the free list
   e->env_status = ENV_FREE;
   e->env_link   = env_free_list;
@@ -767,6 +931,13 @@ env_run(struct Env *e) {
     }
   }
   
+  // A receive offer made by sys_ipc_try_recvv only lasts while the
+  // env is off the CPU.
+  if (e->env_ipc_polling) {
+    e->env_ipc_polling = 0;
+    e->env_ipc_recving = 0;
+  }
+
   curenv = e;  // текущая среда – е
   curenv->env_status = ENV_RUNNING; // устанавливаем статус среды на "выполняется"
   curenv->env_runs++; // обновляем количество запусков контекста процесса
@@ -775,6 +946,13 @@ env_run(struct Env *e) {
   lcr3(curenv->env_cr3); // load cr3
 // LAB 8 code end
 
+  if (env_fpu_owner != curenv) {
+    if (env_fpu_owner)
+      fxsave(env_fpu_owner->env_fxsave);
+    fxrstor(curenv->env_fxsave);
+    env_fpu_owner = curenv;
+  }
+
   env_pop_tf(&curenv->env_tf); // восстанавливаем из curen все переменные окружения
   
   while(1) {}
@@ -16,6 +16,11 @@ int env_alloc(struct Env **e, envid_t parent_id);
 void env_free(struct Env *e);
 void env_create(uint8_t *binary, enum EnvType type);
 void env_destroy(struct Env *e); // Does not return if e == curenv
+int env_wait(envid_t envid);     // Does not return if it blocks
+void env_sleep(unsigned flags, uint32_t timeout_ms) __attribute__((noreturn));
+void env_sleep_end(struct Env *e, int r);
+void env_sleep_expire(void);
+void env_sleep_wake_cons(void);
 
 int envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
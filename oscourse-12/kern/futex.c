@@ -0,0 +1,161 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/tsc.h>
+#include <kern/futex.h>
+
+// Futexes: envs sleep on a 32-bit word of their memory until another
+// env wakes that word.  A futex is named by the physical address of
+// its word, so every env that maps the page, at whatever address (a
+// PTE_SHARE page, or one still shared copy-on-write after fork), names
+// the same futex.  A page that is copied on write becomes a different
+// futex from then on.
+//
+// Waiters are kept in FUTEX_NBUCKETS queues hashed by key, oldest
+// first, so wakeups go out in the order the waits began.  A wait may
+// carry a timeout; the clock interrupt ends the ones that are due.
+
+#define FUTEX_NBUCKETS 64
+
+static struct Env *futex_queue[FUTEX_NBUCKETS]; // linked by env_futex_next
+static size_t futex_ntimed;                     // waiters with a deadline
+
+static struct Env **
+futex_bucket(physaddr_t key) {
+  return &futex_queue[(key >> 2) % FUTEX_NBUCKETS];
+}
+
+// Find the key of the word at addr in curenv.  Returns 0 on success,
+// -E_INVAL if addr is misaligned or not a user address, -E_FAULT if it
+// is not mapped.
+static int
+futex_key(volatile uint32_t *addr, physaddr_t *key) {
+  struct PageInfo *pp;
+  pte_t *pte;
+
+  if ((uintptr_t)addr % sizeof(*addr) || (uintptr_t)addr >= UTOP)
+    return -E_INVAL;
+  if (!(pp = page_lookup(curenv->env_pml4e, (void *)addr, &pte)) || !(*pte & PTE_U))
+    return -E_FAULT;
+  *key = page2pa(pp) + PGOFF(addr);
+  return 0;
+}
+
+// Take e off its queue.
+static void
+futex_unlink(struct Env *e) {
+  struct Env **pe = futex_bucket(e->env_futex_key);
+
+  while (*pe != e)
+    pe = &(*pe)->env_futex_next;
+  *pe = e->env_futex_next;
+
+  if (e->env_futex_deadline)
+    futex_ntimed--;
+  e->env_futex_waiting  = 0;
+  e->env_futex_next     = NULL;
+  e->env_futex_deadline = 0;
+}
+
+// End e's wait, returning r from it.
+static void
+futex_dequeue(struct Env *e, int r) {
+  futex_unlink(e);
+  e->env_tf.tf_regs.reg_rax = r;
+  e->env_status             = ENV_RUNNABLE;
+}
+
+// Block curenv until the word at addr is woken, if it still holds
+// expected.  With timeout_ms > 0 the wait ends after that many
+// milliseconds at the latest.  Does not return on success; the system
+// call returns 0 when woken or -E_TIMEOUT when the time is up.
+// Returns -E_AGAIN at once if the word does not hold expected, or the
+// errors of futex_key.
+int
+futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms) {
+  struct Env **pe;
+  physaddr_t key;
+  int r;
+
+  if ((r = futex_key(addr, &key)) < 0)
+    return r;
+  // Nothing runs between this look and the sleep: the kernel is not
+  // preemptible and has one CPU.
+  if (*addr != expected)
+    return -E_AGAIN;
+
+  curenv->env_futex_waiting  = 1;
+  curenv->env_futex_key      = key;
+  curenv->env_futex_next     = NULL;
+  curenv->env_futex_deadline = 0;
+  if (timeout_ms) {
+    curenv->env_futex_deadline = read_tsc() + tsc_calibrate() / 1000 * timeout_ms;
+    futex_ntimed++;
+  }
+  for (pe = futex_bucket(key); *pe; pe = &(*pe)->env_futex_next)
+    /* find the tail */;
+  *pe = curenv;
+
+  curenv->env_status             = ENV_NOT_RUNNABLE;
+  curenv->env_tf.tf_regs.reg_rax = 0;
+  sched_yield();
+}
+
+// Wake up to n envs waiting on the word at addr, oldest first.
+// Returns the number woken, or the errors of futex_key.
+int
+futex_wake(volatile uint32_t *addr, size_t n) {
+  struct Env *e, *next;
+  physaddr_t key;
+  int r, woken = 0;
+
+  if ((r = futex_key(addr, &key)) < 0)
+    return r;
+  for (e = *futex_bucket(key); e && woken < n; e = next) {
+    next = e->env_futex_next;
+    if (e->env_futex_key == key) {
+      futex_dequeue(e, 0);
+      woken++;
+    }
+  }
+  return woken;
+}
+
+// Forget e's wait, if any; e is going away.
+void
+futex_cancel(struct Env *e) {
+  if (e->env_futex_waiting)
+    futex_unlink(e);
+}
+
+// End the waits whose timeout has passed.  Called on clock interrupts.
+void
+futex_expire(void) {
+  struct Env *e, *next;
+  uint64_t now;
+  size_t i;
+
+  if (!futex_ntimed)
+    return;
+  now = read_tsc();
+  for (i = 0; i < FUTEX_NBUCKETS; i++) {
+    for (e = futex_queue[i]; e; e = next) {
+      next = e->env_futex_next;
+      if (e->env_futex_deadline && e->env_futex_deadline <= now)
+        futex_dequeue(e, -E_TIMEOUT);
+    }
+  }
+}
+
+// Is some env waiting with a timeout?  Then the CPU may only idle
+// until the clock ends it, never give up.
+bool
+futex_timers_pending(void) {
+  return futex_ntimed > 0;
+}
@@ -0,0 +1,17 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <kern/env.h>
+
+int futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms);
+int futex_wake(volatile uint32_t *addr, size_t n);
+void futex_cancel(struct Env *e);
+void futex_expire(void);
+bool futex_timers_pending(void);
+
+#endif // !JOS_KERN_FUTEX_H
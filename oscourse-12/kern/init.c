@@ -5,6 +5,7 @@
 #include <inc/assert.h>
 #include <inc/uefi.h>
 #include <inc/memlayout.h>
+#include <inc/vsyscall.h>
 
 #include <kern/monitor.h>
 #include <kern/tsc.h>
@@ -18,6 +19,7 @@
 #include <kern/picirq.h>
 #include <kern/kclock.h>
 #include <kern/kdebug.h>
+#include <kern/vsyscall.h>
 
 void
 timers_init(void) {
@@ -123,6 +125,8 @@ i386_init(void) {
 #ifndef CONFIG_KSPACE
   // Lab 6 memory management initialization functions
   mem_init();
+  // Let user programs turn TSC counts into time (see vsys_tsc_khz).
+  vsys[VSYS_tsc_khz] = tsc_calibrate() / 1000;
 #endif
 
   // Perform global constructor initialisation (e.g. asan)
@@ -0,0 +1,295 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/stdio.h>
+#include <inc/assert.h>
+#include <inc/string.h>
+
+#include <kern/pmap.h>
+#include <kern/kmalloc.h>
+
+// Kernel memory allocator.
+//
+// A struct KmemCache hands out objects of one size.  It takes one page
+// at a time from page_alloc for a slab, described by a struct Slab with
+// a bitmap of which objects are free.  For small objects the struct
+// Slab sits at the start of the page and the objects follow it.  From
+// SLAB_OFFPAGE bytes up that would cost a whole object per page (or
+// half the page for KMEM_MAXOBJ), so the struct Slab comes from a cache
+// of its own instead, the objects fill the page, and slab_hash finds
+// the struct Slab from the page.  Slabs with free objects are kept on
+// the cache's kc_partial list; a slab whose objects are all free goes
+// back to page_alloc, unless it is the last one the cache has.
+//
+// kmalloc and kfree sit on top, with one cache per power-of-two size
+// class up to KMEM_MAXOBJ.  Anything larger gets a page of its own, so
+// kmalloc cannot give more than PGSIZE bytes.  kfree tells such a page
+// from a slab by looking the page up in slab_hash, and by its pointer
+// being page-aligned, which objects of an in-page slab never are.
+//
+// The kernel is not preemptible and runs on one CPU, so nothing here
+// takes a lock.  With KASAN, objects are poisoned while they are free,
+// so that a use after free or a run past the end of an object is
+// reported.
+
+struct Slab {
+  struct KmemCache *sl_cache;
+  struct Slab *sl_next;  // next slab of the cache with free objects
+  struct Slab *sl_prev;  // previous slab of the cache with free objects
+  struct Slab *sl_hnext; // next off-page slab in the same slab_hash chain
+  char *sl_objs;         // first object
+  size_t sl_nfree;       // objects free
+  uint64_t sl_free[(PGSIZE / 16 + 63) / 64]; // bit set if object is free
+};
+
+// Objects start this far into a slab, keeping them 16-byte aligned
+#define SLABHDR ((sizeof(struct Slab) + 15) & ~(size_t)15)
+
+// Objects at least this large have their struct Slab off the page
+#define SLAB_OFFPAGE (PGSIZE / 8)
+
+static_assert(SLABHDR + SLAB_OFFPAGE <= PGSIZE, "SLAB_OFFPAGE does not fit in a slab");
+static_assert(KMEM_MAXOBJ <= PGSIZE, "KMEM_MAXOBJ does not fit in a page");
+
+// Off-page slabs by the address of their page
+#define SLAB_HASH_SIZE 64
+#define SLAB_HASH(va)  (((uintptr_t)(va) >> PGSHIFT) % SLAB_HASH_SIZE)
+
+static struct Slab *slab_hash[SLAB_HASH_SIZE];
+
+// Where off-page struct Slabs come from
+static struct KmemCache slab_cache;
+
+#ifdef SANITIZE_SHADOW_BASE
+void platform_asan_poison(void *addr, uint32_t size);
+void platform_asan_unpoison(void *addr, uint32_t size);
+#endif
+
+static struct KmemCache *kmem_caches; // all caches, for kmem_print_stats
+
+// Set up kc to hand out objects of size bytes.
+void
+kmem_cache_init(struct KmemCache *kc, const char *name, size_t size) {
+  assert(size > 0 && size <= KMEM_MAXOBJ);
+  kc->kc_name    = name;
+  kc->kc_size    = ROUNDUP(size, 16);
+  kc->kc_nobjs   = kc->kc_size >= SLAB_OFFPAGE ? PGSIZE / kc->kc_size :
+                                                 (PGSIZE - SLABHDR) / kc->kc_size;
+  kc->kc_partial = NULL;
+  kc->kc_nslabs  = 0;
+  kc->kc_nused   = 0;
+  kc->kc_next    = kmem_caches;
+  kmem_caches    = kc;
+}
+
+static void
+slab_link(struct Slab *sl) {
+  struct KmemCache *kc = sl->sl_cache;
+
+  sl->sl_prev = NULL;
+  sl->sl_next = kc->kc_partial;
+  if (sl->sl_next)
+    sl->sl_next->sl_prev = sl;
+  kc->kc_partial = sl;
+}
+
+static void
+slab_unlink(struct Slab *sl) {
+  if (sl->sl_prev)
+    sl->sl_prev->sl_next = sl->sl_next;
+  else
+    sl->sl_cache->kc_partial = sl->sl_next;
+  if (sl->sl_next)
+    sl->sl_next->sl_prev = sl->sl_prev;
+  sl->sl_next = sl->sl_prev = NULL;
+}
+
+// The off-page slab whose objects are on the page at va, or NULL
+static struct Slab *
+slab_lookup(void *va) {
+  struct Slab *sl;
+
+  for (sl = slab_hash[SLAB_HASH(va)]; sl; sl = sl->sl_hnext)
+    if (sl->sl_objs == va)
+      return sl;
+  return NULL;
+}
+
+// The slab that obj of kc is in
+static struct Slab *
+slab_of(struct KmemCache *kc, void *obj) {
+  void *va = ROUNDDOWN(obj, PGSIZE);
+
+  return kc->kc_size >= SLAB_OFFPAGE ? slab_lookup(va) : va;
+}
+
+// Take a page for a new slab of kc.  Returns NULL if there is none.
+static struct Slab *
+slab_new(struct KmemCache *kc) {
+  struct PageInfo *pp;
+  struct Slab *sl;
+  char *va;
+  size_t i;
+
+  if (kc->kc_size >= SLAB_OFFPAGE && !slab_cache.kc_size)
+    kmem_cache_init(&slab_cache, "kmem-slab", sizeof(struct Slab));
+
+  if (!(pp = page_alloc(0)))
+    return NULL;
+  pp->pp_ref++;
+  va = page2kva(pp);
+
+  if (kc->kc_size >= SLAB_OFFPAGE) {
+    if (!(sl = kmem_cache_alloc(&slab_cache))) {
+      page_decref(pp);
+      return NULL;
+    }
+    sl->sl_objs              = va;
+    sl->sl_hnext             = slab_hash[SLAB_HASH(va)];
+    slab_hash[SLAB_HASH(va)] = sl;
+  } else {
+    sl          = (struct Slab *)va;
+    sl->sl_objs = va + SLABHDR;
+  }
+
+  sl->sl_cache = kc;
+  sl->sl_nfree = kc->kc_nobjs;
+  memset(sl->sl_free, 0, sizeof(sl->sl_free));
+  for (i = 0; i < kc->kc_nobjs; i++)
+    sl->sl_free[i / 64] |= 1ULL << (i % 64);
+#ifdef SANITIZE_SHADOW_BASE
+  platform_asan_poison(sl->sl_objs, va + PGSIZE - sl->sl_objs);
+#endif
+  kc->kc_nslabs++;
+  slab_link(sl);
+  return sl;
+}
+
+// Allocate an object from kc.  Returns NULL if out of memory.
+void *
+kmem_cache_alloc(struct KmemCache *kc) {
+  struct Slab *sl;
+  size_t w, i;
+  void *obj;
+
+  if (!(sl = kc->kc_partial) && !(sl = slab_new(kc)))
+    return NULL;
+
+  for (w = 0; !sl->sl_free[w]; w++)
+    /* find a word with a free object */;
+  i = w * 64 + __builtin_ctzll(sl->sl_free[w]);
+  sl->sl_free[w] &= ~(1ULL << (i % 64));
+  if (!--sl->sl_nfree)
+    slab_unlink(sl);
+  kc->kc_nused++;
+
+  obj = sl->sl_objs + i * kc->kc_size;
+#ifdef SANITIZE_SHADOW_BASE
+  platform_asan_unpoison(obj, kc->kc_size);
+#endif
+  return obj;
+}
+
+// Return obj to kc, which it came from.
+void
+kmem_cache_free(struct KmemCache *kc, void *obj) {
+  struct Slab *sl = slab_of(kc, obj);
+  struct Slab **slp;
+  size_t off, i;
+  char *va;
+
+  if (!sl || sl->sl_cache != kc || (char *)obj < sl->sl_objs)
+    panic("kmem_cache_free: %p is not from cache %s", obj, kc->kc_name);
+  off = (char *)obj - sl->sl_objs;
+  i   = off / kc->kc_size;
+  if (off % kc->kc_size || i >= kc->kc_nobjs)
+    panic("kmem_cache_free: %p is not from cache %s", obj, kc->kc_name);
+  if (sl->sl_free[i / 64] & (1ULL << (i % 64)))
+    panic("kmem_cache_free: %p freed twice", obj);
+
+#ifdef SANITIZE_SHADOW_BASE
+  platform_asan_poison(obj, kc->kc_size);
+#endif
+  sl->sl_free[i / 64] |= 1ULL << (i % 64);
+  kc->kc_nused--;
+  if (sl->sl_nfree++ == 0)
+    slab_link(sl);
+
+  // Keep the last slab, so that one object going back and forth does
+  // not take and give back a page every time.
+  if (sl->sl_nfree == kc->kc_nobjs && (sl->sl_next || sl->sl_prev)) {
+    slab_unlink(sl);
+    kc->kc_nslabs--;
+    va = ROUNDDOWN(sl->sl_objs, PGSIZE);
+#ifdef SANITIZE_SHADOW_BASE
+    platform_asan_unpoison(va, PGSIZE);
+#endif
+    if (kc->kc_size >= SLAB_OFFPAGE) {
+      for (slp = &slab_hash[SLAB_HASH(va)]; *slp != sl; slp = &(*slp)->sl_hnext)
+        /* find sl in its chain */;
+      *slp = sl->sl_hnext;
+      kmem_cache_free(&slab_cache, sl);
+    }
+    page_decref(pa2page(PADDR(va)));
+  }
+}
+
+// Size classes of kmalloc: 16, 32, ..., KMEM_MAXOBJ bytes
+#define KMALLOC_NCLASSES 8
+
+static_assert(16 << (KMALLOC_NCLASSES - 1) == KMEM_MAXOBJ, "kmalloc classes do not reach KMEM_MAXOBJ");
+
+static struct KmemCache kmalloc_caches[KMALLOC_NCLASSES];
+static const char *const kmalloc_names[KMALLOC_NCLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"};
+
+// Allocate size bytes, 16-byte aligned; at most PGSIZE.  Returns NULL
+// if size is too large or memory is out.
+void *
+kmalloc(size_t size) {
+  struct PageInfo *pp;
+  int c;
+
+  if (size > PGSIZE)
+    return NULL;
+  if (size > KMEM_MAXOBJ) {
+    if (!(pp = page_alloc(0)))
+      return NULL;
+    pp->pp_ref++;
+    return page2kva(pp);
+  }
+
+  for (c = 0; (16 << c) < size; c++)
+    /* find the class */;
+  if (!kmalloc_caches[c].kc_size)
+    kmem_cache_init(&kmalloc_caches[c], kmalloc_names[c], 16 << c);
+  return kmem_cache_alloc(&kmalloc_caches[c]);
+}
+
+// Free what kmalloc returned.
+void
+kfree(void *ptr) {
+  struct Slab *sl;
+
+  if (!ptr)
+    return;
+  if ((sl = slab_lookup(ROUNDDOWN(ptr, PGSIZE)))) {
+    kmem_cache_free(sl->sl_cache, ptr);
+    return;
+  }
+  if (!PGOFF(ptr)) {
+    page_decref(pa2page(PADDR(ptr)));
+    return;
+  }
+  kmem_cache_free(((struct Slab *)ROUNDDOWN(ptr, PGSIZE))->sl_cache, ptr);
+}
+
+void
+kmem_print_stats(void) {
+  struct KmemCache *kc;
+
+  cprintf("%-16s %6s %8s %8s\n", "cache", "size", "objects", "slabs");
+  for (kc = kmem_caches; kc; kc = kc->kc_next)
+    cprintf("%-16s %6lu %8lu %8lu\n", kc->kc_name, (unsigned long)kc->kc_size,
+            (unsigned long)kc->kc_nused, (unsigned long)kc->kc_nslabs);
+}
@@ -0,0 +1,36 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KMALLOC_H
+#define JOS_KERN_KMALLOC_H
+#ifndef JOS_KERNEL
+#error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A cache of objects of one size, carved out of one-page slabs
+// (see kern/kmalloc.c).
+struct KmemCache {
+  const char *kc_name;
+  size_t kc_size;               // object size, a multiple of 16
+  size_t kc_nobjs;              // objects per slab
+  struct Slab *kc_partial;      // slabs with free objects
+  size_t kc_nslabs;             // slabs held
+  size_t kc_nused;              // objects handed out
+  struct KmemCache *kc_next;    // next cache in kmem_print_stats
+};
+
+// Largest object a cache or kmalloc can hand out from a slab;
+// kmalloc gives whole pages above it.
+#define KMEM_MAXOBJ 2048
+
+void kmem_cache_init(struct KmemCache *kc, const char *name, size_t size);
+void *kmem_cache_alloc(struct KmemCache *kc);
+void kmem_cache_free(struct KmemCache *kc, void *obj);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+void kmem_print_stats(void);
+
+#endif // !JOS_KERN_KMALLOC_H
@@ -16,6 +16,7 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
+#include <kern/kmalloc.h>
 
 #define CMDBUF_SIZE 80 // enough for one VGA text line
 
@@ -49,6 +50,9 @@ static struct Command commands[] = {
     {"memory", "Print list of all physical memory pages", mon_memory},
     // LAB 6 code end
 
+    {"kmstat", "Print kernel allocator caches", mon_kmstat},
+    {"kmbench", "Time kmalloc and kfree", mon_kmbench},
+
     {"backtrace", "Print stack backtrace", mon_backtrace}};
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
 
@@ -229,6 +233,45 @@ mon_memory(int argc, char **argv, struct Trapframe *tf) {
 }
 // LAB 6 code end
 
+int
+mon_kmstat(int argc, char **argv, struct Trapframe *tf) {
+  kmem_print_stats();
+  return 0;
+}
+
+#define KMBENCH_ROUNDS 100000
+#define KMBENCH_BATCH  1024
+
+// Time kmalloc and kfree for each size up to a page: freeing each
+// object at once, and freeing a batch after allocating all of it.
+int
+mon_kmbench(int argc, char **argv, struct Trapframe *tf) {
+  static void *batch[KMBENCH_BATCH];
+  uint64_t start, pair, alloc, freeing;
+  size_t size, i, n;
+
+  for (size = 16; size <= PGSIZE; size *= 2) {
+    start = read_tsc();
+    for (i = 0; i < KMBENCH_ROUNDS; i++)
+      kfree(kmalloc(size));
+    pair = (read_tsc() - start) / KMBENCH_ROUNDS;
+
+    start = read_tsc();
+    for (n = 0; n < KMBENCH_BATCH && (batch[n] = kmalloc(size)); n++)
+      /* allocate */;
+    alloc = read_tsc() - start;
+    start = read_tsc();
+    for (i = 0; i < n; i++)
+      kfree(batch[i]);
+    freeing = read_tsc() - start;
+
+    cprintf("%4lu B: %4lu cycles per kmalloc+kfree; batch of %lu: %4lu per kmalloc, %4lu per kfree\n",
+            (unsigned long)size, (unsigned long)pair, (unsigned long)n,
+            (unsigned long)(n ? alloc / n : 0), (unsigned long)(n ? freeing / n : 0));
+  }
+  return 0;
+}
+
 
 /***** Kernel monitor command interpreter *****/
 
@@ -30,4 +30,7 @@ int mon_memory(int argc, char **argv, struct Trapframe *tf);
 int mon_memory(int argc, char **argv, struct Trapframe *tf);
 // LAB 6 code end
 
+int mon_kmstat(int argc, char **argv, struct Trapframe *tf);
+int mon_kmbench(int argc, char **argv, struct Trapframe *tf);
+
 #endif // !JOS_KERN_MONITOR_H
@@ -32,6 +32,15 @@ physaddr_t kern_cr3;                               // Physical address of boot t
 struct PageInfo *pages;                            // Physical page state array
 static struct PageInfo *page_free_list     = NULL; // Free list of physical pages
 static struct PageInfo *page_free_list_top = NULL;
+
+// Free pages zeroed ahead of time by page_zero_idle, for
+// page_alloc(ALLOC_ZERO) to hand out without clearing them then.
+static struct PageInfo *page_zero_list     = NULL;
+static struct PageInfo *page_zero_list_top = NULL;
+static size_t page_zero_count              = 0;
+
+#define PAGE_ZERO_MAX   1024 // pages kept zeroed at most
+#define PAGE_ZERO_BATCH 16   // pages zeroed between looks for interrupts
 //Pointers to start and end of UEFI memory map
 EFI_MEMORY_DESCRIPTOR *mmap_base = NULL;
 EFI_MEMORY_DESCRIPTOR *mmap_end  = NULL;
@@ -252,7 +261,7 @@ mem_init(void) {
   // Make 'envs' point to an array of size 'NENV' of 'struct Env'.
   // LAB 8: Your code here.
   envs = (struct Env *) boot_alloc(sizeof(struct Env) * NENV);
-  memset(envs, 0, sizeof(struct Env) * npages);
+  memset(envs, 0, sizeof(struct Env) * NENV);
   //////////////////////////////////////////////////////////////////////
   // Make 'vsys' point to an array of size 'NVSYSCALLS' of int.
   // LAB 12: Your code here.
@@ -367,6 +376,9 @@ mem_init(void) {
     cr0 |= CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_MP;
     cr0 &= ~(CR0_TS | CR0_EM);
     lcr0(cr0);
+    // The kernel does not use SSE, but user environments may; their
+    // vector registers are switched in env_run.
+    lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
   }
 
   //////////////////////////////////////////////////////////////////////
@@ -514,18 +526,38 @@ page_init(void) {
 //
 // Returns NULL if out of free memory.
 //
+// A page already zeroed by page_zero_idle is used for ALLOC_ZERO when
+// there is one, and for any allocation once the other free pages are
+// gone.  vsys counts how many ALLOC_ZERO allocations found one.
+//
 // Hint: use page2kva and memset
 struct PageInfo *
 page_alloc(int alloc_flags) {
-  if (!page_free_list) {
+  struct PageInfo *return_page;
+  bool zeroed = 0;
+
+  if (page_zero_list && ((alloc_flags & ALLOC_ZERO) || !page_free_list)) {
+    return_page    = page_zero_list;
+    page_zero_list = return_page->pp_link;
+    if (!page_zero_list)
+      page_zero_list_top = NULL;
+    vsys[VSYS_zero_pages] = --page_zero_count;
+    zeroed                = 1;
+  } else if (page_free_list) {
+    return_page    = page_free_list;
+    page_free_list = return_page->pp_link;
+    if (!page_free_list)
+      page_free_list_top = NULL;
+  } else {
     return NULL;
   }
-  struct PageInfo *return_page = page_free_list;
-  page_free_list               = page_free_list->pp_link;
-  return_page->pp_link         = NULL;
+  return_page->pp_link = NULL;
 
-  if (!page_free_list) {
-    page_free_list_top = NULL;
+  if (alloc_flags & ALLOC_ZERO) {
+    if (zeroed)
+      vsys[VSYS_zero_hits]++;
+    else
+      vsys[VSYS_zero_misses]++;
   }
 
 #ifdef SANITIZE_SHADOW_BASE
@@ -537,16 +569,46 @@ page_alloc(int alloc_flags) {
   platform_asan_unpoison(page2kva(return_page), PGSIZE);
 #endif
 
-  if (alloc_flags & ALLOC_ZERO) {
-    memset(page2kva(return_page), 0, PGSIZE);
+  if ((alloc_flags & ALLOC_ZERO) && !zeroed) {
+    clear_page(page2kva(return_page));
   }
 
   return return_page;
 }
 
+// Move free pages to page_zero_list, zeroing them, until it holds
+// PAGE_ZERO_MAX.  sched_halt calls this on a fresh stack, with
+// interrupts disabled, when it has nothing to run.  Interrupts are let
+// in after each batch; one that comes then goes on to sched_yield and
+// never returns here, which leaves both lists in order.
+void
+page_zero_idle(void) {
+  struct PageInfo *pp;
+  int i;
+
+  while (page_zero_count < PAGE_ZERO_MAX && page_free_list) {
+    for (i = 0; i < PAGE_ZERO_BATCH && page_zero_count < PAGE_ZERO_MAX && page_free_list; i++) {
+      pp             = page_free_list;
+      page_free_list = pp->pp_link;
+      if (!page_free_list)
+        page_free_list_top = NULL;
+
+      clear_page(page2kva(pp));
+      pp->pp_link    = page_zero_list;
+      page_zero_list = pp;
+      if (!page_zero_list_top)
+        page_zero_list_top = pp;
+      page_zero_count++;
+    }
+    vsys[VSYS_zero_pages] = page_zero_count;
+    asm volatile("sti; nop; cli" ::
+                     : "memory");
+  }
+}
+
 int
 page_is_allocated(const struct PageInfo *pp) {
-  return !pp->pp_link && pp != page_free_list_top;
+  return !pp->pp_link && pp != page_free_list_top && pp != page_zero_list_top;
 }
 
 //
@@ -69,6 +69,7 @@ void page_remove(pml4e_t *pml4e, void *va);
 struct PageInfo *page_lookup(pml4e_t *pml4e, void *va, pte_t **pte_store);
 void page_decref(struct PageInfo *pp);
 int page_is_allocated(const struct PageInfo *pp);
+void page_zero_idle(void);
 
 void tlb_invalidate(pml4e_t *pml4e, void *va);
 
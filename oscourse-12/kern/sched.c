@@ -2,6 +2,8 @@
 #include <inc/x86.h>
 #include <kern/env.h>
 #include <kern/monitor.h>
+#include <kern/futex.h>
+#include <kern/pmap.h>
 
 struct Taskstate cpu_ts;
 void sched_halt(void);
@@ -53,13 +55,18 @@ sched_halt(void) {
 
   // For debugging and testing purposes, if there are no runnable
   // environments in the system, then drop into the kernel monitor.
+  // An env asleep until a timeout or console input is going to be
+  // woken by an interrupt, so idle for it instead.
   for (i = 0; i < NENV; i++) {
     if ((envs[i].env_status == ENV_RUNNABLE ||
          envs[i].env_status == ENV_RUNNING ||
          envs[i].env_status == ENV_DYING))
       break;
+    if (envs[i].env_sleeping &&
+        (envs[i].env_sleep_deadline || (envs[i].env_sleep_flags & ENV_SLEEP_CONS)))
+      break;
   }
-  if (i == NENV) {
+  if (i == NENV && !futex_timers_pending()) {
     cprintf("No runnable environments in the system!\n");
     while (1)
       monitor(NULL);
@@ -68,14 +75,16 @@ sched_halt(void) {
   // Mark that no environment is running on CPU
   curenv = NULL;
 
-  // Reset stack pointer, enable interrupts and then halt.
+  // Reset stack pointer, zero pages for page_alloc while there is
+  // nothing else to do, enable interrupts and then halt.
   asm volatile(
       "movq $0, %%rbp\n"
       "movq %0, %%rsp\n"
       "pushq $0\n"
       "pushq $0\n"
+      "call *%1\n"
       "sti\n"
       "hlt\n"
       :
-      : "a"(cpu_ts.ts_esp0));
+      : "a"(cpu_ts.ts_esp0), "c"(page_zero_idle));
 }
@@ -11,6 +11,7 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
+#include <kern/futex.h>
 
 #include <kern/kclock.h>
 
@@ -45,18 +46,20 @@ sys_getenvid(void) {
 }
 
 // Destroy a given environment (possibly the currently running environment).
+// 'status' is what sys_env_wait reports to those waiting for it.
 //
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
 static int
-sys_env_destroy(envid_t envid) {
+sys_env_destroy(envid_t envid, int status) {
   // LAB 8: Your code here.
   int r;
 	struct Env *e;
 
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
+	e->env_exit_status = status;
 	if (e == curenv)
 		cprintf("[%08x] exiting gracefully\n", curenv->env_id);
 	else
@@ -359,42 +362,252 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm) {
 		if (page_insert(e->env_pml4e, p, e->env_ipc_dstva, perm)) {
 			return -E_NO_MEM;
 		}
-    e->env_ipc_perm = perm;
+    e->env_ipc_perm   = perm;
+    e->env_ipc_npages = 1;
 	} else {
-		e->env_ipc_perm = 0;
+		e->env_ipc_perm   = 0;
+		e->env_ipc_npages = 0;
 	}
 	e->env_ipc_recving = 0;
 	e->env_ipc_from = curenv->env_id;
 	e->env_ipc_value = value;
 	e->env_status = ENV_RUNNABLE;
+	e->env_tf.tf_regs.reg_rax = 0;
 	return 0;
 }
 
+// Map the npages pages at srcvas[0], srcvas[1], ... of curenv into e
+// at consecutive addresses from dstva, all with permission perm.
+// Either all pages are mapped or none are.  Returns 0 on success,
+// -E_INVAL if perm or a source page is bad, -E_NO_MEM if out of memory.
+static int
+ipc_map_pages(struct Env *e, void *dstva, void *const *srcvas, size_t npages, unsigned perm) {
+  struct PageInfo *p;
+  pte_t *ptep;
+  size_t i;
+
+  if ((perm & ~(PTE_AVAIL | PTE_W)) != (PTE_U | PTE_P))
+    return -E_INVAL;
+  for (i = 0; i < npages; i++) {
+    if ((uintptr_t)srcvas[i] >= UTOP || PGOFF(srcvas[i]))
+      return -E_INVAL;
+    if (!(p = page_lookup(curenv->env_pml4e, srcvas[i], &ptep)))
+      return -E_INVAL;
+    if (!(*ptep & PTE_W) && (perm & PTE_W))
+      return -E_INVAL;
+  }
+  for (i = 0; i < npages; i++) {
+    p = page_lookup(curenv->env_pml4e, srcvas[i], NULL);
+    if (page_insert(e->env_pml4e, p, dstva + i * PGSIZE, perm)) {
+      while (i-- > 0)
+        page_remove(e->env_pml4e, dstva + i * PGSIZE);
+      return -E_NO_MEM;
+    }
+  }
+  return 0;
+}
+
+// Like sys_ipc_try_send, but send the npages pages at srcvas[0],
+// srcvas[1], ..., all with permission perm.  The receiver gets them at
+// consecutive addresses starting at its dstva; if it is not willing to
+// receive pages, only the value is delivered.  Either all pages are
+// transferred or none are.
+//
+// Errors are as for sys_ipc_try_send, plus:
+//	-E_INVAL if npages is larger than the receiver accepts
+//		or than IPC_MAXPAGES.
+static int
+sys_ipc_try_sendv(envid_t envid, uint32_t value, void *const *srcvas,
+                  size_t npages, unsigned perm) {
+  struct Env *e;
+  int r;
+
+  if (npages > IPC_MAXPAGES)
+    return -E_INVAL;
+  user_mem_assert(curenv, srcvas, npages * sizeof(*srcvas), PTE_U);
+
+  if (envid2env(envid, &e, 0) < 0)
+    return -E_BAD_ENV;
+  if (!e->env_ipc_recving)
+    return -E_IPC_NOT_RECV;
+  if ((uintptr_t)e->env_ipc_dstva >= UTOP)
+    npages = 0;
+  if (npages > e->env_ipc_maxpages)
+    return -E_INVAL;
+
+  if (npages && (r = ipc_map_pages(e, e->env_ipc_dstva, srcvas, npages, perm)) < 0)
+    return r;
+
+  e->env_ipc_perm    = npages ? perm : 0;
+  e->env_ipc_npages  = npages;
+  e->env_ipc_recving = 0;
+  e->env_ipc_from    = curenv->env_id;
+  e->env_ipc_value   = value;
+  e->env_status      = ENV_RUNNABLE;
+  e->env_tf.tf_regs.reg_rax = 0;
+  return 0;
+}
+
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
 //
-// If 'dstva' is < UTOP, then you are willing to receive a page of data.
-// 'dstva' is the virtual address at which the sent page should be mapped.
+// If 'dstva' is < UTOP, then you are willing to receive up to
+// 'maxpages' pages of data (at most IPC_MAXPAGES), mapped one after
+// another starting at 'dstva'.
 //
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned,
+//		maxpages is 0 or too large, or the pages would reach UTOP.
 static int
-sys_ipc_recv(void *dstva) {
-  // LAB 9: Your code here.
-  if ((uintptr_t)dstva < UTOP && PGOFF(dstva)) {
+sys_ipc_recvv(void *dstva, size_t maxpages) {
+  if ((uintptr_t)dstva < UTOP &&
+      (PGOFF(dstva) || maxpages == 0 || maxpages > IPC_MAXPAGES ||
+       maxpages > (UTOP - (uintptr_t)dstva) / PGSIZE))
     return -E_INVAL;
-  }
-	curenv->env_ipc_recving = 1;
-	curenv->env_ipc_dstva = dstva;
-	curenv->env_status = ENV_NOT_RUNNABLE;
+	curenv->env_ipc_recving  = 1;
+	curenv->env_ipc_dstva    = dstva;
+	curenv->env_ipc_maxpages = maxpages;
+	curenv->env_status       = ENV_NOT_RUNNABLE;
   curenv->env_tf.tf_regs.reg_rax = 0;
 	sched_yield();
 	return 0;
 }
 
+// Like sys_ipc_recvv, but without blocking: offer to receive, give up
+// the CPU once so that senders waiting in ipc_send get to run, and
+// withdraw the offer when this env runs again (see env_run).
+// Returns 0 if a message arrived in the meantime, -E_IPC_NOT_RECV if
+// not, or the errors of sys_ipc_recvv.
+static int
+sys_ipc_try_recvv(void *dstva, size_t maxpages) {
+  if ((uintptr_t)dstva < UTOP &&
+      (PGOFF(dstva) || maxpages == 0 || maxpages > IPC_MAXPAGES ||
+       maxpages > (UTOP - (uintptr_t)dstva) / PGSIZE))
+    return -E_INVAL;
+  curenv->env_ipc_recving  = 1;
+  curenv->env_ipc_polling  = 1;
+  curenv->env_ipc_dstva    = dstva;
+  curenv->env_ipc_maxpages = maxpages;
+  curenv->env_tf.tf_regs.reg_rax = -E_IPC_NOT_RECV;
+  sched_yield();
+  return 0;
+}
+
+// Block until another env calls sys_env_wake for us.  A wakeup sent
+// while we were not sleeping is kept, and makes the next sleep return
+// at once, so a waker cannot slip in between the caller's last look at
+// what it waits for and the sleep.  A sleep may also end early (see
+// env_free); callers check again what they were waiting for.
+//
+// If 'dstva' is < UTOP, the waker may hand us up to 'maxpages' pages,
+// mapped one after another starting at 'dstva'; env_sleep_npages tells
+// how many came.
+//
+// With ENV_SLEEP_CONS in 'flags', console input wakes us too, and the
+// sleep returns at once if some is already waiting.  With timeout_ms
+// other than 0 we give up after that many milliseconds.
+//
+// Returns 0 when woken, -E_TIMEOUT if the time ran out, or the errors
+// of sys_ipc_recvv.
+static int
+sys_env_sleep(void *dstva, size_t maxpages, unsigned flags, uint32_t timeout_ms) {
+  if ((uintptr_t)dstva < UTOP &&
+      (PGOFF(dstva) || maxpages == 0 || maxpages > IPC_MAXPAGES ||
+       maxpages > (UTOP - (uintptr_t)dstva) / PGSIZE))
+    return -E_INVAL;
+  if (flags & ~ENV_SLEEP_CONS)
+    return -E_INVAL;
+  curenv->env_sleep_npages = 0;
+  if (curenv->env_wakeup) {
+    curenv->env_wakeup = 0;
+    return 0;
+  }
+  if ((flags & ENV_SLEEP_CONS) && cons_ready())
+    return 0;
+  curenv->env_sleep_dstva    = dstva;
+  curenv->env_sleep_maxpages = maxpages;
+  env_sleep(flags, timeout_ms);
+}
+
+// Wake envid from sys_env_sleep, or have its next sleep return at once
+// if it is not sleeping.  Any env may wake any other.  With npages > 0
+// the pages at srcvas[0], ..., srcvas[npages - 1] go along, mapped with
+// permission perm, as in sys_ipc_try_sendv; that needs envid to be
+// asleep and willing to take them.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if envid does not exist.
+//	-E_IPC_NOT_RECV if pages are sent and envid is not asleep.
+//	the errors of sys_ipc_try_sendv about the pages.
+static int
+sys_env_wake(envid_t envid, void *const *srcvas, size_t npages, unsigned perm) {
+  struct Env *e;
+  int r;
+
+  if (npages > IPC_MAXPAGES)
+    return -E_INVAL;
+  user_mem_assert(curenv, srcvas, npages * sizeof(*srcvas), PTE_U);
+
+  if (envid2env(envid, &e, 0) < 0)
+    return -E_BAD_ENV;
+  if (npages) {
+    if (!e->env_sleeping || (uintptr_t)e->env_sleep_dstva >= UTOP)
+      return -E_IPC_NOT_RECV;
+    if (npages > e->env_sleep_maxpages)
+      return -E_INVAL;
+    if ((r = ipc_map_pages(e, e->env_sleep_dstva, srcvas, npages, perm)) < 0)
+      return r;
+    e->env_sleep_npages = npages;
+  }
+  if (e->env_sleeping) {
+    env_sleep_end(e, 0);
+  } else {
+    e->env_wakeup = 1;
+  }
+  return 0;
+}
+
+// Block until another env wakes the 32-bit word at addr, if it holds
+// expected; give up after timeout_ms milliseconds unless that is 0.
+// See kern/futex.c.
+// Returns 0 when woken, or < 0 on error.  Errors are:
+//	-E_AGAIN if *addr is not expected.
+//	-E_TIMEOUT if the time ran out.
+//	-E_INVAL if addr is misaligned or above UTOP.
+//	-E_FAULT if addr is not mapped.
+static int
+sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms) {
+  return futex_wait(addr, expected, timeout_ms);
+}
+
+// Wake up to n envs waiting on the word at addr, in the order they
+// began to wait.  Returns the number woken, or the errors of
+// sys_futex_wait about addr.
+static int
+sys_futex_wake(volatile uint32_t *addr, size_t n) {
+  return futex_wake(addr, n);
+}
+
+// Block until envid is gone, and return the status it exited with:
+// what it passed to sys_env_destroy, or -E_FAULT if the kernel killed
+// it.  Any env may wait for any other.  See env_wait.
+// Errors are:
+//	-E_BAD_ENV if envid does not exist and its status is lost.
+//	-E_INVAL if envid is the caller.
+static int
+sys_env_wait(envid_t envid) {
+  return env_wait(envid);
+}
+
+// Receive at most one page at dstva; see sys_ipc_recvv.
+static int
+sys_ipc_recv(void *dstva) {
+  // LAB 9: Your code here.
+  return sys_ipc_recvv(dstva, 1);
+}
+
 static int
 sys_env_set_trapframe(envid_t envid, struct Trapframe *tf) {
   struct Env *env;
@@ -437,7 +650,7 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
   } else if (syscallno == SYS_getenvid) {
     return sys_getenvid();
   } else if (syscallno == SYS_env_destroy) {
-    return sys_env_destroy((envid_t) a1);
+    return sys_env_destroy((envid_t) a1, (int) a2);
     // LAB 9 code
   } else if (syscallno == SYS_exofork) {
     return sys_exofork();
@@ -462,6 +675,22 @@ syscall(uintptr_t syscallno, uintptr_t a1, uintptr_t a2, uintptr_t a3, uintptr_t
     return sys_env_set_trapframe((envid_t)a1, (struct Trapframe *) a2);
   } else if (syscallno == SYS_gettime) {
       return sys_gettime();
+  } else if (syscallno == SYS_ipc_try_sendv) {
+    return sys_ipc_try_sendv((envid_t)a1, (uint32_t)a2, (void *const *)a3, (size_t)a4, (unsigned int)a5);
+  } else if (syscallno == SYS_ipc_recvv) {
+    return sys_ipc_recvv((void *)a1, (size_t)a2);
+  } else if (syscallno == SYS_ipc_try_recvv) {
+    return sys_ipc_try_recvv((void *)a1, (size_t)a2);
+  } else if (syscallno == SYS_env_sleep) {
+    return sys_env_sleep((void *)a1, (size_t)a2, (unsigned)a3, (uint32_t)a4);
+  } else if (syscallno == SYS_env_wake) {
+    return sys_env_wake((envid_t)a1, (void *const *)a2, (size_t)a3, (unsigned int)a4);
+  } else if (syscallno == SYS_futex_wait) {
+    return sys_futex_wait((volatile uint32_t *)a1, (uint32_t)a2, (uint32_t)a3);
+  } else if (syscallno == SYS_futex_wake) {
+    return sys_futex_wake((volatile uint32_t *)a1, (size_t)a2);
+  } else if (syscallno == SYS_env_wait) {
+    return sys_env_wait((envid_t)a1);
   } else {
     return -E_INVAL;
   }
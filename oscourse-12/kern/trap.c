@@ -15,6 +15,7 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/timer.h>
+#include <kern/futex.h>
 #include <kern/vsyscall.h>
 
 extern uintptr_t gdtdesc_64;
@@ -246,6 +247,8 @@ trap_dispatch(struct Trapframe *tf) {
 
 
     timer_for_schedule->handle_interrupts();
+    futex_expire();
+    env_sleep_expire();
 
     sched_yield();
     return;
@@ -255,12 +258,14 @@ trap_dispatch(struct Trapframe *tf) {
   // LAB 11: Your code here.
   if (tf->tf_trapno == IRQ_OFFSET + IRQ_KBD) {
     kbd_intr();
+    env_sleep_wake_cons();
     pic_send_eoi(IRQ_KBD);
     sched_yield();
     return;
   }
   if (tf->tf_trapno == IRQ_OFFSET + IRQ_SERIAL) {
     serial_intr();
+    env_sleep_wake_cons();
     pic_send_eoi(IRQ_SERIAL);
     sched_yield();
     return;
@@ -299,6 +304,13 @@ trap(struct Trapframe *tf) {
 
   // cprintf("%ld", tf->tf_trapno);
 
+  // An interrupt that ends the idle hlt of sched_halt has no env to
+  // return to; handle it and pick one.
+  if (!curenv) {
+    trap_dispatch(tf);
+    sched_yield();
+  }
+
   assert(curenv);
 
   // Garbage collect if current enviroment is a zombie
@@ -35,6 +35,7 @@ static ssize_t devcons_read(struct Fd *, void *, size_t);
 static ssize_t devcons_write(struct Fd *, const void *, size_t);
 static int devcons_close(struct Fd *);
 static int devcons_stat(struct Fd *, struct Stat *);
+static int devcons_poll(struct Fd *, int, unsigned *);
 
 struct Dev devcons =
     {
@@ -43,7 +44,8 @@ struct Dev devcons =
         .dev_read  = devcons_read,
         .dev_write = devcons_write,
         .dev_close = devcons_close,
-        .dev_stat  = devcons_stat};
+        .dev_stat  = devcons_stat,
+        .dev_poll  = devcons_poll};
 
 int
 iscons(int fdnum) {
@@ -76,8 +78,11 @@ devcons_read(struct Fd *fd, void *vbuf, size_t n) {
   if (n == 0)
     return 0;
 
-  while ((c = sys_cgetc()) == 0)
-    sys_yield();
+  // Take what devcons_poll looked at first.
+  if ((c = fd->fd_cons.pending))
+    fd->fd_cons.pending = 0;
+  while (!c && (c = sys_cgetc()) == 0)
+    sys_env_sleep((void *)UTOP, 0, ENV_SLEEP_CONS, 0);
   if (c < 0)
     return c;
   if (c == 0x04) // ctl-d is eof
@@ -115,3 +120,18 @@ devcons_stat(struct Fd *fd, struct Stat *stat) {
   strcpy(stat->st_name, "<cons>");
   return 0;
 }
+
+// See poll.  The kernel cannot tell whether input is waiting without
+// taking it, so a character we take is kept for devcons_read.
+static int
+devcons_poll(struct Fd *fd, int events, unsigned *sleep) {
+  int c, ready = events & POLLOUT;
+
+  if ((events & POLLIN) && !fd->fd_cons.pending && (c = sys_cgetc()) > 0)
+    fd->fd_cons.pending = c;
+  if ((events & POLLIN) && fd->fd_cons.pending)
+    ready |= POLLIN;
+  if (!ready && sleep)
+    *sleep |= ENV_SLEEP_CONS;
+  return ready;
+}
@@ -0,0 +1,26 @@
+// Coroutines: contexts with their own stacks that hand the CPU to each
+// other explicitly with coro_switch.  They are the whole scheduling
+// story; a program using them decides itself which one runs next.
+
+#include <inc/lib.h>
+
+void coro_start(void);
+
+// Set up co to run fn(arg) on the stack [stack, stack + size) the
+// first time it is switched to.  fn must never return.
+void
+coro_init(struct Coro *co, void *stack, size_t size, void (*fn)(void *), void *arg) {
+  uintptr_t *sp = (uintptr_t *)ROUNDDOWN((uintptr_t)stack + size, 16);
+
+  // What coro_switch pops: %r15, %r14, %r13, %r12, %rbx, %rbp and the
+  // return address.  coro_start then runs with the stack 16-byte
+  // aligned, as a call instruction expects.
+  *--sp = (uintptr_t)coro_start;
+  *--sp = 0;              // %rbp
+  *--sp = 0;              // %rbx
+  *--sp = (uintptr_t)fn;  // %r12
+  *--sp = (uintptr_t)arg; // %r13
+  *--sp = 0;              // %r14
+  *--sp = 0;              // %r15
+  co->co_rsp = (uintptr_t)sp;
+}
@@ -3,6 +3,12 @@
 
 void
 exit(void) {
+  exitstatus(0);
+}
+
+// Exit, reporting status to whoever waits for us (see wait).
+void
+exitstatus(int status) {
   close_all();
-  sys_env_destroy(0);
+  sys_env_destroy(0, status);
 }
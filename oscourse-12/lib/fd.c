@@ -1,17 +1,18 @@
 #include <inc/lib.h>
+#include <inc/x86.h>
 
 // Maximum number of file descriptors a program may hold open concurrently
-#define MAXFD 32
+#define MAXFD 256
 // Bottom of file descriptor area
 #define FDTABLE 0xD0000000ll
-// Bottom of file data area.  We reserve one data page for each FD,
-// which devices can use if they choose.
+// Bottom of file data area.  We reserve FDDATASIZE bytes for each FD,
+// which devices can map pages into if they choose.
 #define FILEDATA (FDTABLE + MAXFD * PGSIZE)
 
 // Return the 'struct Fd*' for file descriptor index i
 #define INDEX2FD(i) ((struct Fd *)(FDTABLE + (i)*PGSIZE))
-// Return the file data page for file descriptor index i
-#define INDEX2DATA(i) ((char *)(FILEDATA + (i)*PGSIZE))
+// Return the file data area for file descriptor index i
+#define INDEX2DATA(i) ((char *)(FILEDATA + (i)*FDDATASIZE))
 
 // --------------------------------------------------------------
 // File descriptor manipulators
@@ -164,6 +165,7 @@ dup(int oldfdnum, int newfdnum) {
   int r;
   char *ova, *nva;
   struct Fd *oldfd, *newfd;
+  size_t i;
 
   if ((r = fd_lookup(oldfdnum, &oldfd)) < 0)
     return r;
@@ -173,10 +175,11 @@ dup(int oldfdnum, int newfdnum) {
   ova   = fd2data(oldfd);
   nva   = fd2data(newfd);
 
-  if ((uvpml4e[VPML4E(ova)] & PTE_P) && (uvpde[VPDPE(ova)] & PTE_P) &&
-      (uvpd[VPD(ova)] & PTE_P) && (uvpt[PGNUM(ova)] & PTE_P))
-    if ((r = sys_page_map(0, ova, 0, nva, uvpt[PGNUM(ova)] & PTE_SYSCALL)) < 0)
-      goto err;
+  for (i = 0; i < FDDATASIZE; i += PGSIZE)
+    if ((uvpml4e[VPML4E(ova + i)] & PTE_P) && (uvpde[VPDPE(ova + i)] & PTE_P) &&
+        (uvpd[VPD(ova + i)] & PTE_P) && (uvpt[PGNUM(ova + i)] & PTE_P))
+      if ((r = sys_page_map(0, ova + i, 0, nva + i, uvpt[PGNUM(ova + i)] & PTE_SYSCALL)) < 0)
+        goto err;
   if ((r = sys_page_map(0, oldfd, 0, newfd, uvpt[PGNUM(oldfd)] & PTE_SYSCALL)) < 0)
     goto err;
 
@@ -184,7 +187,8 @@ dup(int oldfdnum, int newfdnum) {
 
 err:
   sys_page_unmap(0, newfd);
-  sys_page_unmap(0, nva);
+  for (i = 0; i < FDDATASIZE; i += PGSIZE)
+    sys_page_unmap(0, nva + i);
   return r;
 }
 
@@ -242,14 +246,31 @@ write(int fdnum, const void *buf, size_t n) {
 int
 seek(int fdnum, off_t offset) {
   int r;
+  struct Dev *dev;
   struct Fd *fd;
 
-  if ((r = fd_lookup(fdnum, &fd)) < 0)
+  if ((r = fd_lookup(fdnum, &fd)) < 0 || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
     return r;
+  if (dev->dev_seek)
+    return (*dev->dev_seek)(fd, offset);
   fd->fd_offset = offset;
   return 0;
 }
 
+// Write out anything fdnum has buffered and make it durable.
+int
+fsync(int fdnum) {
+  int r;
+  struct Dev *dev;
+  struct Fd *fd;
+
+  if ((r = fd_lookup(fdnum, &fd)) < 0 || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
+    return r;
+  if (!dev->dev_fsync)
+    return 0;
+  return (*dev->dev_fsync)(fd);
+}
+
 int
 ftruncate(int fdnum, off_t newsize) {
   int r;
@@ -277,20 +298,88 @@ fstat(int fdnum, struct Stat *stat) {
     return r;
   if (!dev->dev_stat)
     return -E_NOT_SUPP;
-  stat->st_name[0] = 0;
-  stat->st_size    = 0;
-  stat->st_isdir   = 0;
-  stat->st_dev     = dev;
+  stat->st_name[0]  = 0;
+  stat->st_size     = 0;
+  stat->st_isdir    = 0;
+  stat->st_nblocks  = 0;
+  stat->st_nextents = 0;
+  stat->st_dev      = dev;
   return (*dev->dev_stat)(fd, stat);
 }
 
-int
-stat(const char *path, struct Stat *stat) {
-  int fd, r;
+// Look at whether pfd is ready, setting pfd->revents; see poll.
+// Returns the events ready, or -E_AGAIN if nothing is and the device
+// cannot arrange to wake us.
+static int
+poll_fd(struct pollfd *pfd, unsigned *sleep) {
+  struct Dev *dev;
+  struct Fd *fd;
+  int r;
 
-  if ((fd = open(path, O_RDONLY)) < 0)
-    return fd;
-  r = fstat(fd, stat);
-  close(fd);
+  pfd->revents = 0;
+  if (pfd->fd < 0)
+    return 0;
+  if (fd_lookup(pfd->fd, &fd) < 0 || dev_lookup(fd->fd_dev_id, &dev) < 0)
+    return pfd->revents = POLLNVAL;
+  if (!dev->dev_poll)
+    return pfd->revents = pfd->events & (POLLIN | POLLOUT);
+  if ((r = (*dev->dev_poll)(fd, pfd->events & (POLLIN | POLLOUT), sleep)) > 0)
+    pfd->revents = r;
   return r;
 }
+
+// Wait until one of the nfds file descriptors at fds is ready for the
+// events it asks for, or for timeout milliseconds; a timeout of 0 only
+// looks, and a negative one waits for ever.  Sets the revents of each
+// and returns how many have some, 0 if the time ran out.
+//
+// A device's dev_poll(fd, events, sleep) returns which of events are
+// ready, with POLLHUP if the other end is gone.  With sleep not NULL
+// and nothing ready, it also arranges for us to be woken from
+// sys_env_sleep when that may change, adding to *sleep the sleep flags
+// that needs, or returns -E_AGAIN if it cannot (a pipe end another env
+// already sleeps on).  With sleep NULL it undoes the arrangement.
+// Devices without dev_poll never block.
+//
+// So when nothing is ready, poll has every device arrange a wakeup,
+// looks once more, and sleeps; if some device could not arrange one,
+// it yields and looks again instead.
+int
+poll(struct pollfd *fds, size_t nfds, int timeout) {
+  uint64_t deadline = 0, now;
+  uint32_t ms = 0;
+  unsigned sleep;
+  bool busy;
+  size_t i;
+  int n, r;
+
+  if (timeout > 0)
+    deadline = read_tsc() + (uint64_t)vsys_tsc_khz() * timeout;
+
+  for (;;) {
+    // This also undoes what the last pass arranged.
+    for (n = 0, i = 0; i < nfds; i++)
+      n += poll_fd(&fds[i], NULL) > 0;
+    if (n || !timeout)
+      return n;
+    if (deadline) {
+      if ((now = read_tsc()) >= deadline)
+        return 0;
+      ms = ROUNDUP(deadline - now, vsys_tsc_khz()) / vsys_tsc_khz();
+    }
+
+    sleep = 0;
+    busy  = 0;
+    for (i = 0; i < nfds && !n; i++) {
+      if ((r = poll_fd(&fds[i], &sleep)) == -E_AGAIN)
+        busy = 1;
+      n += r > 0;
+    }
+    if (n)
+      continue;
+    if (busy)
+      sys_yield();
+    else
+      sys_env_sleep((void *)UTOP, 0, sleep, ms);
+  }
+}
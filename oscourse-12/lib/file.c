@@ -1,6 +1,7 @@
 #include <inc/fs.h>
 #include <inc/string.h>
 #include <inc/lib.h>
+#include <inc/x86.h>
 
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 
@@ -25,11 +26,66 @@ fsipc(unsigned type, void *dstva) {
   return ipc_recv(NULL, dstva, NULL);
 }
 
+// Send request 'type' in fsipcbuf followed by the pages holding the
+// n bytes at buf (at most FSVEC_MAXPAGES of them), which the server
+// reads or writes in place.  The caller must have clipped n with
+// FSVEC_CLIP.  Returns the server's result, or -E_INVAL without sending
+// anything if the pages cannot be lent to the server as they are.
+static int
+fsipc_lend(unsigned type, const void *buf, size_t n, bool towrite) {
+  static envid_t fsenv;
+  void *pgs[1 + FSVEC_MAXPAGES];
+  uintptr_t va = ROUNDDOWN((uintptr_t)buf, PGSIZE);
+  size_t i, npages;
+  int perm = PTE_P | PTE_U | (towrite ? PTE_W : 0);
+  int r;
+
+  if (fsenv == 0)
+    fsenv = ipc_find_env(ENV_TYPE_FS);
+
+  npages = ROUNDUP(PGOFF(buf) + n, PGSIZE) / PGSIZE;
+  assert(npages <= FSVEC_MAXPAGES);
+  pgs[0] = &fsipcbuf;
+  for (i = 0; i < npages; i++, va += PGSIZE) {
+    if (va >= UTOP || !(uvpml4e[VPML4E(va)] & PTE_P) || !(uvpde[VPDPE(va)] & PTE_P) ||
+        !(uvpd[VPD(va)] & PTE_P) || !(uvpt[PGNUM(va)] & PTE_P))
+      return -E_INVAL;
+    // The server writes into pages we read into; they must be ours.
+    if (towrite && (uvpt[PGNUM(va)] & PTE_COW))
+      *(volatile char *)va = *(volatile char *)va;
+    if (towrite && !(uvpt[PGNUM(va)] & PTE_W))
+      return -E_INVAL;
+    pgs[1 + i] = (void *)va;
+  }
+
+  if ((r = ipc_sendv(fsenv, type, pgs, 1 + npages, perm)) < 0)
+    return r;
+  return ipc_recv(NULL, NULL, NULL);
+}
+
+// The part of n bytes at buf that one vectored request can carry.
+#define FSVEC_CLIP(buf, n) MIN((n), FSVEC_MAXPAGES * PGSIZE - PGOFF(buf))
+
+// Send a vectored read or write of the n bytes at buf on fd.  The
+// request is cut short at the page limit.  Returns as fsipc_lend.
+static int
+fsipcv(unsigned type, struct Fd *fd, const void *buf, size_t n, bool towrite) {
+  n = FSVEC_CLIP(buf, n);
+  fsipcbuf.vec.req_fileid = fd->fd_file.id;
+  fsipcbuf.vec.req_n      = n;
+  fsipcbuf.vec.req_pgoff  = PGOFF(buf);
+  return fsipc_lend(type, buf, n, towrite);
+}
+
 static int devfile_flush(struct Fd *fd);
+static int devfile_wbflush(struct Fd *fd);
 static ssize_t devfile_read(struct Fd *fd, void *buf, size_t n);
+static ssize_t devfile_recv(struct Fd *fd, void *buf, size_t n);
 static ssize_t devfile_write(struct Fd *fd, const void *buf, size_t n);
 static int devfile_stat(struct Fd *fd, struct Stat *stat);
 static int devfile_trunc(struct Fd *fd, off_t newsize);
+static int devfile_seek(struct Fd *fd, off_t offset);
+static int devfile_fsync(struct Fd *fd);
 
 struct Dev devfile =
     {
@@ -39,7 +95,67 @@ struct Dev devfile =
         .dev_close = devfile_flush,
         .dev_stat  = devfile_stat,
         .dev_write = devfile_write,
-        .dev_trunc = devfile_trunc};
+        .dev_trunc = devfile_trunc,
+        .dev_seek  = devfile_seek,
+        .dev_fsync = devfile_fsync};
+
+// Write-behind buffer of an O_BUFFERED fd, kept in the fd's data page.
+// Small writes are collected here while they are contiguous and sent
+// in one request once the buffer fills up, or before anything that
+// must see the file as written: reads, seeks, stat, truncate, fsync
+// and close.  The page is mapped PTE_SHARE, like the fd page itself,
+// so fds shared by dup, fork or spawn also share the pending data.
+// Envs sharing it take wb_lock for every operation on the fd (see
+// wb_lock()), so that one does not add to the buffer or move the seek
+// position while another is halfway through doing the same.
+struct WriteBehind {
+  off_t wb_offset;           // file offset of wb_buf[0]
+  size_t wb_len;             // bytes pending in wb_buf
+  volatile uint32_t wb_lock; // 0 free, 1 held, 2 held and waited for
+  char wb_buf[PGSIZE - sizeof(off_t) - sizeof(size_t) - sizeof(uint32_t)];
+};
+
+// Take the write-behind lock of fd, if it is O_BUFFERED.  The holder
+// may be preempted, so waiters sleep on the futex of the lock word
+// instead of spinning; it is 2 while anyone might be sleeping there.
+static void
+wb_lock(struct Fd *fd) {
+  struct WriteBehind *wb = (struct WriteBehind *)fd2data(fd);
+  uint32_t c;
+
+  if (!(fd->fd_omode & O_BUFFERED))
+    return;
+  if ((c = __sync_val_compare_and_swap(&wb->wb_lock, 0, 1)) == 0)
+    return;
+  if (c != 2)
+    c = xchg(&wb->wb_lock, 2);
+  while (c != 0) {
+    (void)sys_futex_wait(&wb->wb_lock, 2, 0);
+    c = xchg(&wb->wb_lock, 2);
+  }
+}
+
+static void
+wb_unlock(struct Fd *fd) {
+  struct WriteBehind *wb = (struct WriteBehind *)fd2data(fd);
+
+  if (!(fd->fd_omode & O_BUFFERED))
+    return;
+  if (xchg(&wb->wb_lock, 0) == 2)
+    (void)sys_futex_wake(&wb->wb_lock, 1);
+}
+
+// Directory entries fetched by readdir but not yet returned, kept in
+// the data page of a directory fd.  The fd's offset follows the
+// entries handed out, so it is always where a listing resumes; if
+// anything else moves it, the buffered entries are dropped.
+struct DirBuf {
+  off_t db_cookie; // where the server stopped listing
+  off_t db_offset; // fd offset matching db_pos
+  uint32_t db_len; // bytes of entries in db_buf
+  uint32_t db_pos; // next entry to return
+  char db_buf[FSDIRENT_BUFSIZE];
+};
 
 // Open a file (or directory).
 //
@@ -80,6 +196,15 @@ open(const char *path, int mode) {
     return r;
   }
 
+  // The server keeps only the access mode; the buffer is ours.
+  if (mode & O_BUFFERED) {
+    if ((r = sys_page_alloc(0, fd2data(fd), PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0) {
+      fd_close(fd, 0);
+      return r;
+    }
+    fd->fd_omode |= O_BUFFERED;
+  }
+
   return fd2num(fd);
 }
 
@@ -93,8 +218,33 @@ open(const char *path, int mode) {
 // to disk.
 static int
 devfile_flush(struct Fd *fd) {
+  int r;
+
+  wb_lock(fd);
+  r = devfile_wbflush(fd);
+  wb_unlock(fd);
+
+  // Drop the write-behind or readdir buffer, if any.
+  (void)sys_page_unmap(0, fd2data(fd));
   fsipcbuf.flush.req_fileid = fd->fd_file.id;
-  return fsipc(FSREQ_FLUSH, NULL);
+  return MIN(r, fsipc(FSREQ_FLUSH, NULL));
+}
+
+// Can the page at va be replaced by a page mapped from the file server?
+// It must be private memory we may write (or not mapped at all), and
+// writes to the mapped page must be handled as copy-on-write.
+static bool
+devfile_can_map(void *va) {
+  if ((uintptr_t)va >= UTOP)
+    return 0;
+  if ((uvpml4e[VPML4E(va)] & PTE_P) && (uvpde[VPDPE(va)] & PTE_P) &&
+      (uvpd[VPD(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P)) {
+    if (uvpt[PGNUM(va)] & PTE_SHARE)
+      return 0;
+    if (!(uvpt[PGNUM(va)] & (PTE_W | PTE_COW)))
+      return 0;
+  }
+  return cow_enable();
 }
 
 // Read at most 'n' bytes from 'fd' at the current position into 'buf'.
@@ -109,7 +259,42 @@ devfile_read(struct Fd *fd, void *buf, size_t n) {
   // bytes read will be written back to fsipcbuf by the file
   // system server.
   // LAB 10: Your code here
+  ssize_t r;
+
+  wb_lock(fd);
+  if ((r = devfile_wbflush(fd)) >= 0)
+    r = devfile_recv(fd, buf, n);
+  wb_unlock(fd);
+  return r;
+}
+
+// Receive at most n bytes into buf from fd's seek position (which the
+// server advances).
+//
+// Whole pages at page-aligned file positions that land on page-aligned
+// parts of buf are not copied: the file server maps its block cache
+// page there, copy-on-write.  Other reads of more than a page are done
+// with one vectored request per FSVEC_MAXPAGES pages of buf; only
+// small ones go through fsipcbuf.
+static ssize_t
+devfile_recv(struct Fd *fd, void *buf, size_t n) {
   int r;
+  size_t mapped = 0;
+
+  while (n - mapped >= PGSIZE && (uintptr_t)(buf + mapped) % PGSIZE == 0 &&
+         fd->fd_offset % PGSIZE == 0 && devfile_can_map(buf + mapped)) {
+    fsipcbuf.read_map.req_fileid = fd->fd_file.id;
+    if ((r = fsipc(FSREQ_READ_MAP, buf + mapped)) < 0)
+      break;
+    mapped += r;
+  }
+  if (mapped)
+    return mapped;
+
+  // Reads of more than a page go straight into buf's pages.
+  if (n > PGSIZE && (r = fsipcv(FSREQ_READV, fd, buf, n, 1)) != -E_INVAL)
+    return r;
+
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
 	fsipcbuf.read.req_n = n;
 	if ((r = fsipc(FSREQ_READ, NULL)) < 0) {
@@ -121,24 +306,26 @@ devfile_read(struct Fd *fd, void *buf, size_t n) {
 	return r;
 }
 
-// Write at most 'n' bytes from 'buf' to 'fd' at the current seek position.
-//
-// Returns:
-//	 The number of bytes successfully written.
-//	 < 0 on error.
+// Send n bytes from buf to the server, to be written at fd's seek
+// position (which the server advances).
 static ssize_t
-devfile_write(struct Fd *fd, const void *buf, size_t n) {
-  // Make an FSREQ_WRITE request to the file system server.  Be
-  // careful: fsipcbuf.write.req_buf is only so large, but
-  // remember that write is always allowed to write *fewer*
-  // bytes than requested.
-  // LAB 10: Your code here
-  if (!fd || !buf)
-    return E_INVAL;
-
+devfile_send(struct Fd *fd, const void *buf, size_t n) {
   size_t res0 = 0;
 
   while (n) {
+    // Large writes lend buf's pages to the server instead of copying.
+    if (n > sizeof(fsipcbuf.write.req_buf)) {
+      int res = fsipcv(FSREQ_WRITEV, fd, buf, n, 0);
+      if (res < 0 && res != -E_INVAL)
+        return res;
+      if (res >= 0) {
+        buf += res;
+        n -= res;
+        res0 += res;
+        continue;
+      }
+    }
+
     size_t blk = MIN(n, sizeof(fsipcbuf.write.req_buf));
 
     memcpy(fsipcbuf.write.req_buf, buf, blk);
@@ -157,25 +344,323 @@ devfile_write(struct Fd *fd, const void *buf, size_t n) {
   return res0;
 }
 
+// Write out the fd's pending buffered data, if any.  The caller holds
+// the write-behind lock, so no other env sees the seek position while
+// it is moved back to the buffered bytes.
+static int
+devfile_wbflush(struct Fd *fd) {
+  struct WriteBehind *wb = (struct WriteBehind *)fd2data(fd);
+  off_t pos;
+  size_t len;
+  ssize_t r;
+
+  if (!(fd->fd_omode & O_BUFFERED) || !wb->wb_len)
+    return 0;
+  // The buffered bytes go to wb_offset; the fd's own offset is already
+  // past them and must end up there again.
+  pos           = fd->fd_offset;
+  len           = wb->wb_len;
+  wb->wb_len    = 0;
+  fd->fd_offset = wb->wb_offset;
+  r             = devfile_send(fd, wb->wb_buf, len);
+  fd->fd_offset = pos;
+  if (r < 0)
+    return r;
+  return r == len ? 0 : -E_NO_DISK;
+}
+
+// Write at most 'n' bytes from 'buf' to 'fd' at the current seek position.
+//
+// Returns:
+//	 The number of bytes successfully written.
+//	 < 0 on error.
+static ssize_t
+devfile_write(struct Fd *fd, const void *buf, size_t n) {
+  // Make an FSREQ_WRITE request to the file system server.  Be
+  // careful: fsipcbuf.write.req_buf is only so large, but
+  // remember that write is always allowed to write *fewer*
+  // bytes than requested.
+  // LAB 10: Your code here
+  struct WriteBehind *wb;
+  ssize_t r;
+
+  if (!fd || !buf)
+    return E_INVAL;
+
+  if (!(fd->fd_omode & O_BUFFERED))
+    return devfile_send(fd, buf, n);
+  wb = (struct WriteBehind *)fd2data(fd);
+  wb_lock(fd);
+  // Writes that would fill the buffer on their own skip it.
+  if (n >= sizeof(wb->wb_buf)) {
+    if ((r = devfile_wbflush(fd)) >= 0)
+      r = devfile_send(fd, buf, n);
+    goto out;
+  }
+
+  if (wb->wb_len && (wb->wb_offset + wb->wb_len != fd->fd_offset ||
+                     wb->wb_len + n > sizeof(wb->wb_buf)))
+    if ((r = devfile_wbflush(fd)) < 0)
+      goto out;
+  if (!wb->wb_len)
+    wb->wb_offset = fd->fd_offset;
+  memcpy(wb->wb_buf + wb->wb_len, buf, n);
+  wb->wb_len += n;
+  fd->fd_offset += n;
+  r = n;
+  if (wb->wb_len == sizeof(wb->wb_buf) && (r = devfile_wbflush(fd)) >= 0)
+    r = n;
+out:
+  wb_unlock(fd);
+  return r;
+}
+
+// Copy the server's Fsret_stat reply into st.
+static void
+devfile_fill_stat(struct Stat *st) {
+  strcpy(st->st_name, fsipcbuf.statRet.ret_name);
+  st->st_size     = fsipcbuf.statRet.ret_size;
+  st->st_isdir    = fsipcbuf.statRet.ret_isdir;
+  st->st_nblocks  = fsipcbuf.statRet.ret_nblocks;
+  st->st_nextents = fsipcbuf.statRet.ret_nextents;
+}
+
 static int
 devfile_stat(struct Fd *fd, struct Stat *st) {
   int r;
 
-  fsipcbuf.stat.req_fileid = fd->fd_file.id;
-  if ((r = fsipc(FSREQ_STAT, NULL)) < 0)
+  wb_lock(fd);
+  if ((r = devfile_wbflush(fd)) >= 0) {
+    fsipcbuf.stat.req_fileid = fd->fd_file.id;
+    r                        = fsipc(FSREQ_STAT, NULL);
+  }
+  wb_unlock(fd);
+  if (r < 0)
     return r;
-  strcpy(st->st_name, fsipcbuf.statRet.ret_name);
-  st->st_size  = fsipcbuf.statRet.ret_size;
-  st->st_isdir = fsipcbuf.statRet.ret_isdir;
+  devfile_fill_stat(st);
   return 0;
 }
 
 // Truncate or extend an open file to 'size' bytes
 static int
 devfile_trunc(struct Fd *fd, off_t newsize) {
-  fsipcbuf.set_size.req_fileid = fd->fd_file.id;
-  fsipcbuf.set_size.req_size   = newsize;
-  return fsipc(FSREQ_SET_SIZE, NULL);
+  int r;
+
+  wb_lock(fd);
+  if ((r = devfile_wbflush(fd)) >= 0) {
+    fsipcbuf.set_size.req_fileid = fd->fd_file.id;
+    fsipcbuf.set_size.req_size   = newsize;
+    r                            = fsipc(FSREQ_SET_SIZE, NULL);
+  }
+  wb_unlock(fd);
+  return r;
+}
+
+static int
+devfile_seek(struct Fd *fd, off_t offset) {
+  int r;
+
+  wb_lock(fd);
+  if ((r = devfile_wbflush(fd)) >= 0)
+    fd->fd_offset = offset;
+  wb_unlock(fd);
+  return r < 0 ? r : 0;
+}
+
+// Write out buffered data and have the server flush the file to disk.
+static int
+devfile_fsync(struct Fd *fd) {
+  int r;
+
+  wb_lock(fd);
+  if ((r = devfile_wbflush(fd)) >= 0) {
+    fsipcbuf.flush.req_fileid = fd->fd_file.id;
+    r                         = fsipc(FSREQ_FLUSH, NULL);
+  }
+  wb_unlock(fd);
+  return r;
+}
+
+// Stat the file at path in a single request, without opening it.
+int
+stat(const char *path, struct Stat *st) {
+  int r;
+
+  if (strlen(path) >= MAXPATHLEN)
+    return -E_BAD_PATH;
+  strcpy(fsipcbuf.stat_path.req_path, path);
+  if ((r = fsipc(FSREQ_STAT_PATH, NULL)) < 0)
+    return r;
+  devfile_fill_stat(st);
+  st->st_dev = &devfile;
+  return 0;
+}
+
+// Read up to n bytes from the start of the file at path into buf.
+// Files that fit in the reply page, or in the pages of buf lent to the
+// server, take a single request and are never opened; the rest of a
+// bigger file is read through an fd.
+// Returns the number of bytes read, less than n only if the file is
+// shorter, or < 0 on error.
+ssize_t
+readfile(const char *path, void *buf, size_t n) {
+  off_t size;
+  size_t got;
+  int r, fdnum;
+
+  if (strlen(path) >= MAXPATHLEN)
+    return -E_BAD_PATH;
+  r = -E_INVAL;
+  if (n > sizeof(fsipcbuf.read_wholeRet.ret_buf)) {
+    strcpy(fsipcbuf.read_whole.req_path, path);
+    fsipcbuf.read_whole.req_n     = FSVEC_CLIP(buf, n);
+    fsipcbuf.read_whole.req_pgoff = PGOFF(buf);
+    r = fsipc_lend(FSREQ_READ_WHOLE, buf, fsipcbuf.read_whole.req_n, 1);
+  }
+  if (r == -E_INVAL) {
+    strcpy(fsipcbuf.read_whole.req_path, path);
+    fsipcbuf.read_whole.req_n = n;
+    if ((r = fsipc(FSREQ_READ_WHOLE, NULL)) >= 0)
+      memmove(buf, fsipcbuf.read_wholeRet.ret_buf, r);
+  }
+  if (r < 0)
+    return r;
+  got  = r;
+  size = fsipcbuf.read_wholeRet.ret_size;
+
+  if (got < n && got < size) {
+    if ((fdnum = open(path, O_RDONLY)) < 0)
+      return fdnum;
+    if ((r = seek(fdnum, got)) >= 0 && (r = readn(fdnum, buf + got, n - got)) >= 0)
+      got += r;
+    close(fdnum);
+    if (r < 0)
+      return r;
+  }
+  return got;
+}
+
+// Delete a file
+int
+remove(const char *path) {
+  if (strlen(path) >= MAXPATHLEN)
+    return -E_BAD_PATH;
+  strcpy(fsipcbuf.remove.req_path, path);
+  return fsipc(FSREQ_REMOVE, NULL);
+}
+
+// Map len bytes of file fdnum, starting at offset, at addr.  Both addr
+// and offset must be page aligned, and the range must start inside the
+// file.  Pages come from the file server's block cache:
+//  - PROT_READ maps them read-only.  They show the file as it was when
+//    mapped; later writes to the file are not seen (MAP_SHARED and
+//    MAP_PRIVATE behave the same).
+//  - PROT_WRITE with MAP_PRIVATE maps them copy-on-write.  Writes go to
+//    private copies and never reach the file.  PROT_WRITE with
+//    MAP_SHARED is not supported.
+// Bytes past the end of the file read as zeros.
+// Returns 0 on success, < 0 on error (nothing is left mapped then).
+int
+mmap(void *addr, size_t len, int prot, int flags, int fdnum, off_t offset) {
+  struct Fd *fd;
+  size_t i;
+  int r;
+
+  if ((uintptr_t)addr % PGSIZE || offset % PGSIZE || offset < 0 ||
+      len > UTOP || (uintptr_t)addr > UTOP - len)
+    return -E_INVAL;
+  if ((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 ||
+      (flags & (MAP_SHARED | MAP_PRIVATE)) == (MAP_SHARED | MAP_PRIVATE))
+    return -E_INVAL;
+  if ((prot & PROT_WRITE) && ((flags & MAP_SHARED) || !cow_enable()))
+    return -E_NOT_SUPP;
+  if ((r = fd_lookup(fdnum, &fd)) < 0)
+    return r;
+  if (fd->fd_dev_id != devfile.dev_id)
+    return -E_NOT_SUPP;
+  wb_lock(fd);
+  r = devfile_wbflush(fd);
+  wb_unlock(fd);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < len; i += PGSIZE) {
+    fsipcbuf.map.req_fileid = fd->fd_file.id;
+    fsipcbuf.map.req_offset = offset + i;
+    fsipcbuf.map.req_cow    = (prot & PROT_WRITE) != 0;
+    if ((r = fsipc(FSREQ_MAP, addr + i)) < 0) {
+      munmap(addr, i);
+      return r;
+    }
+  }
+  return 0;
+}
+
+// Remove the mappings of len bytes at addr.
+int
+munmap(void *addr, size_t len) {
+  size_t i;
+  int r;
+
+  if ((uintptr_t)addr % PGSIZE)
+    return -E_INVAL;
+  for (i = 0; i < len; i += PGSIZE)
+    if ((r = sys_page_unmap(0, addr + i)) < 0)
+      return r;
+  return 0;
+}
+
+// Read the next entry of directory fdnum into *de.  Entries come from
+// the file server in batches, which the fd buffers.
+// Returns 1 on success, 0 at the end of the directory, < 0 on error.
+int
+readdir(int fdnum, struct Dirent *de) {
+  struct Fsdirent *e;
+  struct DirBuf *db;
+  struct Fd *fd;
+  int r;
+
+  if ((r = fd_lookup(fdnum, &fd)) < 0)
+    return r;
+  if (fd->fd_dev_id != devfile.dev_id || (fd->fd_omode & O_BUFFERED))
+    return -E_NOT_SUPP;
+  db = (struct DirBuf *)fd2data(fd);
+  if (!(uvpml4e[VPML4E(db)] & PTE_P) || !(uvpde[VPDPE(db)] & PTE_P) ||
+      !(uvpd[VPD(db)] & PTE_P) || !(uvpt[PGNUM(db)] & PTE_P)) {
+    // Shared like the fd page, so that a forked child resumes the
+    // listing where its parent is.
+    if ((r = sys_page_alloc(0, db, PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+      return r;
+  }
+
+  static_assert(sizeof(struct DirBuf) <= PGSIZE, "DirBuf does not fit in a page");
+
+  if (db->db_pos >= db->db_len || db->db_offset != fd->fd_offset) {
+    fsipcbuf.readdir.req_fileid = fd->fd_file.id;
+    fsipcbuf.readdir.req_cookie = fd->fd_offset;
+    if ((r = fsipc(FSREQ_READDIR, NULL)) < 0)
+      return r;
+    db->db_cookie = fsipcbuf.readdirRet.ret_cookie;
+    db->db_len    = fsipcbuf.readdirRet.ret_len;
+    db->db_pos    = 0;
+    memcpy(db->db_buf, fsipcbuf.readdirRet.ret_buf, db->db_len);
+    if (r == 0) {
+      fd->fd_offset = db->db_offset = db->db_cookie;
+      return 0;
+    }
+  }
+
+  e = (struct Fsdirent *)(db->db_buf + db->db_pos);
+  strcpy(de->d_name, e->de_name);
+  de->d_size  = e->de_size;
+  de->d_isdir = e->de_type == FTYPE_DIR;
+  db->db_pos += e->de_reclen;
+  if (db->db_pos < db->db_len)
+    fd->fd_offset = (off_t)(e->de_slot + 1) * sizeof(struct File);
+  else
+    fd->fd_offset = db->db_cookie;
+  db->db_offset = fd->fd_offset;
+  return 1;
 }
 
 // Synchronize disk with buffer cache
@@ -186,3 +671,14 @@ sync(void) {
 
   return fsipc(FSREQ_SYNC, NULL);
 }
+
+// Fetch the file server's counters
+int
+fs_stats(struct FsStats *st) {
+  int r;
+
+  if ((r = fsipc(FSREQ_STATS, NULL)) < 0)
+    return r;
+  *st = fsipcbuf.statsRet.ret_stats;
+  return 0;
+}
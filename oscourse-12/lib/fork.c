@@ -3,17 +3,15 @@
 #include <inc/string.h>
 #include <inc/lib.h>
 
-// PTE_COW marks copy-on-write page table entries.
+// PTE_COW (inc/lib.h) marks copy-on-write page table entries.
 // It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
-#define PTE_COW 0x800
+
+extern void (*_pgfault_handler)(struct UTrapframe *utf);
 
 //
 // Custom page fault handler - if faulting page is copy-on-write,
 // map in our own private writable copy.
 //
-#ifdef SANITIZE_USER_SHADOW_BASE
-void *__nosan_memcpy(void *dst, const void *src, size_t sz);
-#endif
 static void
 pgfault(struct UTrapframe *utf) {
   // Check that the faulting access was (1) a write, and (2) to a
@@ -45,11 +43,8 @@ pgfault(struct UTrapframe *utf) {
 		panic("pgfault error: sys_page_alloc: %i\n", r);
   }
 
-#ifdef SANITIZE_USER_SHADOW_BASE 
-  __nosan_memcpy((void *) PFTEMP, ROUNDDOWN(addr, PGSIZE), PGSIZE);
-#else
-	memmove((void *) PFTEMP, ROUNDDOWN(addr, PGSIZE), PGSIZE);
-#endif
+  // copy_page is not sanitized.
+  copy_page((void *) PFTEMP, ROUNDDOWN(addr, PGSIZE));
 
 	if ((r = sys_page_map(0, (void *) PFTEMP, 0, ROUNDDOWN(addr, PGSIZE), PTE_W | PTE_U | PTE_P)) < 0) {
 	  panic("pgfault error: sys_page_map: %i\n", r);
@@ -189,6 +184,16 @@ fork(void) {
   }
 }
 
+// Make sure writes to copy-on-write pages get handled, for code other
+// than fork that creates such mappings.  Returns false if the program
+// has a page fault handler of its own, which would not know about them.
+bool
+cow_enable(void) {
+  if (!_pgfault_handler)
+    set_pgfault_handler(pgfault);
+  return _pgfault_handler == pgfault;
+}
+
 // Challenge!
 int
 sfork(void) {
@@ -70,6 +70,63 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm) {
   sys_yield();
 }
 
+// Store the outcome r of a receive at pg in the out parameters of
+// ipc_recvv and return what ipc_recvv returns.
+static int32_t
+ipc_recv_result(int r, envid_t *from_env_store, void *pg,
+                int *perm_store, size_t *npages_store) {
+  if (from_env_store)
+    *from_env_store = r < 0 ? 0 : thisenv->env_ipc_from;
+  if (perm_store)
+    *perm_store = r < 0 ? 0 : thisenv->env_ipc_perm;
+  if (npages_store)
+    *npages_store = r < 0 ? 0 : thisenv->env_ipc_npages;
+  if (r < 0)
+    return r;
+#ifdef SANITIZE_USER_SHADOW_BASE
+  if ((uintptr_t)pg < UTOP)
+    platform_asan_unpoison(pg, thisenv->env_ipc_npages * PGSIZE);
+#endif
+  return thisenv->env_ipc_value;
+}
+
+// Like ipc_recv, but accept up to 'maxpages' pages, mapped one after
+// another from 'pg' on.  The number of pages received is stored in
+// *npages_store if that is nonnull.
+int32_t
+ipc_recvv(envid_t *from_env_store, void *pg, size_t maxpages,
+          int *perm_store, size_t *npages_store) {
+  if (pg == NULL)
+    pg = (void *)UTOP;
+  return ipc_recv_result(sys_ipc_recvv(pg, maxpages),
+                         from_env_store, pg, perm_store, npages_store);
+}
+
+// Like ipc_recvv, but return -E_IPC_NOT_RECV instead of waiting if
+// no sender is ready.  The CPU is given up once either way, so that
+// senders get the chance to send.
+int32_t
+ipc_try_recvv(envid_t *from_env_store, void *pg, size_t maxpages,
+              int *perm_store, size_t *npages_store) {
+  if (pg == NULL)
+    pg = (void *)UTOP;
+  return ipc_recv_result(sys_ipc_try_recvv(pg, maxpages),
+                         from_env_store, pg, perm_store, npages_store);
+}
+
+// Send 'val' and the 'npages' pages at pgs[0], pgs[1], ... with 'perm'
+// to 'toenv' in one message.  Keeps trying while the receiver is not
+// ready, like ipc_send, but returns any other error to the caller:
+// in that case nothing was sent.
+int
+ipc_sendv(envid_t to_env, uint32_t val, void *const *pgs, size_t npages, int perm) {
+  int r;
+
+  while ((r = sys_ipc_try_sendv(to_env, val, pgs, npages, perm)) == -E_IPC_NOT_RECV)
+    sys_yield();
+  return r;
+}
+
 // Find the first environment of the given type.  We'll use this to
 // find special environments.
 // Returns 0 if no such environment exists.
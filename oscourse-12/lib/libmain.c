@@ -28,6 +28,10 @@ libmain(int argc, char **argv) {
   // LAB 8: Your code here.
   thisenv = &envs[ENVX(sys_getenvid())];
 
+#ifndef JOS_PROG
+  string_init(1);
+#endif
+
   // save the name of the program so that panic() can use it
   if (argc > 0)
     binaryname = argv[0];
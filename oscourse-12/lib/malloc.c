@@ -0,0 +1,307 @@
+// User-space malloc.
+//
+// Requests of up to MAXSMALL bytes are rounded up to one of the size
+// classes in class_size.  Each class carves its objects out of spans:
+// SPANSIZE-aligned runs of [UHEAP, UHEAP + UHEAPSIZE) with a struct
+// Span at the start.  A span's pages are mapped as the objects on them
+// are first handed out, and freed objects go on the span's free list.
+// When the last object of a span is freed, its pages go back to the
+// kernel, unless it is the only span with room its class has left.
+//
+// Larger requests get a run of whole spans of their own, with just the
+// pages they need mapped and nothing in front of the object, which is
+// therefore page-aligned.  That is how free tells the two apart: a
+// small object never starts at the first byte of its span.
+//
+// The heap and all of the allocator's state are ordinary private
+// memory, so a child made by fork gets its own copy-on-write heap,
+// exactly as it was.
+
+#include <inc/lib.h>
+
+#define SPANSIZE (16 * PGSIZE)
+#define NSPANS   (UHEAPSIZE / SPANSIZE)
+#define MAXSMALL 2048
+
+struct Span {
+  struct Span *sp_next;  // next span of the class with room
+  struct Span *sp_prev;  // previous span of the class with room
+  void *sp_free;         // freed objects, linked through their first word
+  uint32_t sp_bump;      // offset of the first object never handed out
+  uint32_t sp_mapped;    // bytes mapped from the start of the span
+  uint16_t sp_class;     // index into class_size
+  uint16_t sp_nused;     // objects handed out and not freed
+};
+
+// Objects start this far into a span, keeping them 16-byte aligned
+#define SPANHDR ROUNDUP(sizeof(struct Span), 16)
+
+static const uint16_t class_size[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, MAXSMALL};
+
+#define NCLASSES (sizeof(class_size) / sizeof(class_size[0]))
+
+static struct Span *class_spans[NCLASSES]; // spans with room, by class
+static uint8_t span_used[NSPANS / 8];      // bitmap of spans taken
+static uint16_t span_pages[NSPANS];        // pages of the large object there
+static size_t span_hint;                   // no span below this is free
+
+static_assert(NSPANS % 8 == 0, "UHEAPSIZE is not a multiple of 8 spans");
+static_assert(UHEAPSIZE / PGSIZE <= 0xFFFF, "span_pages cannot count the heap");
+
+static bool
+span_isused(size_t i) {
+  return span_used[i / 8] & (1 << i % 8);
+}
+
+// Take n free spans in a row, first fit.  Returns the index of the
+// first, or -1 if there is no such run.
+static ssize_t
+span_take(size_t n) {
+  size_t i, j, run = 0;
+
+  for (i = span_hint; i < NSPANS; i++) {
+    run = span_isused(i) ? 0 : run + 1;
+    if (run < n)
+      continue;
+    i -= n - 1;
+    for (j = i; j < i + n; j++)
+      span_used[j / 8] |= 1 << j % 8;
+    if (span_hint == i)
+      span_hint = i + n;
+    return i;
+  }
+  return -1;
+}
+
+// Give back n spans from the i-th on.
+static void
+span_release(size_t i, size_t n) {
+  size_t j;
+
+  for (j = i; j < i + n; j++)
+    span_used[j / 8] &= ~(1 << j % 8);
+  span_hint = MIN(span_hint, i);
+}
+
+static char *
+span_va(size_t i) {
+  return (char *)UHEAP + i * SPANSIZE;
+}
+
+static void
+heap_unmap(char *va, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i += PGSIZE)
+    sys_page_unmap(0, va + i);
+}
+
+// Map fresh pages over the len bytes at va.  Returns 0 on success, or
+// < 0 with nothing mapped.
+static int
+heap_map(char *va, size_t len) {
+  size_t i;
+  int r;
+
+  for (i = 0; i < len; i += PGSIZE) {
+    if ((r = sys_page_alloc(0, va + i, PTE_P | PTE_U | PTE_W)) < 0) {
+      heap_unmap(va, i);
+      return r;
+    }
+  }
+  return 0;
+}
+
+static void
+span_link(struct Span *sp) {
+  sp->sp_prev = NULL;
+  sp->sp_next = class_spans[sp->sp_class];
+  if (sp->sp_next)
+    sp->sp_next->sp_prev = sp;
+  class_spans[sp->sp_class] = sp;
+}
+
+static void
+span_unlink(struct Span *sp) {
+  if (sp->sp_prev)
+    sp->sp_prev->sp_next = sp->sp_next;
+  else
+    class_spans[sp->sp_class] = sp->sp_next;
+  if (sp->sp_next)
+    sp->sp_next->sp_prev = sp->sp_prev;
+  sp->sp_next = sp->sp_prev = NULL;
+}
+
+// Has sp no object left to hand out?
+static bool
+span_full(struct Span *sp) {
+  return !sp->sp_free && sp->sp_bump + class_size[sp->sp_class] > SPANSIZE;
+}
+
+// Start a span for class c, with its first page mapped.
+static struct Span *
+span_new(int c) {
+  struct Span *sp;
+  ssize_t i;
+
+  if ((i = span_take(1)) < 0)
+    return NULL;
+  sp = (struct Span *)span_va(i);
+  if (heap_map((char *)sp, PGSIZE) < 0) {
+    span_release(i, 1);
+    return NULL;
+  }
+  sp->sp_free   = NULL;
+  sp->sp_bump   = SPANHDR;
+  sp->sp_mapped = PGSIZE;
+  sp->sp_class  = c;
+  sp->sp_nused  = 0;
+  span_link(sp);
+  return sp;
+}
+
+static void *
+small_alloc(size_t n) {
+  struct Span *sp;
+  uint32_t end;
+  void *obj;
+  int c;
+
+  for (c = 0; class_size[c] < n; c++)
+    /* find the class */;
+  if (!(sp = class_spans[c]) && !(sp = span_new(c)))
+    return NULL;
+
+  if ((obj = sp->sp_free)) {
+    sp->sp_free = *(void **)obj;
+  } else {
+    obj = (char *)sp + sp->sp_bump;
+    end = sp->sp_bump + class_size[c];
+    if (end > sp->sp_mapped) {
+      if (heap_map((char *)sp + sp->sp_mapped, ROUNDUP(end, PGSIZE) - sp->sp_mapped) < 0)
+        return NULL;
+      sp->sp_mapped = ROUNDUP(end, PGSIZE);
+    }
+    sp->sp_bump = end;
+  }
+  sp->sp_nused++;
+  if (span_full(sp))
+    span_unlink(sp);
+  return obj;
+}
+
+static void *
+large_alloc(size_t n) {
+  size_t npages;
+  ssize_t i;
+
+  if (n > UHEAPSIZE)
+    return NULL;
+  npages = ROUNDUP(n, PGSIZE) / PGSIZE;
+  if ((i = span_take(ROUNDUP(n, SPANSIZE) / SPANSIZE)) < 0)
+    return NULL;
+  if (heap_map(span_va(i), npages * PGSIZE) < 0) {
+    span_release(i, ROUNDUP(n, SPANSIZE) / SPANSIZE);
+    return NULL;
+  }
+  span_pages[i] = npages;
+  return span_va(i);
+}
+
+// Allocate n bytes, 16-byte aligned.  Returns NULL if there is no
+// memory left.
+void *
+malloc(size_t n) {
+  if (n <= MAXSMALL)
+    return small_alloc(n ? n : 1);
+  return large_alloc(n);
+}
+
+// Find the span p is in, panicking if p did not come from malloc.
+static size_t
+heap_span(void *p) {
+  uintptr_t va = (uintptr_t)p;
+  size_t i;
+
+  if (va < UHEAP || va >= UHEAP + UHEAPSIZE || va % 16)
+    panic("free: bad pointer %p", p);
+  i = (va - UHEAP) / SPANSIZE;
+  if (!span_isused(i))
+    panic("free: bad pointer %p", p);
+  return i;
+}
+
+void
+free(void *p) {
+  struct Span *sp;
+  size_t i, npages;
+  bool full;
+
+  if (!p)
+    return;
+  i = heap_span(p);
+
+  if ((char *)p == span_va(i)) {
+    npages = span_pages[i];
+    if (!npages)
+      panic("free: bad pointer %p", p);
+    heap_unmap(p, npages * PGSIZE);
+    span_pages[i] = 0;
+    span_release(i, ROUNDUP(npages * PGSIZE, SPANSIZE) / SPANSIZE);
+    return;
+  }
+
+  sp   = (struct Span *)span_va(i);
+  full = span_full(sp);
+  *(void **)p = sp->sp_free;
+  sp->sp_free = p;
+  sp->sp_nused--;
+  if (full)
+    span_link(sp);
+
+  // Keep one span with room per class, so that a malloc/free pair
+  // going back and forth over the edge does not map and unmap pages.
+  if (!sp->sp_nused && (sp->sp_next || sp->sp_prev)) {
+    span_unlink(sp);
+    heap_unmap((char *)sp, sp->sp_mapped);
+    span_release(i, 1);
+  }
+}
+
+// Allocate nmemb objects of size bytes each, zeroed.
+void *
+calloc(size_t nmemb, size_t size) {
+  size_t n = nmemb * size;
+  void *p;
+
+  if (size && n / size != nmemb)
+    return NULL;
+  if (!(p = malloc(n)))
+    return NULL;
+  // Large objects come on pages fresh from the kernel, already zero.
+  if (n <= MAXSMALL)
+    memset(p, 0, n);
+  return p;
+}
+
+// Resize the object at p to n bytes, moving it if it does not fit.
+// Returns the object, or NULL, leaving p alone, if there is no memory.
+void *
+realloc(void *p, size_t n) {
+  size_t i, old;
+  void *q;
+
+  if (!p)
+    return malloc(n);
+  i   = heap_span(p);
+  old = (char *)p == span_va(i) ? span_pages[i] * PGSIZE :
+                                   class_size[((struct Span *)span_va(i))->sp_class];
+  if (n <= old)
+    return p;
+  if (!(q = malloc(n)))
+    return NULL;
+  memcpy(q, p, old);
+  free(p);
+  return q;
+}
@@ -4,6 +4,7 @@ static ssize_t devpipe_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devpipe_write(struct Fd *fd, const void *buf, size_t n);
 static int devpipe_stat(struct Fd *fd, struct Stat *stat);
 static int devpipe_close(struct Fd *fd);
+static int devpipe_poll(struct Fd *fd, int events, unsigned *sleep);
 
 struct Dev devpipe =
     {
@@ -13,21 +14,50 @@ struct Dev devpipe =
         .dev_write = devpipe_write,
         .dev_close = devpipe_close,
         .dev_stat  = devpipe_stat,
+        .dev_poll  = devpipe_poll,
 };
 
-#define PIPEBUFSIZ 32 // small to provoke races
+// A pipe is a ring buffer of PIPEPAGES pages shared by both ends, in
+// the data area of their file descriptors.  Readers and writers copy
+// as much as fits at a time, and when there is nothing to read or no
+// room to write they sleep in the kernel (sys_env_sleep) until the
+// other end wakes them.
+//
+// The sleepers' env ids are kept on a page of their own after the
+// buffer.  Whether the other end is closed is told by the references
+// to the first page (see _pipeisclosed), so devpipe_close drops that
+// page before it looks for sleepers to wake: one that goes to sleep
+// after that look already sees the pipe closed.
+//
+// Whole pages bypass the ring when they can (see pipe_splice): a
+// reader that sleeps on an empty pipe with a page-aligned buffer offers
+// to take pages, and a writer with page-aligned data hands its pages
+// over with the wakeup, copy-on-write in both envs, instead of copying
+// them twice.
+#define PIPEPAGES  8
+#define PIPEBUFSIZ (PIPEPAGES * PGSIZE)
 
 struct Pipe {
-  off_t p_rpos;              // read position
-  off_t p_wpos;              // write position
-  uint8_t p_buf[PIPEBUFSIZ]; // data buffer
+  volatile off_t p_rpos;     // read position
+  volatile off_t p_wpos;     // write position
+  uint8_t p_buf[PIPEBUFSIZ] __attribute__((aligned(PGSIZE))); // data buffer
+  struct {
+    volatile envid_t pw_reader; // reader asleep for data
+    volatile envid_t pw_writer; // writer asleep for room
+    volatile size_t pw_pages;   // pages the reader takes instead
+  } p_wait __attribute__((aligned(PGSIZE)));
 };
 
+#define PIPESIZE sizeof(struct Pipe) // whole pages: p_wait is page-aligned
+
+static_assert(PIPESIZE <= FDDATASIZE, "Pipe does not fit in the fd data area");
+
 int
 pipe(int pfd[2]) {
   int r;
   struct Fd *fd0, *fd1;
-  void *va;
+  char *va;
+  size_t i;
 
   // allocate the file descriptor table entries
   if ((r = fd_alloc(&fd0)) < 0 || (r = sys_page_alloc(0, fd0, PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
@@ -36,12 +66,14 @@ pipe(int pfd[2]) {
   if ((r = fd_alloc(&fd1)) < 0 || (r = sys_page_alloc(0, fd1, PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
     goto err1;
 
-  // allocate the pipe structure as first data page in both
+  // allocate the pipe structure as the first data pages in both
   va = fd2data(fd0);
-  if ((r = sys_page_alloc(0, va, PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
-    goto err2;
-  if ((r = sys_page_map(0, va, 0, fd2data(fd1), PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
-    goto err3;
+  for (i = 0; i < PIPESIZE; i += PGSIZE) {
+    if ((r = sys_page_alloc(0, va + i, PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
+      goto err2;
+    if ((r = sys_page_map(0, va + i, 0, fd2data(fd1) + i, PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
+      goto err2;
+  }
 
   // set up fd structures
   fd0->fd_dev_id = devpipe.dev_id;
@@ -58,9 +90,11 @@ pipe(int pfd[2]) {
   pfd[1] = fd2num(fd1);
   return 0;
 
-err3:
-  sys_page_unmap(0, va);
 err2:
+  for (i = 0; i < PIPESIZE; i += PGSIZE) {
+    sys_page_unmap(0, va + i);
+    sys_page_unmap(0, fd2data(fd1) + i);
+  }
   sys_page_unmap(0, fd1);
 err1:
   sys_page_unmap(0, fd0);
@@ -95,11 +129,108 @@ pipeisclosed(int fdnum) {
   return _pipeisclosed(fd, p);
 }
 
+// Can the page at va be handed to or replaced by another env's page?
+static bool
+pipe_page_private(const void *va) {
+  return (uvpml4e[VPML4E(va)] & PTE_P) && (uvpde[VPDPE(va)] & PTE_P) &&
+         (uvpd[VPD(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P) &&
+         !(uvpt[PGNUM(va)] & PTE_SHARE);
+}
+
+// Sleep until *pos moves from seen or the other end is closed.  We
+// note ourselves in *sleeper first and then look again, so that the
+// other end either sees us there or has already made the change.  Only
+// one env per end can be noted; any others poll.  A reader passes the
+// n bytes at dst where a writer may put whole pages instead (see
+// pipe_splice); returns the bytes put there.
+static size_t
+pipe_wait(struct Fd *fd, struct Pipe *p, volatile envid_t *sleeper,
+          volatile off_t *pos, off_t seen, void *dst, size_t n) {
+  envid_t me = thisenv->env_id;
+  size_t offer = 0, got = 0;
+
+  if (dst && !PGOFF(dst) && n >= PGSIZE && cow_enable())
+    while (offer < MIN(n / PGSIZE, IPC_MAXPAGES) &&
+           pipe_page_private((char *)dst + offer * PGSIZE))
+      offer++;
+  if (!offer)
+    dst = (void *)UTOP;
+
+  if (*sleeper != me && !__sync_bool_compare_and_swap(sleeper, 0, me)) {
+    sys_yield();
+    return 0;
+  }
+  // The kernel checks what a writer hands over against what we offer
+  // here, so it does no harm if this is seen with another sleeper.
+  if (sleeper == &p->p_wait.pw_reader)
+    p->p_wait.pw_pages = offer;
+  __sync_synchronize();
+  if (*pos == seen && !_pipeisclosed(fd, p)) {
+    if (debug)
+      cprintf("[%08x] pipe sleep\n", me);
+    if (sys_env_sleep(dst, offer, 0, 0) == 0)
+      got = thisenv->env_sleep_npages;
+  }
+  __sync_bool_compare_and_swap(sleeper, me, 0);
+  return got * PGSIZE;
+}
+
+// Wake the env noted in *sleeper, if any.
+static void
+pipe_wake(volatile envid_t *sleeper) {
+  envid_t e;
+
+  __sync_synchronize();
+  if ((e = *sleeper) && __sync_bool_compare_and_swap(sleeper, e, 0))
+    sys_env_wake(e, NULL, 0, 0);
+}
+
+// If the pipe is empty and its reader sleeps offering to take whole
+// pages, wake it with as many whole pages from the n bytes at src as it
+// takes, instead of copying them through the ring.  Our own mappings of
+// them become copy-on-write, as after fork, so that whatever either env
+// writes there later stays its own.  Returns the bytes handed over.
+static size_t
+pipe_splice(struct Pipe *p, const void *src, size_t n) {
+  void *pgs[IPC_MAXPAGES];
+  size_t i, npages;
+  envid_t reader;
+  pte_t pte;
+
+  if (PGOFF(src) || n < PGSIZE || p->p_rpos != p->p_wpos)
+    return 0;
+  reader = p->p_wait.pw_reader;
+  npages = MIN(n / PGSIZE, p->p_wait.pw_pages);
+  if (!reader || !npages || !cow_enable())
+    return 0;
+  for (i = 0; i < npages; i++) {
+    pgs[i] = (char *)src + i * PGSIZE;
+    if (!pipe_page_private(pgs[i]))
+      return 0;
+  }
+  for (i = 0; i < npages; i++) {
+    pte = uvpt[PGNUM(pgs[i])];
+    if ((pte & PTE_W) &&
+        sys_page_map(0, pgs[i], 0, pgs[i], ((pte & PTE_SYSCALL) & ~PTE_W) | PTE_COW) < 0)
+      return 0;
+  }
+
+  if (!__sync_bool_compare_and_swap(&p->p_wait.pw_reader, reader, 0))
+    return 0;
+  if (sys_env_wake(reader, pgs, npages, PTE_P | PTE_U | PTE_COW) < 0) {
+    // It is not asleep yet; it will find the data in the ring.
+    sys_env_wake(reader, NULL, 0, 0);
+    return 0;
+  }
+  return npages * PGSIZE;
+}
+
 static ssize_t
 devpipe_read(struct Fd *fd, void *vbuf, size_t n) {
   uint8_t *buf;
-  size_t i;
+  size_t i, m;
   struct Pipe *p;
+  off_t rpos;
 
   p = (struct Pipe *)fd2data(fd);
   if (debug)
@@ -107,34 +238,37 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n) {
             thisenv->env_id, (unsigned long)uvpt[PGNUM(p)],
             (unsigned long)n, (long)p->p_rpos, (long)p->p_wpos);
 
+  if (!n)
+    return 0;
+  while ((rpos = p->p_rpos) == p->p_wpos) {
+    // pipe is empty
+    // if all the writers are gone, note eof
+    if (_pipeisclosed(fd, p))
+      return 0;
+    if ((m = pipe_wait(fd, p, &p->p_wait.pw_reader, &p->p_wpos, rpos, vbuf, n)) > 0)
+      return m;
+  }
+
+  // Take what is there, in at most two pieces where the ring wraps.
   buf = vbuf;
-  for (i = 0; i < n; i++) {
-    while (p->p_rpos == p->p_wpos) {
-      // pipe is empty
-      // if we got any data, return it
-      if (i > 0)
-        return i;
-      // if all the writers are gone, note eof
-      if (_pipeisclosed(fd, p))
-        return 0;
-      // yield and see what happens
-      if (debug)
-        cprintf("devpipe_read yield\n");
-      sys_yield();
-    }
-    // there's a byte.  take it.
-    // wait to increment rpos until the byte is taken!
-    buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
-    p->p_rpos++;
+  for (i = 0; i < n && (rpos = p->p_rpos) != p->p_wpos; i += m) {
+    m = MIN(n - i, (size_t)(p->p_wpos - rpos));
+    m = MIN(m, PIPEBUFSIZ - rpos % PIPEBUFSIZ);
+    memcpy(buf + i, p->p_buf + rpos % PIPEBUFSIZ, m);
+    // wait to advance rpos until the bytes are taken!
+    __sync_synchronize();
+    p->p_rpos = rpos + m;
   }
+  pipe_wake(&p->p_wait.pw_writer);
   return i;
 }
 
 static ssize_t
 devpipe_write(struct Fd *fd, const void *vbuf, size_t n) {
   const uint8_t *buf;
-  size_t i;
+  size_t i, m;
   struct Pipe *p;
+  off_t wpos;
 
   p = (struct Pipe *)fd2data(fd);
   if (debug)
@@ -143,23 +277,26 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n) {
             (unsigned long)n, (long)p->p_rpos, (long)p->p_wpos);
 
   buf = vbuf;
-  for (i = 0; i < n; i++) {
-    while (p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
+  for (i = 0; i < n; i += m) {
+    while ((wpos = p->p_wpos) - p->p_rpos >= PIPEBUFSIZ) {
       // pipe is full
       // if all the readers are gone
       // (it's only writers like us now),
       // note eof
       if (_pipeisclosed(fd, p))
         return 0;
-      // yield and see what happens
-      if (debug)
-        cprintf("devpipe_write yield\n");
-      sys_yield();
+      pipe_wait(fd, p, &p->p_wait.pw_writer, &p->p_rpos, wpos - PIPEBUFSIZ, NULL, 0);
     }
-    // there's room for a byte.  store it.
-    // wait to increment wpos until the byte is stored!
-    p->p_buf[p->p_wpos % PIPEBUFSIZ] = buf[i];
-    p->p_wpos++;
+    if ((m = pipe_splice(p, buf + i, n - i)) > 0)
+      continue;
+    // Fill what room there is, up to where the ring wraps.
+    m = MIN(n - i, PIPEBUFSIZ - (size_t)(wpos - p->p_rpos));
+    m = MIN(m, PIPEBUFSIZ - wpos % PIPEBUFSIZ);
+    memcpy(p->p_buf + wpos % PIPEBUFSIZ, buf + i, m);
+    // wait to advance wpos until the bytes are stored!
+    __sync_synchronize();
+    p->p_wpos = wpos + m;
+    pipe_wake(&p->p_wait.pw_reader);
   }
 
   return i;
@@ -175,8 +312,65 @@ devpipe_stat(struct Fd *fd, struct Stat *stat) {
   return 0;
 }
 
+// Which of events the pipe is ready for, with POLLHUP once the other
+// end is closed.
+static int
+pipe_ready(struct Fd *fd, struct Pipe *p, int events) {
+  int ready = 0;
+
+  if ((events & POLLIN) && p->p_rpos != p->p_wpos)
+    ready |= POLLIN;
+  if ((events & POLLOUT) && p->p_wpos - p->p_rpos < PIPEBUFSIZ)
+    ready |= POLLOUT;
+  if (_pipeisclosed(fd, p))
+    ready |= POLLHUP;
+  return ready;
+}
+
+// See poll.  We get woken as the sleeper of our end, the way pipe_wait
+// does it, except that we take no pages.
+static int
+devpipe_poll(struct Fd *fd, int events, unsigned *sleep) {
+  struct Pipe *p = (struct Pipe *)fd2data(fd);
+  envid_t me     = thisenv->env_id;
+  volatile envid_t *sleeper;
+  int ready;
+
+  sleeper = (fd->fd_omode & O_ACCMODE) == O_RDONLY ? &p->p_wait.pw_reader : &p->p_wait.pw_writer;
+  if (!sleep) {
+    __sync_bool_compare_and_swap(sleeper, me, 0);
+    return pipe_ready(fd, p, events);
+  }
+  if ((ready = pipe_ready(fd, p, events)))
+    return ready;
+
+  if (*sleeper != me && !__sync_bool_compare_and_swap(sleeper, 0, me))
+    return -E_AGAIN;
+  if (sleeper == &p->p_wait.pw_reader)
+    p->p_wait.pw_pages = 0;
+  __sync_synchronize();
+  return pipe_ready(fd, p, events);
+}
+
 static int
 devpipe_close(struct Fd *fd) {
+  struct Pipe *p = (struct Pipe *)fd2data(fd);
+  envid_t reader, writer;
+  size_t i;
+  int r;
+
   (void)sys_page_unmap(0, fd);
-  return sys_page_unmap(0, fd2data(fd));
+  for (i = PGSIZE; i < PIPESIZE - PGSIZE; i += PGSIZE)
+    (void)sys_page_unmap(0, (char *)p + i);
+  r = sys_page_unmap(0, p);
+
+  // Whoever sleeps on the pipe may be waiting for us to go away.
+  reader = p->p_wait.pw_reader;
+  writer = p->p_wait.pw_writer;
+  (void)sys_page_unmap(0, (void *)&p->p_wait);
+  if (reader)
+    sys_env_wake(reader, NULL, 0, 0);
+  if (writer)
+    sys_env_wake(writer, NULL, 0, 0);
+  return r;
 }
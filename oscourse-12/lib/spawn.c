@@ -164,7 +164,7 @@ spawn(const char *prog, const char **argv) {
   return child;
 
 error:
-  sys_env_destroy(child);
+  sys_env_destroy(child, r);
   close(fd);
   return r;
 }
@@ -305,6 +305,14 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
       // allocate a blank page
       if ((r = sys_page_alloc(child, (void *)(va + i), perm)) < 0)
         return r;
+    } else if (!(perm & PTE_W) && i + PGSIZE <= filesz) {
+      // Read-only pages wholly from the file are mapped from the file
+      // server's cache, so every instance of a program shares its text.
+      if ((r = mmap(UTEMP, PGSIZE, PROT_READ, MAP_PRIVATE, fd, fileoffset + i)) < 0)
+        return r;
+      if ((r = sys_page_map(0, UTEMP, child, (void *)(va + i), perm)) < 0)
+        panic("spawn: sys_page_map text: %i", r);
+      sys_page_unmap(0, UTEMP);
     } else {
       // from file
       if ((r = sys_page_alloc(0, UTEMP, PTE_P | PTE_U | PTE_W)) < 0)
@@ -313,6 +321,11 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
         return r;
       if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz - i))) < 0)
         return r;
+      // Whole pages may come back as read-only copy-on-write mappings
+      // of the file server's cache.  The child has no fault handler to
+      // copy them, so writable ones get copied here.
+      if ((perm & PTE_W) && !(uvpt[PGNUM(UTEMP)] & PTE_W))
+        *(volatile char *)UTEMP = *(volatile char *)UTEMP;
       if ((r = sys_page_map(0, UTEMP, child, (void *)(va + i), perm)) < 0)
         panic("spawn: sys_page_map data: %i", r);
       sys_page_unmap(0, UTEMP);
@@ -1,6 +1,7 @@
 // Basic string routines.  Not hardware optimized, but not shabby.
 
 #include <inc/string.h>
+#include <inc/mmu.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -8,8 +9,18 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
-int
-strlen(const char *s) {
+// User environments also get SSE2 versions of memset, memmove, memcmp
+// and strlen, picked by string_init.  The kernel is built without SSE
+// and does not save its own vector registers, so it keeps the generic
+// ones.
+#if !defined(JOS_KERNEL) && !defined(CONFIG_KSPACE)
+#define SIMD 1
+#include <inc/x86.h>
+#include <emmintrin.h>
+#endif
+
+static int
+strlen_generic(const char *s) {
   int n;
 
   for (n = 0; *s != '\0'; s++)
@@ -124,8 +135,8 @@ strfind(const char *s, char c) {
 }
 
 #if ASM
-void *
-memset(void *v, int c, size_t n) {
+static void *
+memset_generic(void *v, int c, size_t n) {
   if (n == 0)
     return v;
   if ((int64_t)v % 4 == 0 && n % 4 == 0) {
@@ -139,8 +150,8 @@ memset(void *v, int c, size_t n) {
   return v;
 }
 
-void *
-memmove(void *dst, const void *src, size_t n) {
+static void *
+memmove_generic(void *dst, const void *src, size_t n) {
   const char *s;
   char *d;
 
@@ -171,8 +182,8 @@ memmove(void *dst, const void *src, size_t n) {
 
 #else
 
-void *
-memset(void *v, int c, size_t n) {
+static void *
+memset_generic(void *v, int c, size_t n) {
   char *p;
   int m;
 
@@ -184,8 +195,8 @@ memset(void *v, int c, size_t n) {
   return v;
 }
 
-void *
-memmove(void *dst, const void *src, size_t n) {
+static void *
+memmove_generic(void *dst, const void *src, size_t n) {
   const char *s;
   char *d;
 
@@ -204,13 +215,8 @@ memmove(void *dst, const void *src, size_t n) {
 }
 #endif
 
-void *
-memcpy(void *dst, const void *src, size_t n) {
-  return memmove(dst, src, n);
-}
-
-int
-memcmp(const void *v1, const void *v2, size_t n) {
+static int
+memcmp_generic(const void *v1, const void *v2, size_t n) {
   const uint8_t *s1 = (const uint8_t *)v1;
   const uint8_t *s2 = (const uint8_t *)v2;
 
@@ -223,6 +229,308 @@ memcmp(const void *v1, const void *v2, size_t n) {
   return 0;
 }
 
+#ifdef SIMD
+
+// Unaligned words, for the short cases
+typedef uint64_t __attribute__((may_alias, aligned(1))) uword64_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) uword32_t;
+
+// Copies and fills of at least this many bytes use rep movsb and rep
+// stosb, which beat SSE2 where the CPU reports them fast: from a few
+// kilobytes on with ERMS, and from much shorter lengths with FSRM.
+static size_t rep_min = (size_t)-1;
+
+__attribute__((target("sse2"))) static void *
+memmove_sse2(void *dst, const void *src, size_t n) {
+  const char *s = src;
+  char *d       = dst;
+  __m128i head, tail, a, b, c, e;
+  char *end;
+
+  // Short moves load everything before storing anything, so they
+  // are correct whichever way the buffers overlap.
+  if (n < 32) {
+    if (n >= 16) {
+      head = _mm_loadu_si128((const __m128i *)s);
+      tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+      _mm_storeu_si128((__m128i *)d, head);
+      _mm_storeu_si128((__m128i *)(d + n - 16), tail);
+    } else if (n >= 8) {
+      uint64_t x = *(const uword64_t *)s, y = *(const uword64_t *)(s + n - 8);
+      *(uword64_t *)d           = x;
+      *(uword64_t *)(d + n - 8) = y;
+    } else if (n >= 4) {
+      uint32_t x = *(const uword32_t *)s, y = *(const uword32_t *)(s + n - 4);
+      *(uword32_t *)d           = x;
+      *(uword32_t *)(d + n - 4) = y;
+    } else if (n) {
+      char x = s[0], y = s[n / 2], z = s[n - 1];
+      d[0]     = x;
+      d[n / 2] = y;
+      d[n - 1] = z;
+    }
+    return dst;
+  }
+
+  // A destination overlapping the end of the source must be copied
+  // backwards.
+  if (s < d && s + n > d)
+    return memmove_generic(dst, src, n);
+
+  if (n >= rep_min) {
+    asm volatile("cld; rep movsb\n" ::"D"(d), "S"(s), "c"(n)
+                 : "cc", "memory");
+    return dst;
+  }
+
+  // Copy forwards in aligned 16-byte stores.  The first and last 16
+  // bytes go unaligned, and are loaded first and stored last in case
+  // the destination overlaps the start of the source.
+  head = _mm_loadu_si128((const __m128i *)s);
+  tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+  end  = d + n - 16;
+  s += 16 - ((uintptr_t)d & 15);
+  d += 16 - ((uintptr_t)d & 15);
+  for (; d + 64 <= end; d += 64, s += 64) {
+    a = _mm_loadu_si128((const __m128i *)s);
+    b = _mm_loadu_si128((const __m128i *)(s + 16));
+    c = _mm_loadu_si128((const __m128i *)(s + 32));
+    e = _mm_loadu_si128((const __m128i *)(s + 48));
+    _mm_store_si128((__m128i *)d, a);
+    _mm_store_si128((__m128i *)(d + 16), b);
+    _mm_store_si128((__m128i *)(d + 32), c);
+    _mm_store_si128((__m128i *)(d + 48), e);
+  }
+  for (; d < end; d += 16, s += 16)
+    _mm_store_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+  _mm_storeu_si128((__m128i *)end, tail);
+  _mm_storeu_si128((__m128i *)dst, head);
+  return dst;
+}
+
+__attribute__((target("sse2"))) static void *
+memset_sse2(void *v, int c, size_t n) {
+  char *p = v, *end;
+  __m128i x;
+
+  if (n < 32) {
+    uint64_t k = (uint8_t)c * 0x0101010101010101ULL;
+    if (n >= 16) {
+      *(uword64_t *)p            = k;
+      *(uword64_t *)(p + 8)      = k;
+      *(uword64_t *)(p + n - 16) = k;
+      *(uword64_t *)(p + n - 8)  = k;
+    } else if (n >= 8) {
+      *(uword64_t *)p           = k;
+      *(uword64_t *)(p + n - 8) = k;
+    } else if (n >= 4) {
+      *(uword32_t *)p           = k;
+      *(uword32_t *)(p + n - 4) = k;
+    } else if (n) {
+      p[0]     = c;
+      p[n / 2] = c;
+      p[n - 1] = c;
+    }
+    return v;
+  }
+
+  if (n >= rep_min) {
+    asm volatile("cld; rep stosb\n" ::"D"(p), "a"(c), "c"(n)
+                 : "cc", "memory");
+    return v;
+  }
+
+  // Unaligned stores at both ends, aligned ones in between
+  x   = _mm_set1_epi8((char)c);
+  end = p + n - 16;
+  _mm_storeu_si128((__m128i *)p, x);
+  _mm_storeu_si128((__m128i *)end, x);
+  p += 16 - ((uintptr_t)p & 15);
+  for (; p + 64 <= end; p += 64) {
+    _mm_store_si128((__m128i *)p, x);
+    _mm_store_si128((__m128i *)(p + 16), x);
+    _mm_store_si128((__m128i *)(p + 32), x);
+    _mm_store_si128((__m128i *)(p + 48), x);
+  }
+  for (; p < end; p += 16)
+    _mm_store_si128((__m128i *)p, x);
+  return v;
+}
+
+__attribute__((target("sse2"))) static int
+memcmp_sse2(const void *v1, const void *v2, size_t n) {
+  const uint8_t *s1 = v1, *s2 = v2;
+  unsigned m;
+  int i;
+
+  for (; n >= 16; n -= 16, s1 += 16, s2 += 16) {
+    m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)s1),
+                                         _mm_loadu_si128((const __m128i *)s2)));
+    if (m != 0xFFFF) {
+      i = __builtin_ctz(~m);
+      return (int)s1[i] - (int)s2[i];
+    }
+  }
+  return memcmp_generic(s1, s2, n);
+}
+
+// Reads whole aligned 16-byte blocks, which may run past the end of
+// the string but never onto the next page; hence no ASAN checks.
+__attribute__((target("sse2"), no_sanitize_address)) static int
+strlen_sse2(const char *s) {
+  const __m128i *p = (const __m128i *)((uintptr_t)s & ~(uintptr_t)15);
+  __m128i zero     = _mm_setzero_si128();
+  unsigned m;
+
+  m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(p), zero)) >> ((uintptr_t)s & 15);
+  if (m)
+    return __builtin_ctz(m);
+  for (;;) {
+    m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(++p), zero));
+    if (m)
+      return (const char *)p + __builtin_ctz(m) - s;
+  }
+}
+
+static void *(*memset_fn)(void *, int, size_t)                = memset_generic;
+static void *(*memmove_fn)(void *, const void *, size_t)      = memmove_generic;
+static int (*memcmp_fn)(const void *, const void *, size_t)   = memcmp_generic;
+static int (*strlen_fn)(const char *)                         = strlen_generic;
+
+// Pick the string routines: the vector ones if vector is set and the
+// CPU has SSE2, otherwise the generic ones.  libmain calls this with
+// vector set before umain runs.
+void
+string_init(bool vector) {
+  uint32_t maxleaf, ebx, edx;
+  bool erms = 0, fsrm = 0;
+
+  memset_fn  = memset_generic;
+  memmove_fn = memmove_generic;
+  memcmp_fn  = memcmp_generic;
+  strlen_fn  = strlen_generic;
+  rep_min    = (size_t)-1;
+
+  cpuid(0, &maxleaf, NULL, NULL, NULL);
+  cpuid(1, NULL, NULL, NULL, &edx);
+  if (!vector || !(edx & (1 << 26)))
+    return;
+  if (maxleaf >= 7) {
+    cpuid_count(7, 0, NULL, &ebx, NULL, &edx);
+    erms = (ebx >> 9) & 1;
+    fsrm = (edx >> 4) & 1;
+  }
+  rep_min = fsrm ? 128 : erms ? 4096 : (size_t)-1;
+
+  memset_fn  = memset_sse2;
+  memmove_fn = memmove_sse2;
+  memcmp_fn  = memcmp_sse2;
+  strlen_fn  = strlen_sse2;
+}
+
+int
+strlen(const char *s) {
+  return strlen_fn(s);
+}
+
+void *
+memset(void *v, int c, size_t n) {
+  return memset_fn(v, c, n);
+}
+
+void *
+memmove(void *dst, const void *src, size_t n) {
+  return memmove_fn(dst, src, n);
+}
+
+int
+memcmp(const void *v1, const void *v2, size_t n) {
+  return memcmp_fn(v1, v2, n);
+}
+
+#else
+
+int
+strlen(const char *s) {
+  return strlen_generic(s);
+}
+
+void *
+memset(void *v, int c, size_t n) {
+  return memset_generic(v, c, n);
+}
+
+void *
+memmove(void *dst, const void *src, size_t n) {
+  return memmove_generic(dst, src, n);
+}
+
+int
+memcmp(const void *v1, const void *v2, size_t n) {
+  return memcmp_generic(v1, v2, n);
+}
+
+#endif
+
+void *
+memcpy(void *dst, const void *src, size_t n) {
+  return memmove(dst, src, n);
+}
+
+// Non-temporal store: the line goes to memory without being read into
+// the cache first, and without evicting anything to make room for it.
+static inline void
+movnti(uint64_t *p, uint64_t v) {
+  asm volatile("movnti %1, %0"
+               : "=m"(*p)
+               : "r"(v));
+}
+
+// Zero the page at pg, which must be page-aligned.  A whole page
+// cleared or copied is rarely read again right away, so these two
+// bypass the cache rather than push the working set out of it.  The
+// sfence makes the stores visible before the page is handed on.
+void
+clear_page(void *pg) {
+  uint64_t *p = pg, *end = p + PGSIZE / sizeof(*p);
+
+  for (; p < end; p += 8) {
+    movnti(p, 0);
+    movnti(p + 1, 0);
+    movnti(p + 2, 0);
+    movnti(p + 3, 0);
+    movnti(p + 4, 0);
+    movnti(p + 5, 0);
+    movnti(p + 6, 0);
+    movnti(p + 7, 0);
+  }
+  asm volatile("sfence" ::
+                   : "memory");
+}
+
+// Copy the page at src to dst; dst must be page-aligned.  Whole pages
+// are copied on behalf of others (copy-on-write), so the loads are not
+// checked by ASAN.
+__attribute__((no_sanitize_address)) void
+copy_page(void *dst, const void *src) {
+  uint64_t *d = dst, *end = d + PGSIZE / sizeof(*d);
+  const uint64_t *s = src;
+  uint64_t a, b, c, e;
+
+  for (; d < end; d += 4, s += 4) {
+    a = s[0];
+    b = s[1];
+    c = s[2];
+    e = s[3];
+    movnti(d, a);
+    movnti(d + 1, b);
+    movnti(d + 2, c);
+    movnti(d + 3, e);
+  }
+  asm volatile("sfence" ::
+                   : "memory");
+}
+
 void *
 memfind(const void *s, int c, size_t n) {
   const void *ends = (const char *)s + n;
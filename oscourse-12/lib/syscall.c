@@ -47,8 +47,13 @@ sys_cgetc(void) {
 }
 
 int
-sys_env_destroy(envid_t envid) {
-  return syscall(SYS_env_destroy, 1, envid, 0, 0, 0, 0);
+sys_env_destroy(envid_t envid, int status) {
+  return syscall(SYS_env_destroy, 1, envid, status, 0, 0, 0);
+}
+
+int
+sys_env_wait(envid_t envid) {
+  return syscall(SYS_env_wait, 0, envid, 0, 0, 0, 0);
 }
 
 envid_t
@@ -109,6 +114,41 @@ sys_ipc_recv(void *dstva) {
   return syscall(SYS_ipc_recv, 1, (uint64_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_try_sendv(envid_t envid, uint64_t value, void *const *srcvas, size_t npages, int perm) {
+  return syscall(SYS_ipc_try_sendv, 0, envid, value, (uint64_t)srcvas, npages, perm);
+}
+
+int
+sys_ipc_recvv(void *dstva, size_t maxpages) {
+  return syscall(SYS_ipc_recvv, 1, (uint64_t)dstva, maxpages, 0, 0, 0);
+}
+
+int
+sys_ipc_try_recvv(void *dstva, size_t maxpages) {
+  return syscall(SYS_ipc_try_recvv, 0, (uint64_t)dstva, maxpages, 0, 0, 0);
+}
+
+int
+sys_env_sleep(void *dstva, size_t maxpages, unsigned flags, uint32_t timeout_ms) {
+  return syscall(SYS_env_sleep, 0, (uint64_t)dstva, maxpages, flags, timeout_ms, 0);
+}
+
+int
+sys_env_wake(envid_t envid, void *const *pgs, size_t npages, int perm) {
+  return syscall(SYS_env_wake, 0, envid, (uint64_t)pgs, npages, perm, 0);
+}
+
+int
+sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms) {
+  return syscall(SYS_futex_wait, 0, (uint64_t)addr, expected, timeout_ms, 0, 0);
+}
+
+int
+sys_futex_wake(volatile uint32_t *addr, size_t n) {
+  return syscall(SYS_futex_wake, 0, (uint64_t)addr, n, 0, 0, 0);
+}
+
 int
 sys_gettime(void) {
   return syscall(SYS_gettime, 0, 0, 0, 0, 0, 0);
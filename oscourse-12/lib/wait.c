@@ -1,12 +1,11 @@
 #include <inc/lib.h>
 
-// Waits until 'envid' exits.
-void
+// Waits until 'envid' exits, and returns its exit status: 0 from exit,
+// what it passed to exitstatus or sys_env_destroy, or -E_FAULT if the
+// kernel killed it.  Returns -E_BAD_ENV if envid is long gone and its
+// status is lost.
+int
 wait(envid_t envid) {
-  const volatile struct Env *e;
-
   assert(envid != 0);
-  e = &envs[ENVX(envid)];
-  while (e->env_id == envid && e->env_status != ENV_FREE)
-    sys_yield();
+  return sys_env_wait(envid);
 }
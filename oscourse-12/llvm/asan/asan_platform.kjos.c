@@ -67,6 +67,11 @@ platform_asan_unpoison(void *addr, uint32_t size) {
   asan_internal_fill_range((uptr)addr, size, 0);
 }
 
+void
+platform_asan_poison(void *addr, uint32_t size) {
+  asan_internal_fill_range((uptr)addr, size, ASAN_HEAP_FREED);
+}
+
 void
 platform_asan_fatal(const char *msg, uptr p, size_t width, unsigned access_type) {
   ASAN_LOG("Fatal error: %s (addr 0x%lx within i/o size 0x%lx of type %u), tracing:",
@@ -0,0 +1,101 @@
+// Time stat() of a cached file, first with the file server otherwise
+// idle and then while another client reads every file in the root
+// directory, which the server mostly has to fetch from the disk, and
+// report the latency distribution of both runs.  A server that handles
+// one request at a time makes each stat wait for the read ahead of it.
+// Only the first run after boot reads the files cold.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSAMPLES 2000
+
+static uint64_t samples[NSAMPLES];
+static char buf[16 * PGSIZE];
+
+// Read every regular file in the root directory.
+static void
+read_all(void) {
+  struct Dirent de;
+  char path[MAXPATHLEN];
+  size_t total = 0;
+  int dfd, fd, r;
+
+  if ((dfd = open("/", O_RDONLY)) < 0)
+    panic("open /: %i", dfd);
+  while (readdir(dfd, &de) > 0) {
+    if (de.d_isdir)
+      continue;
+    snprintf(path, sizeof(path), "/%s", de.d_name);
+    if ((fd = open(path, O_RDONLY)) < 0)
+      continue;
+    while ((r = read(fd, buf + 1, sizeof(buf) - 1)) > 0)
+      total += r;
+    close(fd);
+  }
+  close(dfd);
+  printf("reader: %ld bytes\n", (long)total);
+}
+
+static void
+sort(uint64_t *a, size_t n) {
+  size_t gap, i, j;
+  uint64_t v;
+
+  for (gap = n / 2; gap > 0; gap /= 2)
+    for (i = gap; i < n; i++) {
+      v = a[i];
+      for (j = i; j >= gap && a[j - gap] > v; j -= gap)
+        a[j] = a[j - gap];
+      a[j] = v;
+    }
+}
+
+// Stat path until n samples are in or, if other is set, until that
+// environment has exited.  Returns the number of samples.
+static size_t
+time_stats(const char *path, envid_t other) {
+  const volatile struct Env *e = other ? &envs[ENVX(other)] : NULL;
+  struct Stat st;
+  uint64_t start;
+  size_t n;
+  int r;
+
+  for (n = 0; n < NSAMPLES; n++) {
+    if (e && (e->env_id != other || e->env_status == ENV_FREE))
+      break;
+    start = read_tsc();
+    if ((r = stat(path, &st)) < 0)
+      panic("stat %s: %i", path, r);
+    samples[n] = read_tsc() - start;
+  }
+  return n;
+}
+
+static void
+report(const char *what, size_t n) {
+  if (!n) {
+    printf("%s: no samples\n", what);
+    return;
+  }
+  sort(samples, n);
+  printf("%s: %ld stats, cycles p50 %ld p99 %ld max %ld\n", what, (long)n,
+         (long)samples[n / 2], (long)samples[n * 99 / 100], (long)samples[n - 1]);
+}
+
+void
+umain(int argc, char **argv) {
+  const char *path = "/newmotd";
+  envid_t reader;
+
+  report("idle server", time_stats(path, 0));
+
+  if ((reader = fork()) < 0)
+    panic("fork: %i", reader);
+  if (reader == 0) {
+    read_all();
+    return;
+  }
+  report("during reads", time_stats(path, reader));
+  wait(reader);
+}
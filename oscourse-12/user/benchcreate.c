@@ -0,0 +1,58 @@
+// Create and then remove NFILES empty files in one directory, syncing
+// at the end of each phase, and report files per second along with
+// how the file server's metadata journal batched the changes.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFILES 1000
+
+static void
+report(const char *what, uint64_t cycles, uint64_t hz, struct FsStats *a, struct FsStats *b) {
+  printf("%s: %ld files/sec (%ld cycles each)\n",
+         what, (long)(NFILES * hz / (cycles ? cycles : 1)), (long)(cycles / NFILES));
+  printf("  %ld commits of %ld blocks, %ld checkpoints, %ld write commands\n",
+         (long)(b->jn_commits - a->jn_commits), (long)(b->jn_blocks - a->jn_blocks),
+         (long)(b->jn_ckpts - a->jn_ckpts), (long)(b->io_wrcmds - a->io_wrcmds));
+}
+
+void
+umain(int argc, char **argv) {
+  const char *dir = "/benchcreate.d";
+  char path[MAXPATHLEN];
+  struct FsStats s0, s1, s2;
+  uint64_t hz, start, cycles;
+  int i, fd, r;
+
+  hz = (uint64_t)vsys_tsc_khz() * 1000;
+  if ((fd = open(dir, O_CREAT | O_MKDIR)) < 0)
+    panic("mkdir %s: %i", dir, fd);
+  close(fd);
+
+  if ((r = fs_stats(&s0)) < 0)
+    panic("fs_stats: %i", r);
+  start = read_tsc();
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/f%d", dir, i);
+    if ((fd = open(path, O_CREAT | O_EXCL | O_WRONLY)) < 0)
+      panic("create %s: %i", path, fd);
+    close(fd);
+  }
+  sync();
+  cycles = read_tsc() - start;
+  fs_stats(&s1);
+  report("create", cycles, hz, &s0, &s1);
+
+  start = read_tsc();
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/f%d", dir, i);
+    if ((r = remove(path)) < 0)
+      panic("remove %s: %i", path, r);
+  }
+  sync();
+  cycles = read_tsc() - start;
+  fs_stats(&s2);
+  report("remove", cycles, hz, &s1, &s2);
+
+  remove(dir);
+}
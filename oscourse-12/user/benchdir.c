@@ -0,0 +1,55 @@
+// Measure open() latency in the root directory as it grows to
+// 10,000 files, both for names that exist and for names that don't.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFILES 10000
+#define NPROBE 200
+
+static uint64_t
+time_opens(int nfiles, bool exist) {
+  char name[MAXNAMELEN];
+  uint64_t start;
+  int i, fd;
+
+  start = read_tsc();
+  for (i = 0; i < NPROBE; i++) {
+    snprintf(name, sizeof(name), exist ? "/bench%d" : "/nosuch%d",
+             (int)((i * 7919L) % nfiles));
+    fd = open(name, O_RDONLY);
+    if (exist && fd < 0)
+      panic("open %s: %i", name, fd);
+    if (fd >= 0)
+      close(fd);
+  }
+  return (read_tsc() - start) / NPROBE;
+}
+
+void
+umain(int argc, char **argv) {
+  char name[MAXNAMELEN];
+  int i, n, fd, r;
+
+  n = NFILES;
+  if (argc > 1)
+    n = strtol(argv[1], NULL, 10);
+
+  printf("%8s %16s %16s\n", "files", "open hit (cyc)", "open miss (cyc)");
+  for (i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "/bench%d", i);
+    if ((fd = open(name, O_CREAT | O_RDWR)) < 0)
+      panic("create %s: %i", name, fd);
+    close(fd);
+
+    if (i + 1 == 10 || i + 1 == 100 || i + 1 == 1000 || i + 1 == n)
+      printf("%8d %16ld %16ld\n", i + 1,
+             (long)time_opens(i + 1, 1), (long)time_opens(i + 1, 0));
+  }
+
+  for (i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "/bench%d", i);
+    if ((r = remove(name)) < 0)
+      panic("remove %s: %i", name, r);
+  }
+}
@@ -0,0 +1,65 @@
+// Measure fork+exit of an env with 16 MiB of its own memory: once with
+// a child that exits straight away, and once with one that writes to
+// every page first, so that each is copied on write.  The parent then
+// reads a 64 KiB buffer it had just read before the fork, to see how
+// much of its working set the copies pushed out of the cache.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define MEMSIZE (16 * 1024 * 1024)
+#define ROUNDS  8
+
+static char *mem;
+static char hot[64 * 1024];
+
+// Cycles to read every cache line of the n bytes at p
+static uint64_t
+scan(const char *p, size_t n) {
+  volatile char sink;
+  uint64_t start = read_tsc();
+  size_t i;
+
+  for (i = 0; i < n; i += 64)
+    sink = p[i];
+  (void)sink;
+  return read_tsc() - start;
+}
+
+static void
+run(const char *name, bool touch) {
+  uint64_t start, cycles = 0, rescan = 0;
+  envid_t child;
+  size_t i;
+  int k, r;
+
+  memset(hot, 1, sizeof(hot));
+  for (k = 0; k < ROUNDS; k++) {
+    scan(hot, sizeof(hot));
+    start = read_tsc();
+    if ((child = fork()) < 0)
+      panic("fork: %i", child);
+    if (child == 0) {
+      if (touch)
+        for (i = 0; i < MEMSIZE; i += PGSIZE)
+          mem[i] = k;
+      exit();
+    }
+    if ((r = wait(child)) != 0)
+      panic("wait returned %d", r);
+    cycles += read_tsc() - start;
+    rescan += scan(hot, sizeof(hot));
+  }
+  printf("%s: %ld Kcycles per fork+exit, %ld cycles to read 64 KiB after\n",
+         name, (long)(cycles / ROUNDS >> 10), (long)(rescan / ROUNDS));
+}
+
+void
+umain(int argc, char **argv) {
+  if (!(mem = malloc(MEMSIZE)))
+    panic("malloc of %d bytes failed", MEMSIZE);
+  memset(mem, 1, MEMSIZE);
+
+  run("exit at once", 0);
+  run("write every page", 1);
+}
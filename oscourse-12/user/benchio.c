@@ -0,0 +1,63 @@
+// Mixed random reads and writes on a large file, synced every SYNCOPS
+// operations, and the disk traffic they caused: commands issued after
+// the file server sorted and merged its queued writes, and how far the
+// disk head moved compared to writing every block in arrival order.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define FILEBLOCKS 2048
+#define NOPS       4000
+#define SYNCOPS    64
+
+static char buf[BLKSIZE];
+static uint32_t seed = 1;
+
+static uint32_t
+random(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+umain(int argc, char **argv) {
+  const char *path = "/benchio";
+  struct FsStats s0, s1;
+  uint64_t start, cycles;
+  int fd, i, r, nreads = 0;
+  off_t off;
+
+  if ((fd = open(path, O_CREAT | O_TRUNC | O_RDWR)) < 0)
+    panic("create %s: %i", path, fd);
+  memset(buf, 'b', sizeof(buf));
+  for (i = 0; i < FILEBLOCKS; i++)
+    if ((r = write(fd, buf, sizeof(buf))) != sizeof(buf))
+      panic("write %s: %i", path, r);
+  fsync(fd);
+
+  fs_stats(&s0);
+  start = read_tsc();
+  for (i = 0; i < NOPS; i++) {
+    off = (off_t)(random() % FILEBLOCKS) * BLKSIZE + random() % (BLKSIZE - 512);
+    seek(fd, off);
+    if (random() % 2) {
+      if ((r = read(fd, buf, 512)) != 512)
+        panic("read %s: %i", path, r);
+      nreads++;
+    } else if ((r = write(fd, buf, 512)) != 512)
+      panic("write %s: %i", path, r);
+    if (i % SYNCOPS == SYNCOPS - 1)
+      fsync(fd);
+  }
+  cycles = read_tsc() - start;
+  fs_stats(&s1);
+  close(fd);
+  remove(path);
+
+  printf("%d ops (%d reads): %ld cycles each\n", NOPS, nreads, (long)(cycles / NOPS));
+  printf("disk: %ld reads, %ld writes of %ld blocks\n",
+         (long)(s1.io_rdcmds - s0.io_rdcmds), (long)(s1.io_wrcmds - s0.io_wrcmds),
+         (long)(s1.io_wrblocks - s0.io_wrblocks));
+  printf("seek distance: %ld blocks (%ld in arrival order)\n",
+         (long)(s1.io_seek - s0.io_seek), (long)(s1.io_seek_fifo - s0.io_seek_fifo));
+}
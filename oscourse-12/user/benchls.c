@@ -0,0 +1,76 @@
+// Create a directory of NFILES files and time listing it, once by
+// reading its raw struct File records and once with readdir.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFILES 5000
+
+static const char *dir = "/benchls";
+
+static uint64_t
+list_raw(int *count) {
+  uint64_t start = read_tsc();
+  struct File f;
+  int fd, n;
+
+  *count = 0;
+  if ((fd = open(dir, O_RDONLY)) < 0)
+    panic("open %s: %i", dir, fd);
+  while ((n = readn(fd, &f, sizeof f)) == sizeof f)
+    if (f.f_name[0])
+      ++*count;
+  if (n < 0)
+    panic("read %s: %i", dir, n);
+  close(fd);
+  return read_tsc() - start;
+}
+
+static uint64_t
+list_readdir(int *count) {
+  uint64_t start = read_tsc();
+  struct Dirent de;
+  int fd, r;
+
+  *count = 0;
+  if ((fd = open(dir, O_RDONLY)) < 0)
+    panic("open %s: %i", dir, fd);
+  while ((r = readdir(fd, &de)) > 0)
+    ++*count;
+  if (r < 0)
+    panic("readdir %s: %i", dir, r);
+  close(fd);
+  return read_tsc() - start;
+}
+
+void
+umain(int argc, char **argv) {
+  char path[MAXPATHLEN];
+  uint64_t cycles;
+  int i, fd, n;
+
+  if ((fd = open(dir, O_CREAT | O_MKDIR)) < 0)
+    panic("mkdir %s: %i", dir, fd);
+  close(fd);
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/file%d", dir, i);
+    if ((fd = open(path, O_CREAT)) < 0)
+      panic("create %s: %i", path, fd);
+    close(fd);
+  }
+
+  cycles = list_raw(&n);
+  printf("read:    %d entries, %ld cycles (%ld per entry)\n", n, (long)cycles, (long)(cycles / NFILES));
+  if (n != NFILES)
+    panic("read listed %d entries, expected %d", n, NFILES);
+  cycles = list_readdir(&n);
+  printf("readdir: %d entries, %ld cycles (%ld per entry)\n", n, (long)cycles, (long)(cycles / NFILES));
+  if (n != NFILES)
+    panic("readdir listed %d entries, expected %d", n, NFILES);
+
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/file%d", dir, i);
+    remove(path);
+  }
+  remove(dir);
+}
@@ -0,0 +1,76 @@
+// Measure malloc/free throughput for small objects and for a mix with
+// a few large ones, and how much memory the heap holds against what is
+// live afterwards.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NLIVE  2048
+#define ROUNDS 200000
+
+static void *live[NLIVE];
+static size_t livesize[NLIVE];
+static uint32_t seed = 1;
+
+static uint32_t
+rnd(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// Bytes of pages mapped in the heap
+static size_t
+heap_mapped(void) {
+  uintptr_t va;
+  size_t n = 0;
+
+  for (va = UHEAP; va < UHEAP + UHEAPSIZE; va += PGSIZE) {
+    if (!(uvpml4e[VPML4E(va)] & PTE_P) || !(uvpde[VPDPE(va)] & PTE_P) ||
+        !(uvpd[VPD(va)] & PTE_P)) {
+      va = ROUNDUP(va + 1, PTSIZE) - PGSIZE;
+      continue;
+    }
+    if (uvpt[PGNUM(va)] & PTE_P)
+      n += PGSIZE;
+  }
+  return n;
+}
+
+// Replace a random live object ROUNDS times, with sizes up to maxsmall
+// and one in every nlarge up to 64 KiB.
+static void
+run(const char *name, size_t maxsmall, uint32_t nlarge) {
+  size_t i, n, total = 0;
+  uint64_t start, cycles;
+  int k;
+
+  start = read_tsc();
+  for (i = 0; i < ROUNDS; i++) {
+    k = rnd() % NLIVE;
+    free(live[k]);
+    n = nlarge && rnd() % nlarge == 0 ? rnd() % 65536 : rnd() % maxsmall + 1;
+    if (!(live[k] = malloc(n)))
+      panic("malloc(%ld) failed", (long)n);
+    livesize[k] = n;
+  }
+  cycles = read_tsc() - start;
+
+  for (k = 0; k < NLIVE; k++)
+    total += livesize[k];
+  printf("%s: %ld cycles per malloc/free, %ld KiB live in %ld KiB of heap\n",
+         name, (long)(cycles / ROUNDS), (long)(total / 1024), (long)(heap_mapped() / 1024));
+
+  for (k = 0; k < NLIVE; k++) {
+    free(live[k]);
+    live[k]     = NULL;
+    livesize[k] = 0;
+  }
+}
+
+void
+umain(int argc, char **argv) {
+  run("16-128 B", 128, 0);
+  run("16 B-2 KiB", 2048, 0);
+  run("mixed", 2048, 64);
+  printf("heap after freeing everything: %ld KiB\n", (long)(heap_mapped() / 1024));
+}
@@ -0,0 +1,66 @@
+// Measure open() throughput for a file nested DEPTH directories deep,
+// and for a missing name at the same depth, and report how the file
+// server's name cache fared.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define DEPTH  8
+#define NOPENS 2000
+
+static uint64_t
+time_opens(const char *path, bool exist) {
+  uint64_t start;
+  int i, fd;
+
+  start = read_tsc();
+  for (i = 0; i < NOPENS; i++) {
+    fd = open(path, O_RDONLY);
+    if (exist && fd < 0)
+      panic("open %s: %i", path, fd);
+    if (fd >= 0)
+      close(fd);
+  }
+  return (read_tsc() - start) / NOPENS;
+}
+
+static void
+print_stats(const char *what, struct FsStats *a, struct FsStats *b) {
+  uint64_t hits   = b->dc_hits - a->dc_hits;
+  uint64_t neg    = b->dc_neg_hits - a->dc_neg_hits;
+  uint64_t misses = b->dc_misses - a->dc_misses;
+  uint64_t total  = hits + neg + misses;
+
+  printf("%-8s name cache: %ld hits, %ld negative hits, %ld misses (%ld%% hit)\n",
+         what, (long)hits, (long)neg, (long)misses,
+         total ? (long)((hits + neg) * 100 / total) : 0L);
+}
+
+void
+umain(int argc, char **argv) {
+  char path[MAXPATHLEN], missing[MAXPATHLEN];
+  struct FsStats s0, s1, s2;
+  int i, fd, r;
+  int n = 0;
+
+  for (i = 0; i < DEPTH; i++) {
+    n += snprintf(path + n, sizeof(path) - n, "/benchpath%d", i);
+    if ((fd = open(path, O_CREAT | O_MKDIR)) < 0)
+      panic("mkdir %s: %i", path, fd);
+    close(fd);
+  }
+  snprintf(missing, sizeof(missing), "%s/nosuchfile", path);
+  strcat(path, "/file");
+  if ((fd = open(path, O_CREAT | O_RDWR)) < 0)
+    panic("create %s: %i", path, fd);
+  close(fd);
+
+  if ((r = fs_stats(&s0)) < 0)
+    panic("fs_stats: %i", r);
+  printf("open %s: %ld cycles\n", path, (long)time_opens(path, 1));
+  fs_stats(&s1);
+  print_stats("hit", &s0, &s1);
+  printf("open %s: %ld cycles\n", missing, (long)time_opens(missing, 0));
+  fs_stats(&s2);
+  print_stats("miss", &s1, &s2);
+}
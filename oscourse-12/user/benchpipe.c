@@ -0,0 +1,89 @@
+// Measure throughput through a pipeline shaped like
+// "cat bigfile | cat > /dev/null": a producer writes TOTAL bytes into a
+// pipe, a second env copies them to another pipe the way cat does, and
+// we read and drop them.  Run once per transfer size.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define TOTAL (8 * 1024 * 1024)
+
+static char buf[32 * 1024];
+
+static void
+produce(int fd, size_t chunk) {
+  size_t total;
+  int r;
+
+  for (total = 0; total < TOTAL; total += chunk)
+    if ((r = write(fd, buf, chunk)) != chunk)
+      panic("producer write: %i", r);
+}
+
+static void
+copy(int in, int out, size_t chunk) {
+  int n, r;
+
+  while ((n = read(in, buf, chunk)) > 0)
+    if ((r = write(out, buf, n)) != n)
+      panic("cat write: %i", r);
+  if (n < 0)
+    panic("cat read: %i", n);
+}
+
+static uint64_t
+run(size_t chunk) {
+  envid_t producer, cat;
+  int p1[2], p2[2], n, r;
+  size_t total = 0;
+  uint64_t start;
+
+  if ((r = pipe(p1)) < 0 || (r = pipe(p2)) < 0)
+    panic("pipe: %i", r);
+  start = read_tsc();
+  if ((producer = fork()) < 0)
+    panic("fork: %i", producer);
+  if (producer == 0) {
+    close(p1[0]);
+    close(p2[0]);
+    close(p2[1]);
+    produce(p1[1], chunk);
+    exit();
+  }
+  if ((cat = fork()) < 0)
+    panic("fork: %i", cat);
+  if (cat == 0) {
+    close(p1[1]);
+    close(p2[0]);
+    copy(p1[0], p2[1], chunk);
+    exit();
+  }
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[1]);
+
+  while ((n = read(p2[0], buf, chunk)) > 0)
+    total += n;
+  if (n < 0)
+    panic("read: %i", n);
+  if (total != TOTAL)
+    panic("read %ld bytes, expected %d", (long)total, TOTAL);
+  close(p2[0]);
+  wait(producer);
+  wait(cat);
+  return read_tsc() - start;
+}
+
+void
+umain(int argc, char **argv) {
+  static const size_t chunks[] = {64, 512, 4096, 32768};
+  uint64_t hz, cycles;
+  size_t i;
+
+  hz = (uint64_t)vsys_tsc_khz() * 1000;
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    cycles = run(chunks[i]);
+    printf("%5ld-byte transfers: %ld KB/s\n", (long)chunks[i],
+           (long)((uint64_t)TOTAL / 1024 * hz / (cycles ? cycles : 1)));
+  }
+}
@@ -0,0 +1,69 @@
+// Measure sequential write() and read() throughput of a large file.
+// It is read once into a page-aligned buffer (pages are mapped from the
+// file server's cache) and once into a misaligned one (the server
+// copies the data straight into the buffer's pages).
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define FILESIZE (4 * 1024 * 1024)
+#define CHUNK    (16 * PGSIZE)
+
+static char buf[CHUNK + PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static uint64_t
+time_read(const char *path, char *dst) {
+  uint64_t start;
+  size_t total = 0;
+  int fd, n;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    panic("open %s: %i", path, fd);
+  start = read_tsc();
+  while ((n = read(fd, dst, CHUNK)) > 0)
+    total += n;
+  if (n < 0)
+    panic("read %s: %i", path, n);
+  if (total != FILESIZE)
+    panic("read %ld bytes, expected %d", (long)total, FILESIZE);
+  close(fd);
+  return (read_tsc() - start) / (FILESIZE / (1024 * 1024));
+}
+
+void
+umain(int argc, char **argv) {
+  const char *path = "/benchread";
+  struct FsStats s0, s1, s2;
+  uint64_t start, cycles = 0;
+  int fd, i, j, r;
+
+  if ((fd = open(path, O_CREAT | O_TRUNC | O_RDWR)) < 0)
+    panic("create %s: %i", path, fd);
+  for (i = 0; i < FILESIZE; i += CHUNK) {
+    for (j = 0; j < CHUNK; j += PGSIZE)
+      memset(buf + j, (i + j) / PGSIZE, PGSIZE);
+    start = read_tsc();
+    if ((r = write(fd, buf, CHUNK)) != CHUNK)
+      panic("write %s: %i", path, r);
+    cycles += read_tsc() - start;
+  }
+  close(fd);
+  printf("write: %ld cycles/MB\n", (long)(cycles / (FILESIZE / (1024 * 1024))));
+
+  if ((r = fs_stats(&s0)) < 0)
+    panic("fs_stats: %i", r);
+  printf("copied read: %ld cycles/MB\n", (long)time_read(path, buf + 1));
+  fs_stats(&s1);
+  printf("mapped read: %ld cycles/MB\n", (long)time_read(path, buf));
+  fs_stats(&s2);
+  printf("pages mapped: %ld copied run, %ld mapped run\n",
+         (long)(s1.rd_mapped - s0.rd_mapped), (long)(s2.rd_mapped - s1.rd_mapped));
+
+  // The mapped pages must hold the file's data and be writable.
+  for (i = 0; i < CHUNK; i += PGSIZE)
+    if (buf[i] != (char)((FILESIZE - CHUNK + i) / PGSIZE))
+      panic("bad data at offset %d of last chunk", i);
+  memset(buf, 0, CHUNK);
+
+  remove(path);
+}
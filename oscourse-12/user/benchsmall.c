@@ -0,0 +1,74 @@
+// Count the file server requests and time the ways of getting at a
+// small file: stat by path versus open, fstat and close, and readfile
+// versus open, read and close.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NOPS 200
+
+static const char *path = "/motd";
+static char buf[PGSIZE];
+
+static void
+op_open_fstat(void) {
+  struct Stat st;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    panic("open %s: %i", path, fd);
+  fstat(fd, &st);
+  close(fd);
+}
+
+static void
+op_stat(void) {
+  struct Stat st;
+  int r;
+
+  if ((r = stat(path, &st)) < 0)
+    panic("stat %s: %i", path, r);
+}
+
+static void
+op_open_read(void) {
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    panic("open %s: %i", path, fd);
+  readn(fd, buf, sizeof(buf));
+  close(fd);
+}
+
+static void
+op_readfile(void) {
+  ssize_t r;
+
+  if ((r = readfile(path, buf, sizeof(buf))) < 0)
+    panic("readfile %s: %i", path, (int)r);
+}
+
+static void
+measure(const char *what, void (*op)(void)) {
+  struct FsStats s0, s1;
+  uint64_t start, cycles;
+  int i;
+
+  fs_stats(&s0);
+  start = read_tsc();
+  for (i = 0; i < NOPS; i++)
+    op();
+  cycles = read_tsc() - start;
+  fs_stats(&s1);
+  // Leave out the second fs_stats request itself.
+  printf("%-18s %ld requests, %ld cycles\n", what,
+         (long)((s1.requests - s0.requests - 1) / NOPS), (long)(cycles / NOPS));
+}
+
+void
+umain(int argc, char **argv) {
+  measure("open+fstat+close:", op_open_fstat);
+  measure("stat:", op_stat);
+  measure("open+read+close:", op_open_read);
+  measure("readfile:", op_readfile);
+}
@@ -0,0 +1,68 @@
+// Spawn NSHELLS shells that all sit waiting on the same pipe, and
+// report the time each spawn took and how many physical pages each
+// running shell costs.  Shells share their text pages, mapped from the
+// file server's cache, so the per-shell cost is mostly data and stack.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSHELLS 20
+
+static bool
+va_mapped(const volatile void *va) {
+  return (uvpml4e[VPML4E(va)] & PTE_P) && (uvpde[VPDPE(va)] & PTE_P) &&
+         (uvpd[VPD(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P);
+}
+
+// Count the physical pages with a nonzero reference count.
+static long
+pages_in_use(void) {
+  const volatile struct PageInfo *pp;
+  long n = 0;
+
+  for (pp = pages; (uintptr_t)pp < UPAGES + UPAGES_SIZE; pp++) {
+    if ((uintptr_t)pp % PGSIZE == 0 && !va_mapped(pp))
+      break;
+    if (pp->pp_ref)
+      n++;
+  }
+  return n;
+}
+
+void
+umain(int argc, char **argv) {
+  envid_t shells[NSHELLS];
+  uint64_t start, cycles = 0;
+  long before, after;
+  int p[2], i, r;
+
+  if ((r = pipe(p)) < 0)
+    panic("pipe: %i", r);
+  // The shells read their commands from the pipe, so they block there.
+  if ((r = dup(0, 10)) < 0 || (r = dup(p[0], 0)) < 0)
+    panic("dup: %i", r);
+  close(p[0]);
+
+  before = pages_in_use();
+  for (i = 0; i < NSHELLS; i++) {
+    start = read_tsc();
+    if ((shells[i] = spawnl("/sh", "sh", NULL)) < 0)
+      panic("spawn sh: %i", shells[i]);
+    cycles += read_tsc() - start;
+  }
+  // Let every shell get as far as its first read.
+  for (i = 0; i < 10 * NSHELLS; i++)
+    sys_yield();
+  after = pages_in_use();
+
+  // Restore our stdin; closing the write end lets the shells exit.
+  dup(10, 0);
+  close(10);
+  close(p[1]);
+  for (i = 0; i < NSHELLS; i++)
+    wait(shells[i]);
+
+  printf("spawn: %ld cycles each\n", (long)(cycles / NSHELLS));
+  printf("pages in use: %ld before, %ld with %d shells (%ld per shell)\n",
+         before, after, NSHELLS, (after - before) / NSHELLS);
+}
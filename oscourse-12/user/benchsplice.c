@@ -0,0 +1,64 @@
+// Measure throughput of 1 MiB transfers through a pipe between two
+// envs, once with page-aligned buffers on both sides, where whole pages
+// are handed over instead of copied, and once with misaligned ones,
+// where every byte goes through the pipe's ring.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define XFER   (1024 * 1024)
+#define ROUNDS 16
+
+static char wbuf[XFER + PGSIZE] __attribute__((aligned(PGSIZE)));
+static char rbuf[XFER + PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static uint64_t
+run(size_t off) {
+  uint64_t start;
+  envid_t writer;
+  int p[2], i, r;
+  size_t n, j;
+
+  if ((r = pipe(p)) < 0)
+    panic("pipe: %i", r);
+  start = read_tsc();
+  if ((writer = fork()) < 0)
+    panic("fork: %i", writer);
+  if (writer == 0) {
+    close(p[0]);
+    for (i = 0; i < ROUNDS; i++)
+      if ((r = write(p[1], wbuf + off, XFER)) != XFER)
+        panic("write: %i", r);
+    exit();
+  }
+  close(p[1]);
+
+  for (i = 0; i < ROUNDS; i++) {
+    for (n = 0; n < XFER; n += r)
+      if ((r = read(p[0], rbuf + off + n, XFER - n)) <= 0)
+        panic("read: %i", r);
+    for (j = 0; j < XFER; j += PGSIZE)
+      if (rbuf[off + j] != (char)(j / PGSIZE))
+        panic("bad data at %ld in round %d", (long)j, i);
+  }
+  close(p[0]);
+  wait(writer);
+  return read_tsc() - start;
+}
+
+void
+umain(int argc, char **argv) {
+  uint64_t hz, cycles;
+  size_t j;
+
+  for (j = 0; j < XFER; j += PGSIZE)
+    memset(wbuf + j, j / PGSIZE, PGSIZE);
+  hz = (uint64_t)vsys_tsc_khz() * 1000;
+
+  cycles = run(0);
+  printf("aligned: %ld MB/s\n", (long)((uint64_t)ROUNDS * hz / (cycles ? cycles : 1)));
+  // Shift the data so that wbuf + 1 holds the same bytes as wbuf did.
+  memmove(wbuf + 1, wbuf, XFER);
+  cycles = run(1);
+  printf("misaligned: %ld MB/s\n", (long)((uint64_t)ROUNDS * hz / (cycles ? cycles : 1)));
+}
@@ -0,0 +1,114 @@
+// Measure memcpy, memset, memcmp and strlen across sizes and
+// alignments, with the generic routines and with the vector ones
+// string_init picks for this CPU.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define MAXSIZE (64 * 1024)
+#define BYTES   (8 * 1024 * 1024) // moved per measurement
+
+static char src[MAXSIZE + 64] __attribute__((aligned(64)));
+static char dst[MAXSIZE + 64] __attribute__((aligned(64)));
+
+static const size_t sizes[] = {8, 64, 256, 1024, 4096, MAXSIZE};
+
+// Source and destination offsets from 64-byte alignment
+static const struct {
+  int soff, doff;
+} aligns[] = {{0, 0}, {1, 0}, {3, 13}};
+
+#define NSIZES  (sizeof(sizes) / sizeof(sizes[0]))
+#define NALIGNS (sizeof(aligns) / sizeof(aligns[0]))
+
+enum { OP_MEMCPY,
+       OP_MEMSET,
+       OP_MEMCMP,
+       OP_STRLEN,
+       NOPS };
+
+static const char *const opnames[NOPS] = {"memcpy", "memset", "memcmp", "strlen"};
+
+// Cycles per call of op over n bytes at the given offsets
+static uint64_t
+measure(int op, size_t n, int soff, int doff) {
+  size_t i, rounds = MAX(BYTES / n, 64);
+  char *s = src + soff, *d = dst + doff;
+  uint64_t start;
+  volatile int sink = 0;
+
+  memset(s, 'x', n);
+  s[n - 1] = '\0';
+  memcpy(d, s, n);
+
+  start = read_tsc();
+  for (i = 0; i < rounds; i++) {
+    switch (op) {
+    case OP_MEMCPY:
+      memcpy(d, s, n);
+      break;
+    case OP_MEMSET:
+      memset(d, (int)i, n);
+      break;
+    case OP_MEMCMP:
+      sink += memcmp(d, s, n);
+      break;
+    case OP_STRLEN:
+      sink += strlen(s);
+      break;
+    }
+  }
+  return (read_tsc() - start) / rounds;
+}
+
+// The two versions must agree before their times mean anything.
+static void
+check(size_t n, int soff, int doff) {
+  char *s = src + soff, *d = dst + doff;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    s[i] = 'a' + i % 23;
+  s[n - 1] = '\0';
+  memset(d, 0, n);
+  memcpy(d, s, n);
+  for (i = 0; i < n; i++)
+    if (d[i] != s[i])
+      panic("memcpy of %ld bytes wrong at %ld", (long)n, (long)i);
+  if (memcmp(d, s, n) != 0 || strlen(s) != n - 1)
+    panic("memcmp or strlen of %ld bytes wrong", (long)n);
+  d[n / 2]++;
+  if (memcmp(d, s, n) <= 0 || memcmp(s, d, n) >= 0)
+    panic("memcmp of %ld bytes misses a difference", (long)n);
+  memset(d, 'z', n);
+  for (i = 0; i < n; i++)
+    if (d[i] != 'z')
+      panic("memset of %ld bytes wrong at %ld", (long)n, (long)i);
+}
+
+void
+umain(int argc, char **argv) {
+  static uint64_t cycles[2][NOPS][NALIGNS][NSIZES];
+  size_t i, j;
+  int v, op;
+
+  for (v = 0; v < 2; v++) {
+    string_init(v);
+    for (i = 0; i < NSIZES; i++)
+      for (j = 0; j < NALIGNS; j++) {
+        check(sizes[i], aligns[j].soff, aligns[j].doff);
+        for (op = 0; op < NOPS; op++)
+          cycles[v][op][j][i] = measure(op, sizes[i], aligns[j].soff, aligns[j].doff);
+      }
+  }
+
+  printf("cycles per call, generic -> vector\n");
+  for (op = 0; op < NOPS; op++)
+    for (j = 0; j < NALIGNS; j++) {
+      printf("%s +%d/+%d:", opnames[op], aligns[j].soff, aligns[j].doff);
+      for (i = 0; i < NSIZES; i++)
+        printf("  %ld: %ld -> %ld", (long)sizes[i],
+               (long)cycles[0][op][j][i], (long)cycles[1][op][j][i]);
+      printf("\n");
+    }
+}
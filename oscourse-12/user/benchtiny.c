@@ -0,0 +1,70 @@
+// Build two trees of NFILES small files, one of files small enough to
+// be stored inline in their directory entries and one of files just too
+// big for that, and report the disk blocks each tree uses and the time
+// to read every file in it.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFILES 500
+
+static char data[PGSIZE];
+
+static void
+mktree(const char *dir, size_t size) {
+  char path[MAXPATHLEN];
+  int i, fd, r;
+
+  if ((fd = open(dir, O_CREAT | O_MKDIR)) < 0)
+    panic("mkdir %s: %i", dir, fd);
+  close(fd);
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/f%d", dir, i);
+    if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY)) < 0)
+      panic("create %s: %i", path, fd);
+    if ((r = write(fd, data, size)) != size)
+      panic("write %s: %i", path, r);
+    close(fd);
+  }
+}
+
+static void
+measure(const char *dir, size_t size) {
+  char path[MAXPATHLEN];
+  uint64_t start, cycles, nblocks = 0;
+  struct Stat st;
+  ssize_t n;
+  int i, r;
+
+  mktree(dir, size);
+  if ((r = stat(dir, &st)) < 0)
+    panic("stat %s: %i", dir, r);
+  nblocks = st.st_nblocks;
+
+  start = read_tsc();
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/f%d", dir, i);
+    if ((n = readfile(path, data, sizeof(data))) != size)
+      panic("readfile %s: %i", path, (int)n);
+  }
+  cycles = read_tsc() - start;
+
+  for (i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), "%s/f%d", dir, i);
+    if ((r = stat(path, &st)) < 0)
+      panic("stat %s: %i", path, r);
+    nblocks += st.st_nblocks;
+    remove(path);
+  }
+  remove(dir);
+
+  printf("%d files of %ld bytes: %ld blocks, %ld cycles per read\n",
+         NFILES, (long)size, (long)nblocks, (long)(cycles / NFILES));
+}
+
+void
+umain(int argc, char **argv) {
+  memset(data, 'x', sizeof(data));
+  measure("/tinyinline", FILE_INLINE_MAX);
+  measure("/tinyblocks", FILE_INLINE_MAX + 1);
+}
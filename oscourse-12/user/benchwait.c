@@ -0,0 +1,52 @@
+// Measure what a parent waiting for a busy child costs, the way sh
+// waits for a command: once polling envs[] around sys_yield, as wait
+// used to, and once blocked in sys_env_wait.  Reports how often the
+// parent was put on the CPU and how long the child took to finish a
+// fixed amount of work.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define WORK (1UL << 28)
+
+static void
+poll_wait(envid_t envid) {
+  const volatile struct Env *e = &envs[ENVX(envid)];
+
+  while (e->env_id == envid && e->env_status != ENV_FREE)
+    sys_yield();
+}
+
+static void
+run(const char *name, bool polling) {
+  volatile uint64_t i;
+  uint64_t start, cycles;
+  uint32_t runs;
+  envid_t child;
+  int r;
+
+  runs  = thisenv->env_runs;
+  start = read_tsc();
+  if ((child = fork()) < 0)
+    panic("fork: %i", child);
+  if (child == 0) {
+    for (i = 0; i < WORK; i++)
+      /* spin */;
+    exitstatus(42);
+  }
+
+  if (polling) {
+    poll_wait(child);
+  } else if ((r = wait(child)) != 42) {
+    panic("wait returned %d", r);
+  }
+  cycles = read_tsc() - start;
+  printf("%s: parent ran %u times, child took %ld Mcycles\n",
+         name, thisenv->env_runs - runs, (long)(cycles >> 20));
+}
+
+void
+umain(int argc, char **argv) {
+  run("polling", 1);
+  run("sys_env_wait", 0);
+}
@@ -0,0 +1,70 @@
+// Measure sys_page_alloc in bursts: once after a pause in which the
+// kernel has time to zero pages ahead, and once in bursts back to
+// back, once the pool of zeroed pages has run dry.  Reports cycles per
+// page and how many allocations the pool served.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define BURST  256 // pages per burst
+#define ROUNDS 8
+#define PAUSE  20 // ms
+
+static char *buf;
+
+// Map BURST fresh pages at buf and unmap them again.  Returns the
+// cycles the mapping took.
+static uint64_t
+burst(void) {
+  uint64_t start, cycles;
+  int i, r;
+
+  start = read_tsc();
+  for (i = 0; i < BURST; i++)
+    if ((r = sys_page_alloc(0, buf + i * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+      panic("sys_page_alloc: %i", r);
+  cycles = read_tsc() - start;
+  for (i = 0; i < BURST; i++)
+    sys_page_unmap(0, buf + i * PGSIZE);
+  return cycles;
+}
+
+static void
+run(const char *name, bool pause) {
+  uint64_t cycles = 0;
+  int hits, misses, k;
+
+  // Drain the pool first, so that only pauses refill it.
+  while (vsys_zero_pages() > 0)
+    burst();
+
+  hits   = vsys_zero_hits();
+  misses = vsys_zero_misses();
+  for (k = 0; k < ROUNDS; k++) {
+    if (pause)
+      poll(NULL, 0, PAUSE);
+    cycles += burst();
+  }
+  hits   = vsys_zero_hits() - hits;
+  misses = vsys_zero_misses() - misses;
+  printf("%s: %ld cycles per sys_page_alloc, %d of %d zeroed pages from the pool\n",
+         name, (long)(cycles / (ROUNDS * BURST)), hits, hits + misses);
+}
+
+void
+umain(int argc, char **argv) {
+  int i;
+
+  if (!(buf = malloc(BURST * PGSIZE)))
+    panic("malloc of %d pages failed", BURST);
+  for (i = 0; i < BURST; i++)
+    sys_page_unmap(0, buf + i * PGSIZE);
+
+  run("back to back", 0);
+  run("after a pause", 1);
+  printf("pool holds %d pages\n", vsys_zero_pages());
+
+  for (i = 0; i < BURST; i++)
+    sys_page_alloc(0, buf + i * PGSIZE, PTE_P | PTE_U | PTE_W);
+  free(buf);
+}
@@ -8,7 +8,7 @@ handler(struct UTrapframe *utf) {
   uint64_t err = utf->utf_err;
   cprintf("i faulted at va %lx, err %x\n",
           (unsigned long)addr, (unsigned)(err & 7));
-  sys_env_destroy(sys_getenvid());
+  sys_env_destroy(sys_getenvid(), 0);
 }
 
 void
@@ -4,6 +4,7 @@ int flag[256];
 
 void lsdir(const char *, const char *);
 void ls1(const char *, bool, off_t, const char *);
+void lsextents(const char *, const char *, const char *);
 
 void
 ls(const char *path, const char *prefix) {
@@ -20,33 +21,46 @@ ls(const char *path, const char *prefix) {
 
 void
 lsdir(const char *path, const char *prefix) {
-  int fd, n;
-  struct File f;
+  int fd, r;
+  struct Dirent de;
 
   if ((fd = open(path, O_RDONLY)) < 0)
     panic("open %s: %i", path, fd);
-  while ((n = readn(fd, &f, sizeof f)) == sizeof f)
-    if (f.f_name[0])
-      ls1(prefix, f.f_type == FTYPE_DIR, f.f_size, f.f_name);
-  if (n > 0)
-    panic("short read in directory %s", path);
-  if (n < 0)
-    panic("error reading directory %s: %i", path, n);
+  while ((r = readdir(fd, &de)) > 0)
+    ls1(prefix, de.d_isdir, de.d_size, de.d_name);
+  if (r < 0)
+    panic("error reading directory %s: %i", path, r);
+  close(fd);
+}
+
+// Print how name is laid out on disk: its blocks, the number of
+// contiguous extents they form, and the share of block boundaries that
+// are not contiguous (0% for a file stored in one piece).
+void
+lsextents(const char *prefix, const char *sep, const char *name) {
+  char path[MAXPATHLEN];
+  struct Stat st;
+  int r;
+
+  snprintf(path, sizeof(path), "%s%s%s", prefix, sep, name);
+  if ((r = stat(path, &st)) < 0)
+    panic("stat %s: %i", path, r);
+  printf("%8ld %6u %3ld%% ", (long)st.st_nblocks, st.st_nextents,
+         st.st_nblocks > 1 ? (long)((st.st_nextents - 1) * 100 / (st.st_nblocks - 1)) : 0L);
 }
 
 void
 ls1(const char *prefix, bool isdir, off_t size, const char *name) {
-  const char *sep;
+  const char *sep = "";
 
+  if (prefix && prefix[0] && prefix[strlen(prefix) - 1] != '/')
+    sep = "/";
   if (flag['l'])
-    printf("%11d %c ", size, isdir ? 'd' : '-');
-  if (prefix) {
-    if (prefix[0] && prefix[strlen(prefix) - 1] != '/')
-      sep = "/";
-    else
-      sep = "";
+    printf("%11ld %c ", (long)size, isdir ? 'd' : '-');
+  if (flag['e'])
+    lsextents(prefix ? prefix : "", sep, name);
+  if (prefix)
     printf("%s%s", prefix, sep);
-  }
   printf("%s", name);
   if (flag['F'] && isdir)
     printf("/");
@@ -55,7 +69,7 @@ ls1(const char *prefix, bool isdir, off_t size, const char *name) {
 
 void
 usage(void) {
-  printf("usage: ls [-dFl] [file...]\n");
+  printf("usage: ls [-deFl] [file...]\n");
   exit();
 }
 
@@ -68,6 +82,7 @@ umain(int argc, char **argv) {
   while ((i = argnext(&args)) >= 0)
     switch (i) {
       case 'd':
+      case 'e':
       case 'F':
       case 'l':
         flag[i]++;
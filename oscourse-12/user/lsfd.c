@@ -22,12 +22,12 @@ umain(int argc, char **argv) {
   for (i = 0; i < 32; i++)
     if (fstat(i, &st) >= 0) {
       if (usefprint)
-        fprintf(1, "fd %d: name %s isdir %d size %d dev %s\n",
+        fprintf(1, "fd %d: name %s isdir %d size %ld dev %s\n",
                 i, st.st_name, st.st_isdir,
-                st.st_size, st.st_dev->dev_name);
+                (long)st.st_size, st.st_dev->dev_name);
       else
-        cprintf("fd %d: name %s isdir %d size %d dev %s\n",
+        cprintf("fd %d: name %s isdir %d size %ld dev %s\n",
                 i, st.st_name, st.st_isdir,
-                st.st_size, st.st_dev->dev_name);
+                (long)st.st_size, st.st_dev->dev_name);
     }
 }
@@ -253,6 +253,55 @@ usage(void) {
   exit();
 }
 
+// A command file is read whole, in one file server request if it fits,
+// into pages allocated at SCRIPTVA, and its lines are run from there.
+#define SCRIPTVA       ((char *)0xE0000000)
+#define SCRIPTMAXPAGES 64
+
+static char *script;
+
+// Read the command file path into memory and set up script.
+// Returns false if it is too big, leaving script unset.
+bool
+loadscript(const char *path) {
+  size_t npages = 0, want = 1;
+  ssize_t n;
+  int r;
+
+  // Start with a page and grow until the whole file fits.
+  for (;;) {
+    for (; npages < want; npages++)
+      if ((r = sys_page_alloc(0, SCRIPTVA + npages * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+        panic("sys_page_alloc: %i", r);
+    if ((n = readfile(path, SCRIPTVA, npages * PGSIZE - 1)) < 0)
+      panic("open %s: %i", path, (int)n);
+    if (n < npages * PGSIZE - 1)
+      break;
+    if (npages == SCRIPTMAXPAGES) {
+      for (; npages > 0; npages--)
+        sys_page_unmap(0, SCRIPTVA + (npages - 1) * PGSIZE);
+      return 0;
+    }
+    want = MIN(2 * npages, SCRIPTMAXPAGES);
+  }
+  SCRIPTVA[n] = 0;
+  script      = SCRIPTVA;
+  return 1;
+}
+
+// Return the next line of the script, or NULL at its end.
+char *
+scriptline(void) {
+  char *line = script;
+
+  if (!*script)
+    return NULL;
+  script = strfind(script, '\n');
+  if (*script)
+    *script++ = 0;
+  return line;
+}
+
 void
 umain(int argc, char **argv) {
   int r, interactive, echocmds;
@@ -277,19 +326,19 @@ umain(int argc, char **argv) {
 
   if (argc > 2)
     usage();
-  if (argc == 2) {
+  if (argc == 2 && !loadscript(argv[1])) {
     close(0);
     if ((r = open(argv[1], O_RDONLY)) < 0)
       panic("open %s: %i", argv[1], r);
     assert(r == 0);
   }
   if (interactive == '?')
-    interactive = iscons(0);
+    interactive = !script && iscons(0);
 
   while (1) {
     char *buf;
 
-    buf = readline(interactive ? "$ " : NULL);
+    buf = script ? scriptline() : readline(interactive ? "$ " : NULL);
     if (buf == NULL) {
       if (debug)
         cprintf("EXITING\n");
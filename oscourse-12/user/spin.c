@@ -25,5 +25,5 @@ umain(int argc, char **argv) {
   sys_yield();
 
   cprintf("I am the parent.  Killing the child...\n");
-  sys_env_destroy(env);
+  sys_env_destroy(env, 0);
 }
@@ -0,0 +1,89 @@
+// Check O_BUFFERED write-behind: small writes reach the file by
+// fsync and close, reads and seeks on the same fd see them, and a
+// parent and child writing through one shared fd lose no records.
+
+#include <inc/lib.h>
+
+#define PATH    "/testbuffered"
+#define RECSIZE 16
+#define NRECS   1000
+
+static char rec[RECSIZE], buf[RECSIZE];
+
+// Fill rec with c
+static void
+fill(char c) {
+  memset(rec, c, RECSIZE);
+}
+
+// Append NRECS records of c to fd
+static void
+put(int fd, char c) {
+  int i, r;
+
+  fill(c);
+  for (i = 0; i < NRECS; i++)
+    if ((r = write(fd, rec, RECSIZE)) != RECSIZE)
+      panic("write: %i", r);
+}
+
+// Read PATH through a fresh unbuffered fd and count records of a and
+// of b; every record must be whole.
+static void
+check(off_t size, char a, int na, char b, int nb) {
+  struct Stat st;
+  int fd, i, r, ca = 0, cb = 0;
+
+  if ((fd = open(PATH, O_RDONLY)) < 0)
+    panic("open %s: %i", PATH, fd);
+  if ((r = fstat(fd, &st)) < 0)
+    panic("fstat: %i", r);
+  if (st.st_size != size)
+    panic("size is %ld, not %ld", (long)st.st_size, (long)size);
+  for (i = 0; i < size / RECSIZE; i++) {
+    if ((r = readn(fd, buf, RECSIZE)) != RECSIZE)
+      panic("readn: %i", r);
+    fill(buf[0]);
+    if (memcmp(buf, rec, RECSIZE) != 0)
+      panic("record %d is torn", i);
+    ca += buf[0] == a;
+    cb += buf[0] == b;
+  }
+  close(fd);
+  if (ca != na || cb != nb)
+    panic("%d records of %c and %d of %c, not %d and %d", ca, a, cb, b, na, nb);
+}
+
+void
+umain(int argc, char **argv) {
+  envid_t child;
+  int fd, r;
+
+  if ((fd = open(PATH, O_RDWR | O_CREAT | O_TRUNC | O_BUFFERED)) < 0)
+    panic("open %s: %i", PATH, fd);
+
+  put(fd, 'a');
+  if ((r = fsync(fd)) < 0)
+    panic("fsync: %i", r);
+  check(NRECS * RECSIZE, 'a', NRECS, 'b', 0);
+
+  put(fd, 'b');
+  if ((r = seek(fd, (NRECS * 2 - 1) * RECSIZE)) < 0)
+    panic("seek: %i", r);
+  if ((r = readn(fd, buf, RECSIZE)) != RECSIZE || buf[0] != 'b')
+    panic("read back after seek: %i", r);
+  check(2 * NRECS * RECSIZE, 'a', NRECS, 'b', NRECS);
+  cprintf("write-behind on one fd OK\n");
+
+  if ((r = ftruncate(fd, 0)) < 0 || (r = seek(fd, 0)) < 0)
+    panic("truncate: %i", r);
+  if ((child = fork()) < 0)
+    panic("fork: %i", child);
+  put(fd, child ? 'p' : 'c');
+  if (child == 0)
+    exit();
+  wait(child);
+  close(fd);
+  check(2 * NRECS * RECSIZE, 'p', NRECS, 'c', NRECS);
+  cprintf("write-behind shared across fork OK\n");
+}
@@ -0,0 +1,42 @@
+// Check futex wait and wake between a parent and a child sharing a
+// page, along with the early returns of sys_futex_wait.
+
+#include <inc/lib.h>
+
+#define VA ((volatile uint32_t *)0xA000000)
+
+void
+umain(int argc, char **argv) {
+  const volatile struct Env *e;
+  envid_t child;
+  int r;
+
+  if ((r = sys_page_alloc(0, (void *)VA, PTE_P | PTE_W | PTE_U | PTE_SHARE)) < 0)
+    panic("sys_page_alloc: %i", r);
+
+  if ((r = sys_futex_wait(VA, 1, 0)) != -E_AGAIN)
+    panic("wait on a changed word: %i", r);
+  if ((r = sys_futex_wait(VA, 0, 50)) != -E_TIMEOUT)
+    panic("wait with a timeout: %i", r);
+  if ((r = sys_futex_wake(VA, 1)) != 0)
+    panic("wake with no waiters: %i", r);
+
+  if ((child = fork()) < 0)
+    panic("fork: %i", child);
+  if (child == 0) {
+    while (*VA == 0)
+      if ((r = sys_futex_wait(VA, 0, 0)) < 0 && r != -E_AGAIN)
+        panic("child wait: %i", r);
+    exit();
+  }
+
+  e = &envs[ENVX(child)];
+  while (e->env_status != ENV_NOT_RUNNABLE)
+    sys_yield();
+  *VA = 1;
+  if ((r = sys_futex_wake(VA, 1)) != 1)
+    panic("wake woke %d envs", r);
+  wait(child);
+
+  cprintf("futex tests passed\n");
+}
@@ -55,7 +55,7 @@ umain(int argc, char **argv) {
   while (kid->env_status == ENV_RUNNABLE)
     if (pipeisclosed(p[0]) != 0) {
       cprintf("\nRACE: pipe appears closed\n");
-      sys_env_destroy(r);
+      sys_env_destroy(r, 0);
       exit();
     }
   cprintf("child done with loop\n");
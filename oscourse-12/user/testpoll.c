@@ -0,0 +1,70 @@
+// Check poll with a single reader on 64 pipes, fed one word each, in
+// a scattered order, by a child.
+
+#include <inc/lib.h>
+
+#define NPIPES 64
+
+static int rfd[NPIPES], wfd[NPIPES];
+static struct pollfd fds[NPIPES];
+
+void
+umain(int argc, char **argv) {
+  bool seen[NPIPES] = {0};
+  int i, k, n, r, got, p[2];
+  envid_t writer;
+
+  for (i = 0; i < NPIPES; i++) {
+    if ((r = pipe(p)) < 0)
+      panic("pipe %d: %i", i, r);
+    rfd[i]        = p[0];
+    wfd[i]        = p[1];
+    fds[i].fd     = p[0];
+    fds[i].events = POLLIN;
+  }
+
+  if ((r = poll(fds, NPIPES, 0)) != 0)
+    panic("poll of empty pipes: %d", r);
+  if ((r = poll(fds, NPIPES, 100)) != 0)
+    panic("poll with a timeout: %d", r);
+
+  if ((writer = fork()) < 0)
+    panic("fork: %i", writer);
+  if (writer == 0) {
+    for (i = 0; i < NPIPES; i++)
+      close(rfd[i]);
+    for (k = 0; k < NPIPES; k++) {
+      i = k * 37 % NPIPES;
+      if ((r = write(wfd[i], &i, sizeof(i))) != sizeof(i))
+        panic("write to pipe %d: %i", i, r);
+      sys_yield();
+    }
+    exit();
+  }
+  for (i = 0; i < NPIPES; i++)
+    close(wfd[i]);
+
+  for (got = 0; got < NPIPES;) {
+    if ((n = poll(fds, NPIPES, -1)) <= 0)
+      panic("poll: %d", n);
+    for (i = 0; i < NPIPES; i++) {
+      if (!(fds[i].revents & POLLIN))
+        continue;
+      if ((r = readn(rfd[i], &k, sizeof(k))) != sizeof(k) || k != i)
+        panic("read from pipe %d: %i, %d", i, r, k);
+      if (seen[i])
+        panic("pipe %d ready twice", i);
+      seen[i] = 1;
+      got++;
+    }
+  }
+  wait(writer);
+
+  if ((r = poll(fds, NPIPES, -1)) != NPIPES)
+    panic("poll of closed pipes: %d", r);
+  for (i = 0; i < NPIPES; i++)
+    if (fds[i].revents != POLLHUP)
+      panic("pipe %d: revents %x", i, fds[i].revents);
+
+  cprintf("poll tests passed\n");
+}